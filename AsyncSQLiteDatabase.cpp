@@ -0,0 +1,389 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "AsyncSQLiteDatabase.h"
+
+#include "SQLiteLog.h"
+#include "SQLiteStatement.h"
+#include "SQLiteTransaction.h"
+
+#include <exception>
+
+AsyncSQLiteDatabase::AsyncSQLiteDatabase()
+    : m_stopping(false)
+{
+    m_thread = std::thread(&AsyncSQLiteDatabase::run, this);
+}
+
+AsyncSQLiteDatabase::~AsyncSQLiteDatabase()
+{
+    post([](SQLiteDatabase& db) { db.close(); });
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_one();
+    m_thread.join();
+}
+
+void AsyncSQLiteDatabase::post(const std::function<void(SQLiteDatabase&)>& work)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_tasks.push_back(work);
+    }
+    m_wakeUp.notify_one();
+}
+
+size_t AsyncSQLiteDatabase::pendingTaskCount() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_tasks.size();
+}
+
+void AsyncSQLiteDatabase::run()
+{
+    std::deque<std::function<void(SQLiteDatabase&)> > batch;
+    std::unique_lock<std::mutex> lock(m_lock);
+    for (;;) {
+        m_wakeUp.wait(lock, [this]() { return m_stopping || !m_tasks.empty(); });
+        if (m_tasks.empty())
+            return;
+
+        // Take everything queued so far and run it without going back to the
+        // queue, so requests arriving together are pipelined.
+        batch.swap(m_tasks);
+        lock.unlock();
+        for (size_t i = 0; i < batch.size(); ++i) {
+            // A throwing task must not take the worker, and every task queued
+            // after it, down with it.
+            try {
+                batch[i](m_database);
+            } catch (const std::exception& exception) {
+                SQLITE_LOG(ERROR) << "Exception thrown by an AsyncSQLiteDatabase task - " << exception.what();
+            } catch (...) {
+                SQLITE_LOG(ERROR) << "Exception thrown by an AsyncSQLiteDatabase task";
+            }
+        }
+        batch.clear();
+        lock.lock();
+    }
+}
+
+std::future<bool> AsyncSQLiteDatabase::open(const std::string& filename)
+{
+    return submit([filename](SQLiteDatabase& db) { return db.open(filename); });
+}
+
+std::future<void> AsyncSQLiteDatabase::close()
+{
+    return submit([](SQLiteDatabase& db) { db.close(); });
+}
+
+bool AsyncSQLiteDatabase::runExecute(SQLiteDatabase& db, const std::string& sql, const Binder& binder)
+{
+    SQLiteStatement statement(db, sql);
+    if (statement.prepare() != SQLResultOk)
+        return false;
+    if (binder)
+        binder(statement);
+    return statement.executeCommand();
+}
+
+AsyncSQLiteDatabase::QueryResult AsyncSQLiteDatabase::runQuery(SQLiteDatabase& db, const std::string& sql, const Binder& binder)
+{
+    QueryResult result;
+    SQLiteStatement statement(db, sql);
+    result.result = statement.prepare();
+    if (result.result != SQLResultOk)
+        return result;
+    if (binder)
+        binder(statement);
+
+    while ((result.result = statement.step()) == SQLResultRow) {
+        int columns = statement.columnCount();
+        if (result.columnNames.empty()) {
+            for (int i = 0; i < columns; ++i)
+                result.columnNames.push_back(statement.getColumnName(i));
+        }
+
+        std::vector<SQLValue> row;
+        row.reserve(columns);
+        for (int i = 0; i < columns; ++i)
+            row.push_back(statement.getColumnValue(i));
+        result.rows.push_back(std::move(row));
+    }
+    statement.finalize();
+    return result;
+}
+
+bool AsyncSQLiteDatabase::runTransaction(SQLiteDatabase& db, const std::function<bool(SQLiteDatabase&)>& body)
+{
+    SQLiteTransaction transaction(db);
+    transaction.begin();
+    if (!transaction.inProgress())
+        return false;
+    if (!body(db)) {
+        transaction.rollback();
+        return false;
+    }
+    transaction.commit();
+    return !transaction.inProgress();
+}
+
+std::future<bool> AsyncSQLiteDatabase::executeAsync(const std::string& sql, const Binder& binder)
+{
+    return submit([sql, binder](SQLiteDatabase& db) { return runExecute(db, sql, binder); });
+}
+
+void AsyncSQLiteDatabase::executeAsync(const std::string& sql, const Binder& binder, const Completion& completion)
+{
+    post([sql, binder, completion](SQLiteDatabase& db) {
+        bool result = false;
+        try {
+            result = runExecute(db, sql, binder);
+        } catch (...) {
+            SQLITE_LOG(ERROR) << "Exception thrown by the binder of " << sql;
+        }
+        completion(result);
+    });
+}
+
+std::future<AsyncSQLiteDatabase::QueryResult> AsyncSQLiteDatabase::queryAsync(const std::string& sql, const Binder& binder)
+{
+    return submit([sql, binder](SQLiteDatabase& db) { return runQuery(db, sql, binder); });
+}
+
+void AsyncSQLiteDatabase::queryAsync(const std::string& sql, const Binder& binder, const QueryCompletion& completion)
+{
+    post([sql, binder, completion](SQLiteDatabase& db) {
+        QueryResult result;
+        try {
+            result = runQuery(db, sql, binder);
+        } catch (...) {
+            SQLITE_LOG(ERROR) << "Exception thrown by the binder of " << sql;
+            result = QueryResult();
+            result.result = SQLResultError;
+        }
+        completion(std::move(result));
+    });
+}
+
+std::future<bool> AsyncSQLiteDatabase::transactionAsync(const std::function<bool(SQLiteDatabase&)>& body)
+{
+    return submit([body](SQLiteDatabase& db) { return runTransaction(db, body); });
+}
+
+void AsyncSQLiteDatabase::transactionAsync(const std::function<bool(SQLiteDatabase&)>& body, const Completion& completion)
+{
+    post([body, completion](SQLiteDatabase& db) {
+        // The transaction rolls back as the exception leaves runTransaction().
+        bool result = false;
+        try {
+            result = runTransaction(db, body);
+        } catch (...) {
+            SQLITE_LOG(ERROR) << "Exception thrown by a transaction body";
+        }
+        completion(result);
+    });
+}
+
+int AsyncSQLiteDatabase::readRows(SQLiteStatement& statement, size_t maxRows, std::vector<std::vector<SQLValue> >& rows)
+{
+    int result = SQLResultRow;
+    while (rows.size() < maxRows && (result = statement.step()) == SQLResultRow) {
+        int columns = statement.columnCount();
+        std::vector<SQLValue> row;
+        row.reserve(columns);
+        for (int i = 0; i < columns; ++i)
+            row.push_back(statement.getColumnValue(i));
+        rows.push_back(std::move(row));
+    }
+    return rows.size() < maxRows ? result : SQLResultRow;
+}
+
+#if SQLITE_HAS_COROUTINES
+SQLiteAwaitable<bool> AsyncSQLiteDatabase::execute(const std::string& sql, const Binder& binder)
+{
+    return SQLiteAwaitable<bool>(*this, [sql, binder](SQLiteDatabase& db) { return runExecute(db, sql, binder); });
+}
+
+SQLiteAwaitable<AsyncSQLiteDatabase::QueryResult> AsyncSQLiteDatabase::query(const std::string& sql, const Binder& binder)
+{
+    return SQLiteAwaitable<QueryResult>(*this, [sql, binder](SQLiteDatabase& db) { return runQuery(db, sql, binder); });
+}
+
+SQLiteAwaitable<bool> AsyncSQLiteDatabase::transaction(const std::function<bool(SQLiteDatabase&)>& body)
+{
+    return SQLiteAwaitable<bool>(*this, [body](SQLiteDatabase& db) { return runTransaction(db, body); });
+}
+
+SQLiteRowStream AsyncSQLiteDatabase::rowsAsync(const std::string& sql, const Binder& binder, size_t batchSize)
+{
+    return SQLiteRowStream(*this, sql, binder, batchSize);
+}
+
+// Shared between the stream and the worker tasks filling it. The statement
+// is only touched on the worker thread.
+struct SQLiteRowStream::State {
+    State(const std::string& sql, const AsyncSQLiteDatabase::Binder& binder, size_t batchSize)
+        : sql(sql)
+        , binder(binder)
+        , batchSize(batchSize ? batchSize : 1)
+        , hasReadyBatch(false)
+        , isFilling(false)
+        , isDone(false)
+        , isCancelled(false)
+        , result(SQLResultOk)
+    {
+    }
+
+    std::string sql;
+    AsyncSQLiteDatabase::Binder binder;
+    size_t batchSize;
+    std::unique_ptr<SQLiteStatement> statement;
+
+    std::mutex lock;
+    Batch readyBatch;
+    bool hasReadyBatch;
+    bool isFilling;
+    bool isDone;
+    bool isCancelled;
+    int result;
+    std::coroutine_handle<> waiter;
+};
+
+SQLiteRowStream::SQLiteRowStream(AsyncSQLiteDatabase& db, const std::string& sql, const AsyncSQLiteDatabase::Binder& binder, size_t batchSize)
+    : m_database(&db)
+    , m_state(std::make_shared<State>(sql, binder, batchSize))
+{
+    m_state->isFilling = true;
+    fill();
+}
+
+SQLiteRowStream::~SQLiteRowStream()
+{
+    if (!m_state)
+        return;
+
+    std::shared_ptr<State> state = m_state;
+    {
+        std::lock_guard<std::mutex> lock(state->lock);
+        state->isCancelled = true;
+    }
+    m_database->post([state](SQLiteDatabase&) { state->statement.reset(); });
+}
+
+int SQLiteRowStream::result() const
+{
+    std::lock_guard<std::mutex> lock(m_state->lock);
+    return m_state->result;
+}
+
+void SQLiteRowStream::fill()
+{
+    std::shared_ptr<State> state = m_state;
+    AsyncSQLiteDatabase* database = m_database;
+    m_database->post([state, database](SQLiteDatabase& db) {
+        {
+            std::lock_guard<std::mutex> lock(state->lock);
+            if (state->isCancelled)
+                return;
+        }
+
+        Batch batch;
+        int result = SQLResultRow;
+        if (!state->statement) {
+            state->statement.reset(new SQLiteStatement(db, state->sql));
+            result = state->statement->prepare();
+            if (result == SQLResultOk && state->binder) {
+                // A throwing binder ends the stream, so the reader is resumed.
+                try {
+                    state->binder(*state->statement);
+                } catch (...) {
+                    SQLITE_LOG(ERROR) << "Exception thrown by the binder of " << state->sql;
+                    result = SQLResultError;
+                }
+            }
+            if (result == SQLResultOk)
+                result = SQLResultRow;
+        }
+        if (result == SQLResultRow)
+            result = AsyncSQLiteDatabase::readRows(*state->statement, state->batchSize, batch);
+        if (result != SQLResultRow)
+            state->statement.reset();
+
+        std::coroutine_handle<> waiter;
+        {
+            std::lock_guard<std::mutex> lock(state->lock);
+            state->readyBatch = std::move(batch);
+            state->hasReadyBatch = true;
+            state->isFilling = false;
+            if (result != SQLResultRow) {
+                state->isDone = true;
+                state->result = result;
+            }
+            waiter = state->waiter;
+            state->waiter = std::coroutine_handle<>();
+        }
+        if (waiter)
+            database->resume(waiter);
+    });
+}
+
+bool SQLiteRowStream::takeLocked(Batch& batch)
+{
+    if (!m_state->hasReadyBatch) {
+        if (!m_state->isDone)
+            return false;
+        // Everything was handed out; an empty batch ends the loop.
+        batch.clear();
+        return true;
+    }
+
+    batch = std::move(m_state->readyBatch);
+    m_state->readyBatch = Batch();
+    m_state->hasReadyBatch = false;
+    // Read the next batch while the caller works on this one.
+    if (!m_state->isDone && !m_state->isFilling) {
+        m_state->isFilling = true;
+        fill();
+    }
+    return true;
+}
+
+bool SQLiteRowStream::takeReadyBatch(Batch& batch)
+{
+    std::lock_guard<std::mutex> lock(m_state->lock);
+    return takeLocked(batch);
+}
+
+bool SQLiteRowStream::takeReadyBatchOrWait(Batch& batch, std::coroutine_handle<> handle)
+{
+    std::lock_guard<std::mutex> lock(m_state->lock);
+    if (takeLocked(batch))
+        return true;
+    m_state->waiter = handle;
+    return false;
+}
+#endif
@@ -0,0 +1,266 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef AsyncSQLiteDatabase_h
+#define AsyncSQLiteDatabase_h
+
+#include "SQLValue.h"
+#include "SQLiteDatabase.h"
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+#define SQLITE_HAS_COROUTINES 1
+#include <coroutine>
+#include <optional>
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class SQLiteStatement;
+template<typename Result> class SQLiteAwaitable;
+class SQLiteRowStream;
+
+// Owns a SQLiteDatabase on a dedicated worker thread, so callers never block
+// on the connection lock or on disk I/O. Every call queues a task and returns
+// at once, with a std::future or by invoking a callback on the worker thread
+// when the task is done.
+//
+// Tasks run in the order they were queued. The worker takes every pending
+// task off the queue in one go and runs them back to back, so the connection
+// does not sit idle between queued requests.
+//
+// An exception thrown by a binder or transaction body reaches the caller
+// through the future, or as a failed result for the callback overloads.
+// Anything else that throws on the worker is logged and dropped.
+class AsyncSQLiteDatabase {
+public:
+    struct QueryResult {
+        QueryResult() : result(SQLResultOk) { }
+
+        // SQLResultDone once every row was read, or the error that stopped it.
+        int result;
+        std::vector<std::string> columnNames;
+        std::vector<std::vector<SQLValue> > rows;
+    };
+
+    typedef std::function<void(SQLiteStatement&)> Binder;
+    typedef std::function<void(bool)> Completion;
+    typedef std::function<void(QueryResult&&)> QueryCompletion;
+
+    AsyncSQLiteDatabase();
+    // Runs the tasks already queued, closes the database and stops the worker.
+    ~AsyncSQLiteDatabase();
+
+    std::future<bool> open(const std::string& filename);
+    std::future<void> close();
+
+    // Runs a statement that returns no rows. The binder, if any, is called on
+    // the worker thread after the statement is prepared.
+    std::future<bool> executeAsync(const std::string& sql, const Binder& = Binder());
+    void executeAsync(const std::string& sql, const Binder&, const Completion&);
+
+    // Runs a query and collects its rows.
+    std::future<QueryResult> queryAsync(const std::string& sql, const Binder& = Binder());
+    void queryAsync(const std::string& sql, const Binder&, const QueryCompletion&);
+
+    // Runs body inside a transaction, committing if it returns true and
+    // rolling back otherwise. The future holds whether the commit happened.
+    std::future<bool> transactionAsync(const std::function<bool(SQLiteDatabase&)>& body);
+    void transactionAsync(const std::function<bool(SQLiteDatabase&)>& body, const Completion&);
+
+    // Runs any work against the connection on the worker thread.
+    template<typename Function>
+    std::future<std::invoke_result_t<Function, SQLiteDatabase&> > submit(Function work)
+    {
+        typedef std::invoke_result_t<Function, SQLiteDatabase&> Result;
+        std::shared_ptr<std::packaged_task<Result(SQLiteDatabase&)> > task(new std::packaged_task<Result(SQLiteDatabase&)>(std::move(work)));
+        std::future<Result> future = task->get_future();
+        post([task](SQLiteDatabase& db) { (*task)(db); });
+        return future;
+    }
+
+    // Queues work without a result.
+    void post(const std::function<void(SQLiteDatabase&)>& work);
+
+    size_t pendingTaskCount() const;
+
+#if SQLITE_HAS_COROUTINES
+    // Coroutine interface, available when building as C++20 (the CMake option
+    // SQLITE_COROUTINES):
+    //
+    //   AsyncSQLiteDatabase::QueryResult result = co_await db.query("SELECT ...");
+    //
+    //   SQLiteRowStream rows = db.rowsAsync("SELECT ...");
+    //   while (true) {
+    //       std::vector<std::vector<SQLValue> > batch = co_await rows.next();
+    //       if (batch.empty())
+    //           break;
+    //       ...
+    //   }
+    //
+    // A suspended coroutine is resumed on the worker thread, or through the
+    // resume executor if one is set.
+    typedef std::function<void(std::coroutine_handle<>)> ResumeExecutor;
+    void setResumeExecutor(const ResumeExecutor& executor) { m_resumeExecutor = executor; }
+
+    SQLiteAwaitable<bool> execute(const std::string& sql, const Binder& = Binder());
+    SQLiteAwaitable<QueryResult> query(const std::string& sql, const Binder& = Binder());
+    SQLiteAwaitable<bool> transaction(const std::function<bool(SQLiteDatabase&)>& body);
+    // Streams rows in batches of up to batchSize. The worker reads the next
+    // batch while the caller processes the current one, so a coroutine is
+    // suspended at most once per batch, and not at all when the worker is
+    // ahead. The stream must not outlive the database.
+    SQLiteRowStream rowsAsync(const std::string& sql, const Binder& = Binder(), size_t batchSize = 256);
+#endif
+
+private:
+    template<typename Result> friend class SQLiteAwaitable;
+    friend class SQLiteRowStream;
+
+    static bool runExecute(SQLiteDatabase&, const std::string& sql, const Binder&);
+    static QueryResult runQuery(SQLiteDatabase&, const std::string& sql, const Binder&);
+    static bool runTransaction(SQLiteDatabase&, const std::function<bool(SQLiteDatabase&)>& body);
+    // Steps until maxRows rows are read or the statement stops returning rows.
+    // Returns SQLResultRow if there may be more rows.
+    static int readRows(SQLiteStatement&, size_t maxRows, std::vector<std::vector<SQLValue> >& rows);
+
+    void run();
+
+    SQLiteDatabase m_database;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    std::deque<std::function<void(SQLiteDatabase&)> > m_tasks;
+    bool m_stopping;
+    std::thread m_thread;
+
+#if SQLITE_HAS_COROUTINES
+    void resume(std::coroutine_handle<> handle)
+    {
+        if (m_resumeExecutor)
+            m_resumeExecutor(handle);
+        else
+            handle.resume();
+    }
+
+    ResumeExecutor m_resumeExecutor;
+#endif
+};
+
+#if SQLITE_HAS_COROUTINES
+// Runs a function on the worker thread of an AsyncSQLiteDatabase when
+// co_awaited, and resumes the awaiting coroutine with its result.
+template<typename Result>
+class SQLiteAwaitable {
+public:
+    SQLiteAwaitable(AsyncSQLiteDatabase& db, std::function<Result(SQLiteDatabase&)> work)
+        : m_database(db)
+        , m_work(std::move(work))
+    {
+    }
+
+    bool await_ready() const { return false; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+        m_database.post([this, handle](SQLiteDatabase& db) {
+            try {
+                m_result.emplace(m_work(db));
+            } catch (...) {
+                m_exception = std::current_exception();
+            }
+            m_database.resume(handle);
+        });
+    }
+
+    Result await_resume()
+    {
+        if (m_exception)
+            std::rethrow_exception(m_exception);
+        return std::move(*m_result);
+    }
+
+private:
+    AsyncSQLiteDatabase& m_database;
+    std::function<Result(SQLiteDatabase&)> m_work;
+    std::optional<Result> m_result;
+    std::exception_ptr m_exception;
+};
+
+class SQLiteRowStream {
+public:
+    typedef std::vector<std::vector<SQLValue> > Batch;
+
+    class NextBatch {
+    public:
+        explicit NextBatch(SQLiteRowStream& stream) : m_stream(stream), m_hasBatch(false) { }
+
+        bool await_ready() { return m_hasBatch = m_stream.takeReadyBatch(m_batch); }
+        bool await_suspend(std::coroutine_handle<> handle) { return !(m_hasBatch = m_stream.takeReadyBatchOrWait(m_batch, handle)); }
+        Batch await_resume()
+        {
+            // Resumed by the worker once the batch was filled.
+            if (!m_hasBatch)
+                m_stream.takeReadyBatch(m_batch);
+            return std::move(m_batch);
+        }
+
+    private:
+        SQLiteRowStream& m_stream;
+        bool m_hasBatch;
+        Batch m_batch;
+    };
+
+    SQLiteRowStream(AsyncSQLiteDatabase&, const std::string& sql, const AsyncSQLiteDatabase::Binder&, size_t batchSize);
+    SQLiteRowStream(SQLiteRowStream&&) = default;
+    ~SQLiteRowStream();
+
+    // An empty batch means there are no more rows.
+    NextBatch next() { return NextBatch(*this); }
+
+    // SQLResultDone after the last row, or the error that ended the stream.
+    int result() const;
+
+private:
+    struct State;
+
+    bool takeReadyBatch(Batch&);
+    bool takeReadyBatchOrWait(Batch&, std::coroutine_handle<>);
+    bool takeLocked(Batch&);
+    void fill();
+
+    AsyncSQLiteDatabase* m_database;
+    std::shared_ptr<State> m_state;
+};
+#endif
+
+#endif
@@ -27,13 +27,12 @@
  */
 
 #include "DatabaseAuthorizer.h"
+#include "SQLiteLog.h"
 
 #include <string.h>
 #include <iostream>
 #include <memory>
 
-#include <glog/logging.h>
-
 std::shared_ptr<DatabaseAuthorizer> DatabaseAuthorizer::create(const std::string& databaseInfoTableName)
 {
     return std::shared_ptr<DatabaseAuthorizer>(new DatabaseAuthorizer(databaseInfoTableName));
@@ -61,7 +60,7 @@ void DatabaseAuthorizer::resetDeletes()
 
 void DatabaseAuthorizer::addWhitelistedFunctions()
 {
-    DLOG(INFO) << "Enter function: " << __func__;
+    SQLITE_LOG(TRACE) << "Enter function: " << __func__;
 
     // SQLite functions used to help implement some operations
     // ALTER TABLE helpers
@@ -124,7 +123,7 @@ void DatabaseAuthorizer::addWhitelistedFunctions()
     // like(), lower() and upper() are already in the list
     m_whitelistedFunctions.insert("regexp");
 
-    DLOG(INFO) << "Exit function: " << __func__;
+    SQLITE_LOG(TRACE) << "Exit function: " << __func__;
 }
 
 int DatabaseAuthorizer::createTable(const std::string& tableName)
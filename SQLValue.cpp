@@ -42,21 +42,149 @@
 
 SQLValue::SQLValue(const SQLValue& val)
     : m_type(val.m_type)
-    , m_number(val.m_number)
-    , m_string(val.m_string)
 {
+    copyFrom(val);
+}
+
+SQLValue::SQLValue(SQLValue&& val)
+    : m_type(val.m_type)
+{
+    moveFrom(val);
+}
+
+SQLValue& SQLValue::operator=(const SQLValue& val)
+{
+    if (this == &val)
+        return *this;
+    releasePayload();
+    m_type = val.m_type;
+    copyFrom(val);
+    return *this;
+}
+
+SQLValue& SQLValue::operator=(SQLValue&& val)
+{
+    if (this == &val)
+        return *this;
+    releasePayload();
+    m_type = val.m_type;
+    moveFrom(val);
+    return *this;
+}
+
+SQLValue SQLValue::text(std::string_view s)
+{
+    SQLValue value(StringValue);
+    value.setPayload(s.data(), s.size());
+    return value;
+}
+
+SQLValue SQLValue::blob(std::string_view s)
+{
+    SQLValue value(BlobValue);
+    value.setPayload(s.data(), s.size());
+    return value;
+}
+
+SQLValue SQLValue::borrowedText(std::string_view s)
+{
+    SQLValue value(StringValue);
+    value.m_storage = BorrowedStorage;
+    value.m_payload.data = s.data();
+    value.m_payload.size = s.size();
+    return value;
+}
+
+SQLValue SQLValue::borrowedBlob(std::string_view s)
+{
+    SQLValue value = borrowedText(s);
+    value.m_type = BlobValue;
+    return value;
 }
 
 std::string SQLValue::string() const
 {
     ASSERT(m_type == StringValue);
 
-    return m_string;
+    std::string_view view = textView();
+    return std::string(view.data(), view.size());
 }
 
 double SQLValue::number() const
 {
-    ASSERT(m_type == NumberValue);
+    ASSERT(m_type == NumberValue || m_type == IntegerValue);
 
-    return m_number;
+    if (m_type == IntegerValue)
+        return static_cast<double>(m_integer);
+    return m_type == NumberValue ? m_number : 0.0;
+}
+
+int64_t SQLValue::integer() const
+{
+    ASSERT(m_type == NumberValue || m_type == IntegerValue);
+
+    if (m_type == NumberValue)
+        return static_cast<int64_t>(m_number);
+    return m_type == IntegerValue ? m_integer : 0;
+}
+
+std::string_view SQLValue::textView() const
+{
+    if (!hasPayload())
+        return std::string_view();
+    if (m_storage == InlineStorage)
+        return std::string_view(m_inline, m_inlineSize);
+    return std::string_view(m_payload.data, m_payload.size);
+}
+
+void SQLValue::setPayload(const char* data, size_t size)
+{
+    if (size <= inlineCapacity) {
+        m_storage = InlineStorage;
+        m_inlineSize = static_cast<uint8_t>(size);
+        if (size)
+            memcpy(m_inline, data, size);
+        return;
+    }
+
+    char* copy = new char[size];
+    memcpy(copy, data, size);
+    m_storage = HeapStorage;
+    m_inlineSize = 0;
+    m_payload.data = copy;
+    m_payload.size = size;
+}
+
+void SQLValue::copyFrom(const SQLValue& val)
+{
+    if (val.m_storage == HeapStorage) {
+        setPayload(val.m_payload.data, val.m_payload.size);
+        return;
+    }
+
+    // Inline payloads and scalars are copied bitwise; borrowed payloads stay
+    // borrowed.
+    m_storage = val.m_storage;
+    m_inlineSize = val.m_inlineSize;
+    memcpy(m_inline, val.m_inline, inlineCapacity);
+}
+
+void SQLValue::moveFrom(SQLValue& val)
+{
+    m_storage = val.m_storage;
+    m_inlineSize = val.m_inlineSize;
+    memcpy(m_inline, val.m_inline, inlineCapacity);
+
+    // The heap buffer, if any, now belongs to this value.
+    val.m_type = NullValue;
+    val.m_storage = InlineStorage;
+    val.m_inlineSize = 0;
+}
+
+void SQLValue::releasePayload()
+{
+    if (m_storage == HeapStorage)
+        delete[] m_payload.data;
+    m_storage = InlineStorage;
+    m_inlineSize = 0;
 }
@@ -30,26 +30,87 @@
 #define SQLValue_h
 
 #include <iostream>
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
+// A single SQLite value: NULL, a 64-bit integer, a double, text or a blob.
+//
+// Text and blob payloads of up to inlineCapacity bytes are stored inside the
+// value itself, so short values never allocate. Longer payloads are copied to
+// the heap, unless the value was created by one of the borrowed*() factories
+// or by SQLiteStatement::columnValueView(), in which case it only points at
+// the caller's memory. A borrowed value, and any copy of it, is valid only as
+// long as the memory it points at.
 class SQLValue
 {
 public:
-    enum Type { NullValue, NumberValue, StringValue };
+    enum Type { NullValue, NumberValue, StringValue, IntegerValue, BlobValue };
 
-    SQLValue() : m_type(NullValue), m_number(0.0) { }
-    SQLValue(double number) : m_type(NumberValue), m_number(number) { }
-    SQLValue(const std::string& s) : m_type(StringValue), m_number(0.0), m_string(s) { }
+    static const size_t inlineCapacity = 24;
+
+    SQLValue() : m_type(NullValue), m_storage(InlineStorage), m_inlineSize(0), m_integer(0) { }
+    SQLValue(double number) : m_type(NumberValue), m_storage(InlineStorage), m_inlineSize(0), m_number(number) { }
+    // Any integral type makes an IntegerValue; unsigned values above
+    // INT64_MAX wrap, as they do when bound with sqlite3_bind_int64().
+    template<typename Integer, typename = std::enable_if_t<std::is_integral<Integer>::value>>
+    SQLValue(Integer integer) : m_type(IntegerValue), m_storage(InlineStorage), m_inlineSize(0), m_integer(static_cast<int64_t>(integer)) { }
+    SQLValue(const std::string& s) : m_type(StringValue) { setPayload(s.data(), s.size()); }
+    SQLValue(const char* s) : m_type(StringValue) { setPayload(s, s ? strlen(s) : 0); }
     SQLValue(const SQLValue&);
+    SQLValue(SQLValue&&);
+    ~SQLValue() { releasePayload(); }
+
+    SQLValue& operator=(const SQLValue&);
+    SQLValue& operator=(SQLValue&&);
+
+    static SQLValue text(std::string_view);
+    static SQLValue blob(std::string_view);
+    static SQLValue blob(const void* data, size_t size) { return blob(std::string_view(static_cast<const char*>(data), size)); }
+    static SQLValue borrowedText(std::string_view);
+    static SQLValue borrowedBlob(std::string_view);
 
     Type type() const { return m_type; }
+    bool isNull() const { return m_type == NullValue; }
+    bool isBorrowed() const { return m_storage == BorrowedStorage; }
 
     std::string string() const;
+    // Converts an integer value to double.
     double number() const;
+    // Converts a double value to integer.
+    int64_t integer() const;
+    // The payload of a text or blob value; empty for other types.
+    std::string_view textView() const;
+    std::string_view blobView() const { return textView(); }
 
 private:
-    Type m_type;
-    double m_number;
-    std::string m_string;
+    enum Storage { InlineStorage, HeapStorage, BorrowedStorage };
+
+    struct Payload {
+        const char* data;
+        size_t size;
+    };
+
+    explicit SQLValue(Type type) : m_type(type), m_storage(InlineStorage), m_inlineSize(0), m_integer(0) { }
+
+    void setPayload(const char* data, size_t size);
+    void copyFrom(const SQLValue&);
+    void moveFrom(SQLValue&);
+    void releasePayload();
+    bool hasPayload() const { return m_type == StringValue || m_type == BlobValue; }
+
+    Type m_type : 8;
+    Storage m_storage : 8;
+    uint8_t m_inlineSize;
+    union {
+        int64_t m_integer;
+        double m_number;
+        Payload m_payload;
+        char m_inline[inlineCapacity];
+    };
 };
 
 #endif
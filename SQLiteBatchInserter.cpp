@@ -0,0 +1,196 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteBatchInserter.h"
+
+#include "SQLiteDatabase.h"
+#include "SQLiteLog.h"
+#include "SQLiteStatement.h"
+#include "SQLiteTransaction.h"
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+static const size_t defaultRowsPerTransaction = 1000;
+
+SQLiteBatchInserter::SQLiteBatchInserter(SQLiteDatabase& db, const std::string& sql)
+    : m_database(db)
+    , m_sql(sql)
+    , m_rowsPerTransaction(defaultRowsPerTransaction)
+    , m_rowsPerStatement(1)
+{
+}
+
+SQLiteBatchInserter::SQLiteBatchInserter(SQLiteDatabase& db, const std::string& table, const std::vector<std::string>& columns)
+    : m_database(db)
+    , m_table(table)
+    , m_columns(columns)
+    , m_rowsPerTransaction(defaultRowsPerTransaction)
+    , m_rowsPerStatement(1)
+{
+    m_sql = sqlForRows(1);
+}
+
+void SQLiteBatchInserter::setRowsPerStatement(size_t rows)
+{
+    if (m_columns.empty()) {
+        m_rowsPerStatement = 1;
+        return;
+    }
+
+    // Stay within the number of host parameters SQLite accepts per statement.
+    size_t maximumRows = rows;
+    if (m_database.isOpen()) {
+        int maximumParameters = sqlite3_limit(m_database.sqlite3Handle(), SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+        maximumRows = std::max<size_t>(1, maximumParameters / m_columns.size());
+    }
+    m_rowsPerStatement = std::max<size_t>(1, std::min(rows, maximumRows));
+}
+
+std::string SQLiteBatchInserter::sqlForRows(size_t rows) const
+{
+    std::string columns;
+    std::string values = "(";
+    for (size_t i = 0; i < m_columns.size(); ++i) {
+        if (i) {
+            columns += ", ";
+            values += ", ";
+        }
+        columns += m_columns[i];
+        values += "?";
+    }
+    values += ")";
+
+    std::string sql = "INSERT INTO " + m_table + " (" + columns + ") VALUES " + values;
+    for (size_t i = 1; i < rows; ++i)
+        sql += ", " + values;
+    return sql;
+}
+
+bool SQLiteBatchInserter::insert(const RowSource& source)
+{
+    return insert(source, 0);
+}
+
+bool SQLiteBatchInserter::insert(const RowSource& source, size_t rowCount)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    SQLiteStatement singleRow(m_database, m_sql);
+    if (singleRow.prepare() != SQLResultOk)
+        return false;
+
+    // Multi-VALUES statements are only used while at least a full group of
+    // rows remains, so a group is never left partially bound, and only when
+    // rejected rows need not be reported one by one.
+    std::unique_ptr<SQLiteStatement> multipleRows;
+    if (m_rowsPerStatement > 1 && rowCount >= m_rowsPerStatement && !m_constraintFailureHandler) {
+        multipleRows.reset(new SQLiteStatement(m_database, sqlForRows(m_rowsPerStatement)));
+        if (multipleRows->prepare() != SQLResultOk)
+            return false;
+    }
+
+    const bool ownsTransaction = !m_database.transactionInProgress();
+    std::unique_ptr<SQLiteTransaction> transaction;
+    size_t rowsInTransaction = 0;
+    size_t remainingRows = rowCount;
+    uint64_t rowNumber = 0;
+    bool succeeded = true;
+
+    while (true) {
+        if (ownsTransaction && !transaction) {
+            transaction.reset(new SQLiteTransaction(m_database));
+            transaction->begin();
+            if (!transaction->inProgress()) {
+                succeeded = false;
+                break;
+            }
+        }
+
+        SQLiteStatement* statement = &singleRow;
+        size_t rowsInStatement = 1;
+        if (multipleRows && remainingRows >= m_rowsPerStatement) {
+            statement = multipleRows.get();
+            rowsInStatement = m_rowsPerStatement;
+        }
+
+        size_t boundRows = 0;
+        while (boundRows < rowsInStatement && source(*statement, boundRows * m_columns.size() + 1))
+            ++boundRows;
+        if (!boundRows)
+            break;
+        if (boundRows < rowsInStatement) {
+            SQLITE_LOG(ERROR) << "Row source ended in the middle of a multi-row insert - " << statement->query();
+            statement->reset();
+            succeeded = false;
+            break;
+        }
+
+        int error = statement->step();
+        statement->reset();
+
+        if (error == SQLResultDone) {
+            m_statistics.rowsInserted += boundRows;
+            rowsInTransaction += boundRows;
+        } else if ((error & 0xff) == SQLResultConstraint) {
+            m_statistics.rowsRejected += boundRows;
+            if (m_constraintFailureHandler) {
+                for (size_t i = 0; i < boundRows; ++i)
+                    m_constraintFailureHandler(rowNumber + i, error);
+            }
+        } else {
+            succeeded = false;
+            break;
+        }
+
+        rowNumber += boundRows;
+        remainingRows -= std::min(boundRows, remainingRows);
+
+        if (transaction && rowsInTransaction >= m_rowsPerTransaction) {
+            transaction->commit();
+            if (transaction->inProgress()) {
+                succeeded = false;
+                break;
+            }
+            ++m_statistics.transactionsCommitted;
+            transaction.reset();
+            rowsInTransaction = 0;
+        }
+    }
+
+    if (transaction) {
+        if (succeeded) {
+            transaction->commit();
+            succeeded = !transaction->inProgress();
+            if (succeeded && rowsInTransaction)
+                ++m_statistics.transactionsCommitted;
+        }
+        // Rolls back if the commit did not happen.
+        transaction.reset();
+    }
+
+    m_statistics.elapsedSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return succeeded;
+}
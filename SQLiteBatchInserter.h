@@ -0,0 +1,125 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteBatchInserter_h
+#define SQLiteBatchInserter_h
+
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+class SQLiteDatabase;
+class SQLiteStatement;
+
+// Inserts many rows through one prepared statement, committing every
+// rowsPerTransaction inserted rows. If the database already has a
+// transaction in progress the rows are inserted as part of it and nothing is
+// committed.
+//
+// Rows that fail a constraint are skipped and reported through the
+// constraint failure handler; any other error rolls back the current batch
+// and stops the insert. Batches committed before the error are kept.
+class SQLiteBatchInserter {
+private:
+    SQLiteBatchInserter(const SQLiteBatchInserter&);
+    SQLiteBatchInserter& operator=(const SQLiteBatchInserter&);
+public:
+    struct Statistics {
+        Statistics() : rowsInserted(0), rowsRejected(0), transactionsCommitted(0), elapsedSeconds(0) { }
+
+        double rowsPerSecond() const { return elapsedSeconds > 0 ? rowsInserted / elapsedSeconds : 0; }
+
+        uint64_t rowsInserted;
+        uint64_t rowsRejected;
+        uint64_t transactionsCommitted;
+        double elapsedSeconds;
+    };
+
+    // Binds the values of one row, starting at parameter index firstParameter.
+    // Returns false, without binding anything, when there are no more rows.
+    typedef std::function<bool(SQLiteStatement&, int firstParameter)> RowSource;
+
+    // Called with the zero-based number of each row rejected by a constraint
+    // and the extended SQLite result code.
+    typedef std::function<void(uint64_t row, int error)> ConstraintFailureHandler;
+
+    // Inserts with the given single-row INSERT statement.
+    SQLiteBatchInserter(SQLiteDatabase&, const std::string& sql);
+    // Generates "INSERT INTO table (columns...) VALUES (?, ...)", which also
+    // allows several rows to be inserted per statement.
+    SQLiteBatchInserter(SQLiteDatabase&, const std::string& table, const std::vector<std::string>& columns);
+
+    size_t rowsPerTransaction() const { return m_rowsPerTransaction; }
+    void setRowsPerTransaction(size_t rows) { m_rowsPerTransaction = rows ? rows : 1; }
+
+    // Number of rows inserted by each multi-VALUES statement. Only used when
+    // the column list is known, the number of rows is known up front and no
+    // constraint failure handler is set. SQLite rejects every row of a
+    // statement that fails a constraint, and the rows cannot be bound again
+    // to find the one at fault, so with a handler rows go one at a time and
+    // each rejected row is reported on its own. Without one, a constraint
+    // failure skips every row of its statement.
+    size_t rowsPerStatement() const { return m_rowsPerStatement; }
+    void setRowsPerStatement(size_t);
+
+    void setConstraintFailureHandler(const ConstraintFailureHandler& handler) { m_constraintFailureHandler = handler; }
+
+    // Inserts rows until the source runs dry. Returns false on an error other
+    // than a constraint failure.
+    bool insert(const RowSource&);
+
+    // Inserts the rows in [begin, end). bind is called as
+    // bind(statement, firstParameter, *iterator) for every row.
+    template<typename Iterator, typename Binder>
+    bool insert(Iterator begin, Iterator end, Binder bind)
+    {
+        size_t rowCount = std::distance(begin, end);
+        return insert([&](SQLiteStatement& statement, int firstParameter) {
+            if (begin == end)
+                return false;
+            bind(statement, firstParameter, *begin);
+            ++begin;
+            return true;
+        }, rowCount);
+    }
+
+    // Statistics accumulated over every insert() call.
+    const Statistics& statistics() const { return m_statistics; }
+    void resetStatistics() { m_statistics = Statistics(); }
+
+private:
+    bool insert(const RowSource&, size_t rowCount);
+    std::string sqlForRows(size_t rows) const;
+
+    SQLiteDatabase& m_database;
+    std::string m_sql;
+    std::string m_table;
+    std::vector<std::string> m_columns;
+    size_t m_rowsPerTransaction;
+    size_t m_rowsPerStatement;
+    ConstraintFailureHandler m_constraintFailureHandler;
+    Statistics m_statistics;
+};
+
+#endif // SQLiteBatchInserter_h
@@ -0,0 +1,407 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteBlobStream.h"
+
+#include "SQLiteDatabase.h"
+#include "SQLiteLog.h"
+#include "SQLiteStatement.h"
+#include "SQLiteTransaction.h"
+#include <sqlite3.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+
+SQLiteBlobStream::SQLiteBlobStream(SQLiteDatabase& db, size_t bufferSize)
+    : m_database(db)
+    , m_blob(0)
+    , m_writable(false)
+    , m_rowID(0)
+    , m_buffer(std::max<size_t>(bufferSize, 1))
+    , m_bufferOffset(0)
+{
+    discardBuffer(0);
+}
+
+SQLiteBlobStream::~SQLiteBlobStream()
+{
+    close();
+}
+
+int SQLiteBlobStream::open(const std::string& table, const std::string& column, int64_t rowID, bool writable, const std::string& databaseName)
+{
+    close();
+
+    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    int error = sqlite3_blob_open(m_database.sqlite3Handle(), databaseName.c_str(), table.c_str(), column.c_str(), rowID, writable ? 1 : 0, &m_blob);
+    if (error != SQLITE_OK) {
+        SQLITE_LOG(ERROR) << "sqlite3_blob_open failed (" << error << ") " << table << "." << column << " row " << rowID << "\nError - " << sqlite3_errmsg(m_database.sqlite3Handle());
+        // sqlite3_blob_open() may leave a handle behind on failure.
+        sqlite3_blob_close(m_blob);
+        m_blob = 0;
+        return error;
+    }
+
+    m_writable = writable;
+    m_rowID = rowID;
+    discardBuffer(0);
+    return SQLITE_OK;
+}
+
+int SQLiteBlobStream::reopen(int64_t rowID)
+{
+    if (!m_blob)
+        return SQLITE_MISUSE;
+
+    // Buffered output belongs to the current row.
+    int error = flushPutArea();
+    if (error != SQLITE_OK)
+        return error;
+
+    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    error = sqlite3_blob_reopen(m_blob, rowID);
+    if (error != SQLITE_OK) {
+        // The handle is aborted and can only be closed now.
+        SQLITE_LOG(ERROR) << "sqlite3_blob_reopen failed (" << error << ") row " << rowID << "\nError - " << sqlite3_errmsg(m_database.sqlite3Handle());
+        closeHandle();
+        return error;
+    }
+
+    m_rowID = rowID;
+    discardBuffer(0);
+    return SQLITE_OK;
+}
+
+int SQLiteBlobStream::close()
+{
+    if (!m_blob)
+        return SQLITE_OK;
+
+    int error = flushPutArea();
+    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    int result = closeHandle();
+    return error != SQLITE_OK ? error : result;
+}
+
+int SQLiteBlobStream::closeHandle()
+{
+    int result = sqlite3_blob_close(m_blob);
+    m_blob = 0;
+    m_writable = false;
+    discardBuffer(0);
+    return result;
+}
+
+int SQLiteBlobStream::size() const
+{
+    return m_blob ? sqlite3_blob_bytes(m_blob) : 0;
+}
+
+int SQLiteBlobStream::read(void* buffer, int size, int offset)
+{
+    if (!m_blob)
+        return SQLITE_MISUSE;
+
+    int error = flushPutArea();
+    if (error != SQLITE_OK)
+        return error;
+
+    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    return sqlite3_blob_read(m_blob, buffer, size, offset);
+}
+
+int SQLiteBlobStream::write(const void* buffer, int size, int offset)
+{
+    if (!m_blob)
+        return SQLITE_MISUSE;
+
+    // Buffered output goes first, so that this write lands on top of it.
+    int error = flushPutArea();
+    if (error == SQLITE_OK)
+        error = writeBlob(buffer, size, offset);
+
+    // Keep the get area consistent with what was just written.
+    if (error == SQLITE_OK && offset < m_bufferOffset + (egptr() - eback()) && offset + size > m_bufferOffset)
+        discardBuffer(position());
+    return error;
+}
+
+int SQLiteBlobStream::writeBlob(const void* buffer, int size, int offset)
+{
+    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    return sqlite3_blob_write(m_blob, buffer, size, offset);
+}
+
+// Number of bytes mapped at a time by writeFromFile(). Mapping offsets
+// must be page aligned, so this is a whole number of pages.
+static size_t fileMappingSize()
+{
+    return sysconf(_SC_PAGESIZE) * 16;
+}
+
+int SQLiteBlobStream::writeFromFile(int fd)
+{
+    if (!m_blob)
+        return SQLITE_MISUSE;
+
+    struct stat fileStats;
+    if (fstat(fd, &fileStats) == -1)
+        return SQLITE_IOERR;
+    if (fileStats.st_size != size())
+        return SQLITE_MISMATCH;
+
+    const size_t mappingSize = fileMappingSize();
+    for (off_t offset = 0; offset < fileStats.st_size; offset += mappingSize) {
+        size_t length = std::min<off_t>(mappingSize, fileStats.st_size - offset);
+        void* mapping = mmap(0, length, PROT_READ, MAP_PRIVATE, fd, offset);
+        if (mapping == MAP_FAILED) {
+            SQLITE_LOG(ERROR) << "mmap failed at offset " << offset << " - " << strerror(errno);
+            return SQLITE_IOERR;
+        }
+
+        int error = write(mapping, length, offset);
+        munmap(mapping, length);
+        if (error != SQLITE_OK)
+            return error;
+    }
+
+    return SQLITE_OK;
+}
+
+int SQLiteBlobStream::readToFile(int fd)
+{
+    if (!m_blob)
+        return SQLITE_MISUSE;
+
+    // The transfer reuses the stream buffer, so drop what it holds.
+    int streamPosition = position();
+    int blobSize = size();
+    int error = SQLITE_OK;
+    for (int offset = 0; offset < blobSize && error == SQLITE_OK; offset += m_buffer.size()) {
+        int length = std::min<int>(m_buffer.size(), blobSize - offset);
+        error = read(m_buffer.data(), length, offset);
+
+        for (int written = 0; error == SQLITE_OK && written < length; ) {
+            ssize_t result = ::write(fd, m_buffer.data() + written, length - written);
+            if (result == -1 && errno == EINTR)
+                continue;
+            if (result <= 0) {
+                SQLITE_LOG(ERROR) << "write failed - " << strerror(errno);
+                error = SQLITE_IOERR;
+                break;
+            }
+            written += result;
+        }
+    }
+
+    discardBuffer(streamPosition);
+    return error;
+}
+
+int SQLiteBlobStream::insertFile(SQLiteStatement& insert, int blobParameter, const std::string& table, const std::string& column,
+                                 const std::string& path, int64_t* rowID)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        SQLITE_LOG(ERROR) << "Unable to open " << path << " - " << strerror(errno);
+        return SQLITE_CANTOPEN;
+    }
+
+    struct stat fileStats;
+    if (fstat(fd, &fileStats) == -1) {
+        ::close(fd);
+        return SQLITE_IOERR;
+    }
+
+    SQLiteDatabase& db = *insert.database();
+    SQLiteTransaction transaction(db);
+    if (!db.transactionInProgress())
+        transaction.begin();
+
+    int error = insert.bindZeroBlob(blobParameter, fileStats.st_size);
+    if (error == SQLITE_OK) {
+        error = insert.step();
+        insert.reset();
+        if (error == SQLITE_DONE)
+            error = SQLITE_OK;
+        // INSERT OR IGNORE and ON CONFLICT DO NOTHING finish without a row,
+        // and the last insert rowid then belongs to some earlier row.
+        if (error == SQLITE_OK && sqlite3_changes(db.sqlite3Handle()) != 1) {
+            SQLITE_LOG(ERROR) << "Insert of " << path << " did not add a row - " << insert.query();
+            error = SQLITE_CONSTRAINT;
+        }
+    }
+
+    int64_t insertedRowID = db.lastInsertRowID();
+    if (error == SQLITE_OK) {
+        SQLiteBlobStream blob(db);
+        error = blob.open(table, column, insertedRowID, true);
+        if (error == SQLITE_OK)
+            error = blob.writeFromFile(fd);
+        if (error == SQLITE_OK)
+            error = blob.close();
+    }
+    ::close(fd);
+
+    // The transaction rolls back when it goes out of scope uncommitted.
+    if (error == SQLITE_OK && transaction.inProgress()) {
+        transaction.commit();
+        if (transaction.inProgress())
+            error = db.lastError();
+    }
+
+    if (error == SQLITE_OK && rowID)
+        *rowID = insertedRowID;
+    return error;
+}
+
+void SQLiteBlobStream::discardBuffer(int position)
+{
+    m_bufferOffset = position;
+    setg(m_buffer.data(), m_buffer.data(), m_buffer.data());
+    setp(0, 0);
+}
+
+int SQLiteBlobStream::flushPutArea()
+{
+    if (!pbase())
+        return SQLITE_OK;
+
+    int offset = m_bufferOffset;
+    int length = pptr() - pbase();
+    discardBuffer(offset + length);
+    if (!length || !m_blob)
+        return SQLITE_OK;
+    return writeBlob(m_buffer.data(), length, offset);
+}
+
+SQLiteBlobStream::int_type SQLiteBlobStream::underflow()
+{
+    if (gptr() < egptr())
+        return traits_type::to_int_type(*gptr());
+
+    int offset = position();
+    int length = std::min<int>(m_buffer.size(), size() - offset);
+    if (length <= 0 || read(m_buffer.data(), length, offset) != SQLITE_OK)
+        return traits_type::eof();
+
+    m_bufferOffset = offset;
+    setg(m_buffer.data(), m_buffer.data(), m_buffer.data() + length);
+    return traits_type::to_int_type(*gptr());
+}
+
+std::streamsize SQLiteBlobStream::xsgetn(char* buffer, std::streamsize count)
+{
+    std::streamsize buffered = std::min<std::streamsize>(count, egptr() - gptr());
+    memcpy(buffer, gptr(), buffered);
+    gbump(buffered);
+    if (buffered == count)
+        return count;
+
+    // Read the rest straight into the caller's buffer.
+    int offset = position();
+    int length = std::min<std::streamsize>(count - buffered, size() - offset);
+    if (length <= 0 || read(buffer + buffered, length, offset) != SQLITE_OK)
+        return buffered;
+
+    discardBuffer(offset + length);
+    return buffered + length;
+}
+
+std::streamsize SQLiteBlobStream::showmanyc()
+{
+    int remaining = size() - position();
+    return remaining > 0 ? remaining : -1;
+}
+
+SQLiteBlobStream::int_type SQLiteBlobStream::overflow(int_type c)
+{
+    if (!m_blob || !m_writable || flushPutArea() != SQLITE_OK)
+        return traits_type::eof();
+    if (traits_type::eq_int_type(c, traits_type::eof()))
+        return traits_type::not_eof(c);
+
+    // Start a put area at the current position, up to the end of the blob.
+    int offset = position();
+    int length = std::min<int>(m_buffer.size(), size() - offset);
+    if (length <= 0)
+        return traits_type::eof();
+
+    discardBuffer(offset);
+    setp(m_buffer.data(), m_buffer.data() + length);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+int SQLiteBlobStream::sync()
+{
+    return flushPutArea() == SQLITE_OK ? 0 : -1;
+}
+
+std::streamsize SQLiteBlobStream::xsputn(const char* buffer, std::streamsize count)
+{
+    // Small writes are gathered in the put area by std::streambuf, which
+    // calls overflow() whenever it is full.
+    if (count < static_cast<std::streamsize>(m_buffer.size()))
+        return std::streambuf::xsputn(buffer, count);
+
+    if (flushPutArea() != SQLITE_OK)
+        return 0;
+    int offset = position();
+    int length = std::min<std::streamsize>(count, size() - offset);
+    if (length <= 0 || write(buffer, length, offset) != SQLITE_OK)
+        return 0;
+
+    discardBuffer(offset + length);
+    return length;
+}
+
+SQLiteBlobStream::pos_type SQLiteBlobStream::seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode)
+{
+    if (flushPutArea() != SQLITE_OK)
+        return pos_type(off_type(-1));
+
+    off_type base = 0;
+    if (direction == std::ios_base::cur)
+        base = position();
+    else if (direction == std::ios_base::end)
+        base = size();
+
+    off_type target = base + offset;
+    if (!m_blob || target < 0 || target > size())
+        return pos_type(off_type(-1));
+
+    discardBuffer(target);
+    return pos_type(target);
+}
+
+SQLiteBlobStream::pos_type SQLiteBlobStream::seekpos(pos_type position, std::ios_base::openmode mode)
+{
+    return seekoff(off_type(position), std::ios_base::beg, mode);
+}
@@ -0,0 +1,117 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteBlobStream_h
+#define SQLiteBlobStream_h
+
+#include <iostream>
+#include <streambuf>
+#include <vector>
+
+struct sqlite3_blob;
+
+class SQLiteDatabase;
+class SQLiteStatement;
+
+// Incremental I/O on a single BLOB value, without loading it into memory.
+//
+// The stream offers positional read() and write() calls and is also a
+// std::streambuf, so it can back a std::istream or std::ostream. A blob
+// cannot change size through this interface: writes past the end fail.
+// reopen() moves the handle to another row of the same column, which is
+// much cheaper than opening a new one.
+//
+// Stream output is gathered in the buffer and written to the blob when the
+// buffer is full, and on flush, seek, read(), write(), reopen() and close().
+//
+// If the row is modified or deleted through another statement while the
+// stream is open, the handle expires and reads and writes return
+// SQLITE_ABORT. A failed reopen() closes the stream.
+class SQLiteBlobStream : public std::streambuf {
+private:
+    SQLiteBlobStream(const SQLiteBlobStream&);
+    SQLiteBlobStream& operator=(const SQLiteBlobStream&);
+public:
+    explicit SQLiteBlobStream(SQLiteDatabase&, size_t bufferSize = 16 * 1024);
+    ~SQLiteBlobStream();
+
+    int open(const std::string& table, const std::string& column, int64_t rowID, bool writable = false, const std::string& databaseName = "main");
+    int reopen(int64_t rowID);
+    int close();
+
+    bool isOpen() const { return m_blob; }
+    bool isWritable() const { return m_writable; }
+    int64_t rowID() const { return m_rowID; }
+
+    // Size of the blob in bytes.
+    int size() const;
+
+    int read(void* buffer, int size, int offset);
+    int write(const void* buffer, int size, int offset);
+
+    // Copies a whole file into the blob, which must already be exactly as
+    // large as the file. The file is mapped a few pages at a time, so memory
+    // use does not depend on its size.
+    int writeFromFile(int fd);
+    // Writes the whole blob to a file descriptor, one buffer at a time.
+    int readToFile(int fd);
+
+    // Stores the file at path as a new row. insert is a prepared INSERT with
+    // its other parameters bound; parameter blobParameter receives a
+    // zeroblob of the file's size, which is then filled from the file. Runs
+    // in a transaction of its own unless one is already in progress. Returns
+    // SQLITE_CONSTRAINT if the statement did not insert exactly one row.
+    static int insertFile(SQLiteStatement& insert, int blobParameter, const std::string& table, const std::string& column,
+                          const std::string& path, int64_t* rowID = 0);
+
+protected:
+    // std::streambuf
+    int_type underflow();
+    int_type overflow(int_type);
+    int sync();
+    std::streamsize xsgetn(char*, std::streamsize);
+    std::streamsize xsputn(const char*, std::streamsize);
+    std::streamsize showmanyc();
+    pos_type seekoff(off_type, std::ios_base::seekdir, std::ios_base::openmode);
+    pos_type seekpos(pos_type, std::ios_base::openmode);
+
+private:
+    // At most one of the get and put areas is in use at a time.
+    int position() const { return m_bufferOffset + (pbase() ? pptr() - pbase() : gptr() - eback()); }
+    void discardBuffer(int position);
+    // Writes out and ends the put area.
+    int flushPutArea();
+    int writeBlob(const void* buffer, int size, int offset);
+    // Called with the connection lock held.
+    int closeHandle();
+
+    SQLiteDatabase& m_database;
+    sqlite3_blob* m_blob;
+    bool m_writable;
+    int64_t m_rowID;
+    std::vector<char> m_buffer;
+    // Blob offset of the first byte of the get or put area.
+    int m_bufferOffset;
+};
+
+#endif // SQLiteBlobStream_h
@@ -0,0 +1,202 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteCheckpointer.h"
+
+#include "SQLiteLog.h"
+#include "SQLiteStatement.h"
+
+#include <algorithm>
+
+#include <sqlite3.h>
+
+// Sizes of the WAL file header and of each frame header.
+static const int walHeaderBytes = 32;
+static const int walFrameHeaderBytes = 24;
+
+SQLiteCheckpointer::SQLiteCheckpointer(SQLiteDatabase& db, const Options& options)
+    : m_database(db)
+    , m_options(options)
+    , m_pageSize(0)
+    , m_checkpointedFrames(0)
+    , m_stopping(false)
+    , m_walFull(false)
+{
+}
+
+SQLiteCheckpointer::~SQLiteCheckpointer()
+{
+    stop();
+}
+
+bool SQLiteCheckpointer::start()
+{
+    if (m_thread.joinable())
+        return true;
+
+    std::string filename;
+    {
+        std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+        if (!m_database.isOpen())
+            return false;
+        const char* name = sqlite3_db_filename(m_database.sqlite3Handle(), "main");
+        filename = name ? name : "";
+    }
+    if (filename.empty() || !m_connection.open(filename))
+        return false;
+    m_connection.disableThreadingChecks();
+
+    SQLiteStatement journalMode(m_connection, "PRAGMA journal_mode");
+    SQLiteStatement pageSize(m_connection, "PRAGMA page_size");
+    if (journalMode.getColumnText(0) != "wal") {
+        SQLITE_LOG(WARNING) << "SQLite checkpointer needs a WAL-mode database";
+        journalMode.finalize();
+        m_connection.close();
+        return false;
+    }
+    m_pageSize = pageSize.getColumnInt(0);
+    journalMode.finalize();
+    pageSize.finalize();
+
+    {
+        // Replaces the automatic checkpoint, which uses the same hook.
+        std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+        sqlite3_wal_hook(m_database.sqlite3Handle(), walHook, this);
+        m_database.m_hasCheckpointer = true;
+    }
+
+    m_stopping = false;
+    m_walFull = false;
+    m_checkpointedFrames = 0;
+    m_thread = std::thread(&SQLiteCheckpointer::run, this);
+    return true;
+}
+
+void SQLiteCheckpointer::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+        m_database.m_hasCheckpointer = false;
+        if (m_database.isOpen())
+            sqlite3_wal_autocheckpoint(m_database.sqlite3Handle(), m_database.walAutoCheckpoint());
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    m_thread.join();
+    m_connection.close();
+}
+
+int SQLiteCheckpointer::walHook(void* context, sqlite3*, const char*, int frames)
+{
+    SQLiteCheckpointer* checkpointer = static_cast<SQLiteCheckpointer*>(context);
+    if (checkpointer->m_options.walFrameThreshold <= 0 || frames < checkpointer->m_options.walFrameThreshold)
+        return SQLITE_OK;
+
+    {
+        std::lock_guard<std::mutex> lock(checkpointer->m_lock);
+        checkpointer->m_walFull = true;
+    }
+    checkpointer->m_wakeUp.notify_one();
+    return SQLITE_OK;
+}
+
+int SQLiteCheckpointer::checkpointNow()
+{
+    if (!m_connection.isOpen())
+        return SQLITE_MISUSE;
+
+    std::lock_guard<std::mutex> checkpointLock(m_checkpointLock);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    int walFrames;
+    int checkpointedFrames;
+    int result = m_connection.checkpoint(SQLiteDatabase::CheckpointPassive, &walFrames, &checkpointedFrames);
+    // A smaller count means the writer started the WAL over.
+    if (checkpointedFrames < m_checkpointedFrames)
+        m_checkpointedFrames = 0;
+    int64_t framesCheckpointed = std::max(checkpointedFrames - m_checkpointedFrames, 0);
+    m_checkpointedFrames = std::max(checkpointedFrames, 0);
+
+    bool escalated = false;
+    bool escalationBusy = false;
+    if (result == SQLITE_OK && walFrames > 0 && checkpointedFrames == walFrames && m_options.escalation != SQLiteDatabase::CheckpointPassive) {
+        // Everything is copied already, so only the reset is left to do. Without
+        // a busy handler this gives up at once if a reader is still in the WAL.
+        int escalatedResult = m_connection.checkpoint(m_options.escalation, &walFrames, &checkpointedFrames);
+        if (escalatedResult == SQLITE_OK) {
+            escalated = true;
+            m_checkpointedFrames = 0;
+            if (m_options.escalation == SQLiteDatabase::CheckpointTruncate)
+                walFrames = 0;
+        } else if ((escalatedResult & 0xff) == SQLITE_BUSY)
+            escalationBusy = true;
+        else
+            result = escalatedResult;
+    }
+    int64_t duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    ++m_statistics.checkpoints;
+    if (escalated)
+        ++m_statistics.escalations;
+    if (escalationBusy)
+        ++m_statistics.busyEscalations;
+    if (result != SQLITE_OK && (result & 0xff) != SQLITE_BUSY) {
+        ++m_statistics.errors;
+        SQLITE_LOG(WARNING) << "SQLite checkpoint failed (" << result << ")";
+    }
+    m_statistics.framesCheckpointed += framesCheckpointed;
+    m_statistics.walFrames = std::max(walFrames, 0);
+    m_statistics.walBytes = m_statistics.walFrames ? walHeaderBytes + m_statistics.walFrames * (m_pageSize + walFrameHeaderBytes) : 0;
+    m_statistics.lastDurationNanoseconds = duration;
+    m_statistics.maxDurationNanoseconds = std::max(m_statistics.maxDurationNanoseconds, duration);
+    m_statistics.totalDurationNanoseconds += duration;
+    return result;
+}
+
+SQLiteCheckpointer::Statistics SQLiteCheckpointer::statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_statistics;
+}
+
+void SQLiteCheckpointer::run()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stopping) {
+        m_wakeUp.wait_for(lock, m_options.interval, [this]() { return m_stopping || m_walFull; });
+        if (m_stopping)
+            break;
+        m_walFull = false;
+
+        lock.unlock();
+        checkpointNow();
+        lock.lock();
+    }
+}
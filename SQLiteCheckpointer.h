@@ -0,0 +1,120 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteCheckpointer_h
+#define SQLiteCheckpointer_h
+
+#include "SQLiteDatabase.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct sqlite3;
+
+// Moves WAL checkpoints off the commit path of a WAL-mode database.
+//
+// While running, the checkpointer turns the connection's automatic
+// checkpoints off and checkpoints from a connection of its own on a
+// background thread instead: on a timer, and as soon as a commit leaves more
+// than walFrameThreshold frames in the WAL. Checkpoints are PASSIVE, so they
+// never wait for readers or the writer. When a PASSIVE checkpoint has copied
+// the whole WAL, an escalation to RESTART or TRUNCATE is attempted without
+// waiting, so the WAL starts over from the beginning (and shrinks, for
+// TRUNCATE) whenever no reader is still using it. An escalated checkpoint
+// holds the write lock while it resets the WAL, so writers need a busy
+// timeout.
+//
+// Stop the checkpointer (or destroy it) before closing the database.
+class SQLiteCheckpointer {
+public:
+    struct Options {
+        Options()
+            : interval(std::chrono::milliseconds(1000))
+            , walFrameThreshold(1000)
+            , escalation(SQLiteDatabase::CheckpointTruncate) { }
+
+        std::chrono::milliseconds interval;
+        // 0 checkpoints on the timer only.
+        int walFrameThreshold;
+        // CheckpointPassive turns escalation off.
+        SQLiteDatabase::CheckpointMode escalation;
+    };
+
+    struct Statistics {
+        Statistics()
+            : checkpoints(0), escalations(0), busyEscalations(0), errors(0), framesCheckpointed(0)
+            , walFrames(0), walBytes(0), lastDurationNanoseconds(0), maxDurationNanoseconds(0), totalDurationNanoseconds(0) { }
+
+        int64_t checkpoints;
+        // Escalated checkpoints that completed, and those that found the WAL in use.
+        int64_t escalations;
+        int64_t busyEscalations;
+        int64_t errors;
+        int64_t framesCheckpointed;
+        // WAL size after the last checkpoint.
+        int64_t walFrames;
+        int64_t walBytes;
+        // Duration of checkpoint runs, escalation included.
+        int64_t lastDurationNanoseconds;
+        int64_t maxDurationNanoseconds;
+        int64_t totalDurationNanoseconds;
+    };
+
+    SQLiteCheckpointer(SQLiteDatabase&, const Options& = Options());
+    ~SQLiteCheckpointer();
+
+    // Fails if the database is not an open WAL-mode database file.
+    bool start();
+    void stop();
+    bool isRunning() const { return m_thread.joinable(); }
+
+    // Runs one checkpoint on the calling thread. Only while running.
+    int checkpointNow();
+
+    Statistics statistics() const;
+
+private:
+    static int walHook(void*, sqlite3*, const char*, int frames);
+
+    void run();
+
+    SQLiteDatabase& m_database;
+    Options m_options;
+    // Checkpoints run here, so they never hold the lock of m_database.
+    SQLiteDatabase m_connection;
+    int m_pageSize;
+    // Frames copied by earlier checkpoints of the current WAL.
+    int m_checkpointedFrames;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    bool m_stopping;
+    bool m_walFull;
+    Statistics m_statistics;
+    std::mutex m_checkpointLock;
+    std::thread m_thread;
+};
+
+#endif
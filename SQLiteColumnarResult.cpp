@@ -0,0 +1,306 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteColumnarResult.h"
+
+#include <sqlite3.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+static SQLiteColumnarResult::ColumnType columnTypeForStorageClass(int storageClass)
+{
+    switch (storageClass) {
+    case SQLITE_INTEGER:
+        return SQLiteColumnarResult::IntegerColumn;
+    case SQLITE_FLOAT:
+        return SQLiteColumnarResult::FloatColumn;
+    case SQLITE_BLOB:
+        return SQLiteColumnarResult::BlobColumn;
+    default:
+        return SQLiteColumnarResult::TextColumn;
+    }
+}
+
+// Follows the column affinity rules of http://www.sqlite.org/datatype3.html
+static SQLiteColumnarResult::ColumnType columnTypeForDeclaredType(const char* declaredType)
+{
+    if (!declaredType)
+        return SQLiteColumnarResult::TextColumn;
+
+    std::string type(declaredType);
+    for (size_t i = 0; i < type.length(); ++i)
+        type[i] = toupper(type[i]);
+
+    if (type.find("INT") != std::string::npos)
+        return SQLiteColumnarResult::IntegerColumn;
+    if (type.find("CHAR") != std::string::npos || type.find("CLOB") != std::string::npos || type.find("TEXT") != std::string::npos)
+        return SQLiteColumnarResult::TextColumn;
+    if (type.find("BLOB") != std::string::npos)
+        return SQLiteColumnarResult::BlobColumn;
+    if (type.find("REAL") != std::string::npos || type.find("FLOA") != std::string::npos || type.find("DOUB") != std::string::npos)
+        return SQLiteColumnarResult::FloatColumn;
+    return SQLiteColumnarResult::TextColumn;
+}
+
+void SQLiteColumnarResult::Column::reserve(size_t rows)
+{
+    m_validity.reserve((rows + 7) / 8);
+    switch (m_type) {
+    case IntegerColumn:
+        m_integers.reserve(rows);
+        break;
+    case FloatColumn:
+        m_doubles.reserve(rows);
+        break;
+    case TextColumn:
+    case BlobColumn:
+        m_offsets.reserve(rows + 1);
+        break;
+    }
+    if (m_offsets.empty() && (m_type == TextColumn || m_type == BlobColumn))
+        m_offsets.push_back(0);
+}
+
+// Doubles hold every integer of at most 53 bits exactly.
+static bool isExactDouble(int64_t value)
+{
+    return value >= -(INT64_C(1) << 53) && value <= (INT64_C(1) << 53);
+}
+
+static void appendIntegerText(std::vector<char>& bytes, int64_t value)
+{
+    char buffer[32];
+    sqlite3_snprintf(sizeof(buffer), buffer, "%lld", static_cast<sqlite3_int64>(value));
+    bytes.insert(bytes.end(), buffer, buffer + strlen(buffer));
+}
+
+// Formats like SQLite does, with more digits when 15 do not round-trip.
+static void appendDoubleText(std::vector<char>& bytes, double value)
+{
+    char buffer[32];
+    sqlite3_snprintf(sizeof(buffer), buffer, "%!.15g", value);
+    if (strtod(buffer, nullptr) != value)
+        sqlite3_snprintf(sizeof(buffer), buffer, "%!.17g", value);
+    bytes.insert(bytes.end(), buffer, buffer + strlen(buffer));
+}
+
+SQLiteColumnarResult::ColumnType SQLiteColumnarResult::Column::typeForValue(sqlite3_stmt* statement, int col) const
+{
+    int storageClass = sqlite3_column_type(statement, col);
+    if (!m_hasValues)
+        return columnTypeForStorageClass(storageClass);
+
+    switch (m_type) {
+    case IntegerColumn:
+        if (storageClass == SQLITE_INTEGER)
+            return IntegerColumn;
+        if (storageClass == SQLITE_FLOAT) {
+            for (size_t row = 0; row < m_size; ++row) {
+                if (!isExactDouble(m_integers[row]))
+                    return TextColumn;
+            }
+            return FloatColumn;
+        }
+        return TextColumn;
+    case FloatColumn:
+        if (storageClass == SQLITE_FLOAT)
+            return FloatColumn;
+        if (storageClass == SQLITE_INTEGER && isExactDouble(sqlite3_column_int64(statement, col)))
+            return FloatColumn;
+        return TextColumn;
+    case TextColumn:
+    case BlobColumn:
+        break;
+    }
+    return m_type;
+}
+
+void SQLiteColumnarResult::Column::changeType(ColumnType type)
+{
+    std::vector<int64_t> integers;
+    std::vector<double> doubles;
+    std::vector<uint64_t> offsets;
+    std::vector<char> bytes;
+
+    if (type == TextColumn || type == BlobColumn)
+        offsets.push_back(0);
+    for (size_t row = 0; row < m_size; ++row) {
+        bool isNull = this->isNull(row);
+        switch (type) {
+        case IntegerColumn:
+            // Only reached while every row is NULL.
+            integers.push_back(0);
+            break;
+        case FloatColumn:
+            doubles.push_back(isNull ? 0.0 : m_type == IntegerColumn ? static_cast<double>(m_integers[row]) : m_doubles[row]);
+            break;
+        case TextColumn:
+        case BlobColumn:
+            if (!isNull) {
+                if (m_type == IntegerColumn)
+                    appendIntegerText(bytes, m_integers[row]);
+                else if (m_type == FloatColumn)
+                    appendDoubleText(bytes, m_doubles[row]);
+                else
+                    bytes.insert(bytes.end(), m_bytes.begin() + m_offsets[row], m_bytes.begin() + m_offsets[row + 1]);
+            }
+            offsets.push_back(bytes.size());
+            break;
+        }
+    }
+
+    m_type = type;
+    m_integers.swap(integers);
+    m_doubles.swap(doubles);
+    m_offsets.swap(offsets);
+    m_bytes.swap(bytes);
+}
+
+size_t SQLiteColumnarResult::Column::append(sqlite3_stmt* statement, int col)
+{
+    size_t bytes = byteSize();
+    int storageClass = sqlite3_column_type(statement, col);
+    bool isNull = storageClass == SQLITE_NULL;
+    if (!isNull) {
+        ColumnType type = typeForValue(statement, col);
+        if (type != m_type)
+            changeType(type);
+        m_hasValues = true;
+    }
+
+    if (!(m_size & 7))
+        m_validity.push_back(0);
+    if (!isNull)
+        m_validity.back() |= 1 << (m_size & 7);
+
+    switch (m_type) {
+    case IntegerColumn:
+        m_integers.push_back(isNull ? 0 : sqlite3_column_int64(statement, col));
+        break;
+    case FloatColumn:
+        m_doubles.push_back(isNull ? 0.0 : sqlite3_column_double(statement, col));
+        break;
+    case TextColumn:
+    case BlobColumn:
+        if (storageClass == SQLITE_INTEGER)
+            appendIntegerText(m_bytes, sqlite3_column_int64(statement, col));
+        else if (storageClass == SQLITE_FLOAT)
+            appendDoubleText(m_bytes, sqlite3_column_double(statement, col));
+        else if (!isNull) {
+            // Fetch the value before its length so the length matches the
+            // representation that was asked for.
+            const char* value = m_type == TextColumn ? reinterpret_cast<const char*>(sqlite3_column_text(statement, col))
+                                                     : static_cast<const char*>(sqlite3_column_blob(statement, col));
+            int length = sqlite3_column_bytes(statement, col);
+            if (value)
+                m_bytes.insert(m_bytes.end(), value, value + length);
+        }
+        m_offsets.push_back(m_bytes.size());
+        break;
+    }
+
+    ++m_size;
+    return byteSize() - bytes;
+}
+
+void SQLiteColumnarResult::Column::clearRows()
+{
+    m_size = 0;
+    m_validity.clear();
+    m_integers.clear();
+    m_doubles.clear();
+    m_bytes.clear();
+    m_offsets.clear();
+    if (m_type == TextColumn || m_type == BlobColumn)
+        m_offsets.push_back(0);
+}
+
+size_t SQLiteColumnarResult::Column::byteSize() const
+{
+    switch (m_type) {
+    case IntegerColumn:
+        return m_size * sizeof(int64_t);
+    case FloatColumn:
+        return m_size * sizeof(double);
+    case TextColumn:
+    case BlobColumn:
+        break;
+    }
+    return m_bytes.size() + m_size * sizeof(uint64_t);
+}
+
+size_t SQLiteColumnarResult::Column::allocatedBytes() const
+{
+    return m_validity.capacity() + m_integers.capacity() * sizeof(int64_t) + m_doubles.capacity() * sizeof(double)
+        + m_offsets.capacity() * sizeof(uint64_t) + m_bytes.capacity();
+}
+
+size_t SQLiteColumnarResult::allocatedBytes() const
+{
+    size_t bytes = 0;
+    for (size_t col = 0; col < m_columns.size(); ++col)
+        bytes += m_columns[col].allocatedBytes();
+    return bytes;
+}
+
+void SQLiteColumnarResult::clear()
+{
+    m_rowCount = 0;
+    m_byteSize = 0;
+    m_columns.clear();
+}
+
+void SQLiteColumnarResult::clearRows()
+{
+    m_rowCount = 0;
+    m_byteSize = 0;
+    for (size_t col = 0; col < m_columns.size(); ++col)
+        m_columns[col].clearRows();
+}
+
+void SQLiteColumnarResult::setUpColumns(sqlite3_stmt* statement, bool onRow, size_t expectedRows)
+{
+    clear();
+
+    int count = sqlite3_column_count(statement);
+    m_columns.reserve(count);
+    for (int col = 0; col < count; ++col) {
+        ColumnType type;
+        if (onRow && sqlite3_column_type(statement, col) != SQLITE_NULL)
+            type = columnTypeForStorageClass(sqlite3_column_type(statement, col));
+        else
+            type = columnTypeForDeclaredType(sqlite3_column_decltype(statement, col));
+
+        const char* name = sqlite3_column_name(statement, col);
+        m_columns.push_back(Column(name ? name : "", type));
+        m_columns.back().reserve(expectedRows);
+    }
+}
+
+void SQLiteColumnarResult::appendRow(sqlite3_stmt* statement)
+{
+    for (size_t col = 0; col < m_columns.size(); ++col)
+        m_byteSize += m_columns[col].append(statement, col);
+    ++m_rowCount;
+}
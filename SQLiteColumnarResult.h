@@ -0,0 +1,130 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteColumnarResult_h
+#define SQLiteColumnarResult_h
+
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+struct sqlite3_stmt;
+
+class SQLiteStatement;
+
+// A whole result set stored column by column, filled by
+// SQLiteStatement::returnColumnarResults().
+//
+// Every column keeps its values in one contiguous typed buffer plus a
+// validity bitmap (bit i set when row i is not NULL), so vectorized code can
+// consume it without a row-to-column transpose. Text and blob columns use a
+// single byte buffer and rowCount() + 1 offsets into it.
+class SQLiteColumnarResult {
+private:
+    SQLiteColumnarResult(const SQLiteColumnarResult&);
+    SQLiteColumnarResult& operator=(const SQLiteColumnarResult&);
+public:
+    // The type of a column is taken from the storage class of its first
+    // non-NULL value, and from the declared type until there is one. A later
+    // value the type cannot hold exactly widens the column: an IntegerColumn
+    // becomes a FloatColumn for a REAL value, and a numeric column becomes a
+    // TextColumn for a text or blob value or for an integer a double cannot
+    // represent. Text and blob columns take any value, numbers as their text.
+    enum ColumnType { IntegerColumn, FloatColumn, TextColumn, BlobColumn };
+
+    class Column {
+    public:
+        Column(const std::string& name, ColumnType type) : m_name(name), m_type(type), m_size(0), m_hasValues(false) { }
+
+        const std::string& name() const { return m_name; }
+        ColumnType type() const { return m_type; }
+        size_t size() const { return m_size; }
+
+        bool isNull(size_t row) const { return !(m_validity[row >> 3] & (1 << (row & 7))); }
+        const uint8_t* validityBitmap() const { return m_validity.data(); }
+
+        // IntegerColumn values.
+        const int64_t* integers() const { return m_integers.data(); }
+        // FloatColumn values.
+        const double* doubles() const { return m_doubles.data(); }
+        // TextColumn and BlobColumn values: row i is bytes()[offsets()[i], offsets()[i + 1]).
+        const uint64_t* offsets() const { return m_offsets.data(); }
+        const char* bytes() const { return m_bytes.data(); }
+        std::string_view bytesAt(size_t row) const { return std::string_view(m_bytes.data() + m_offsets[row], m_offsets[row + 1] - m_offsets[row]); }
+
+    private:
+        friend class SQLiteColumnarResult;
+
+        void reserve(size_t rows);
+        // Returns the number of bytes the value added to the column,
+        // including any growth from widening it.
+        size_t append(sqlite3_stmt*, int col);
+        void clearRows();
+        size_t byteSize() const;
+        size_t allocatedBytes() const;
+
+        ColumnType typeForValue(sqlite3_stmt*, int col) const;
+        // Converts the rows held so far to another type.
+        void changeType(ColumnType);
+
+        std::string m_name;
+        ColumnType m_type;
+        size_t m_size;
+        // Whether a non-NULL value has been seen, after which the type only widens.
+        bool m_hasValues;
+        std::vector<uint8_t> m_validity;
+        std::vector<int64_t> m_integers;
+        std::vector<double> m_doubles;
+        std::vector<uint64_t> m_offsets;
+        std::vector<char> m_bytes;
+    };
+
+    SQLiteColumnarResult() : m_rowCount(0), m_byteSize(0) { }
+
+    size_t rowCount() const { return m_rowCount; }
+    size_t columnCount() const { return m_columns.size(); }
+    const Column& column(size_t index) const { return m_columns[index]; }
+
+    // Bytes of column data held, and bytes allocated for the column buffers.
+    size_t byteSize() const { return m_byteSize; }
+    size_t allocatedBytes() const;
+
+    void clear();
+    // Drops the rows but keeps the columns and their buffers, so the result
+    // can be refilled without allocating.
+    void clearRows();
+
+private:
+    friend class SQLiteStatement;
+
+    // Sets up the columns from the statement's current row, reserving room
+    // for expectedRows rows. Without an estimate buffers grow geometrically.
+    void setUpColumns(sqlite3_stmt*, bool onRow, size_t expectedRows);
+    void appendRow(sqlite3_stmt*);
+
+    size_t m_rowCount;
+    size_t m_byteSize;
+    std::vector<Column> m_columns;
+};
+
+#endif // SQLiteColumnarResult_h
@@ -0,0 +1,306 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteConnectionPool.h"
+
+#include "SQLiteLog.h"
+
+#include <algorithm>
+
+static const size_t maxAffinityThreads = 1024;
+
+static int64_t nanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+SQLiteConnectionPool::Lease::Lease(SQLiteConnectionPool* pool, SQLiteDatabase* database, size_t index)
+    : m_pool(pool)
+    , m_database(database)
+    , m_index(index)
+    , m_leasedAt(std::chrono::steady_clock::now())
+{
+}
+
+SQLiteConnectionPool::Lease::Lease(Lease&& other)
+    : m_pool(other.m_pool)
+    , m_database(other.m_database)
+    , m_index(other.m_index)
+    , m_leasedAt(other.m_leasedAt)
+{
+    other.m_pool = 0;
+    other.m_database = 0;
+}
+
+SQLiteConnectionPool::Lease& SQLiteConnectionPool::Lease::operator=(Lease&& other)
+{
+    if (this != &other) {
+        release();
+        m_pool = other.m_pool;
+        m_database = other.m_database;
+        m_index = other.m_index;
+        m_leasedAt = other.m_leasedAt;
+        other.m_pool = 0;
+        other.m_database = 0;
+    }
+    return *this;
+}
+
+void SQLiteConnectionPool::Lease::release()
+{
+    if (!m_database)
+        return;
+
+    m_pool->giveBack(m_index, m_leasedAt);
+    m_pool = 0;
+    m_database = 0;
+}
+
+SQLiteConnectionPool::SQLiteConnectionPool()
+    : m_writerBusy(false)
+    , m_busyReaders(0)
+    , m_threadAffinity(true)
+    , m_nextAffinity(0)
+{
+}
+
+SQLiteConnectionPool::~SQLiteConnectionPool()
+{
+    close();
+}
+
+bool SQLiteConnectionPool::open(const std::string& filename, size_t readerCount)
+{
+    close();
+
+    std::unique_ptr<SQLiteDatabase> writer(new SQLiteDatabase);
+    if (!writer->open(filename))
+        return false;
+    writer->disableThreadingChecks();
+
+    if (!writer->setJournalMode(SQLiteDatabase::JournalWAL)) {
+        SQLITE_LOG(ERROR) << "SQLite database " << filename << " could not be switched to WAL mode";
+        return false;
+    }
+
+    std::vector<std::unique_ptr<SQLiteDatabase> > readers;
+    for (size_t i = 0; i < std::max<size_t>(readerCount, 1); ++i) {
+        std::unique_ptr<SQLiteDatabase> reader(new SQLiteDatabase);
+        if (!reader->open(filename) || !reader->executeCommand("PRAGMA query_only = 1")) {
+            SQLITE_LOG(ERROR) << "SQLite database " << filename << " could not open reader connection " << i;
+            return false;
+        }
+        reader->disableThreadingChecks();
+        readers.push_back(std::move(reader));
+    }
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_writer = std::move(writer);
+    m_readers = std::move(readers);
+    m_readerBusy.assign(m_readers.size(), false);
+    m_writerBusy = false;
+    m_busyReaders = 0;
+    m_affinity.clear();
+    m_nextAffinity = 0;
+    m_statistics = Statistics();
+    m_statisticsStart = std::chrono::steady_clock::now();
+    return true;
+}
+
+void SQLiteConnectionPool::close()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_connectionReturned.wait(lock, [this] { return !m_writerBusy && !m_busyReaders; });
+
+    // Readers first, so the writer's close checkpoints and removes the WAL file.
+    m_readers.clear();
+    m_readerBusy.clear();
+    m_affinity.clear();
+    m_writer.reset();
+}
+
+bool SQLiteConnectionPool::isOpen() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_writer.get();
+}
+
+size_t SQLiteConnectionPool::readerCount() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_readers.size();
+}
+
+void SQLiteConnectionPool::setThreadAffinity(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_threadAffinity = enabled;
+}
+
+bool SQLiteConnectionPool::threadAffinity() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_threadAffinity;
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::reader()
+{
+    return leaseReader(true);
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::writer()
+{
+    return leaseWriter(true);
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::tryReader()
+{
+    return leaseReader(false);
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::tryWriter()
+{
+    return leaseWriter(false);
+}
+
+size_t SQLiteConnectionPool::takeFreeReader(bool& affinityHit)
+{
+    affinityHit = false;
+    size_t preferred = writerIndex;
+    if (m_threadAffinity) {
+        // Threads are spread over the readers in the order they first ask.
+        std::unordered_map<std::thread::id, size_t>::iterator it = m_affinity.find(std::this_thread::get_id());
+        if (it == m_affinity.end()) {
+            if (m_affinity.size() >= maxAffinityThreads)
+                m_affinity.clear();
+            it = m_affinity.insert(std::make_pair(std::this_thread::get_id(), m_nextAffinity++ % m_readers.size())).first;
+        }
+        preferred = it->second;
+        if (!m_readerBusy[preferred]) {
+            affinityHit = true;
+            return preferred;
+        }
+    }
+
+    for (size_t i = 0; i < m_readers.size(); ++i) {
+        if (!m_readerBusy[i])
+            return i;
+    }
+    return writerIndex;
+}
+
+void SQLiteConnectionPool::recordWait(std::chrono::steady_clock::time_point start)
+{
+    int64_t waited = nanosecondsSince(start);
+    ++m_statistics.leaseWaits;
+    m_statistics.leaseWaitNanoseconds += waited;
+    m_statistics.maxLeaseWaitNanoseconds = std::max(m_statistics.maxLeaseWaitNanoseconds, waited);
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::leaseReader(bool wait)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (m_readers.empty())
+        return Lease();
+
+    bool affinityHit;
+    size_t index = takeFreeReader(affinityHit);
+    if (index == writerIndex) {
+        if (!wait)
+            return Lease();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        m_connectionReturned.wait(lock, [this, &index, &affinityHit] {
+            return m_readers.empty() || (index = takeFreeReader(affinityHit)) != writerIndex;
+        });
+        if (m_readers.empty())
+            return Lease();
+        recordWait(start);
+    }
+
+    if (m_threadAffinity) {
+        if (affinityHit)
+            ++m_statistics.affinityHits;
+        else
+            ++m_statistics.affinityMisses;
+    }
+    m_readerBusy[index] = true;
+    ++m_busyReaders;
+    ++m_statistics.readerLeases;
+    m_statistics.peakBusyReaders = std::max(m_statistics.peakBusyReaders, m_busyReaders);
+    return Lease(this, m_readers[index].get(), index);
+}
+
+SQLiteConnectionPool::Lease SQLiteConnectionPool::leaseWriter(bool wait)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    if (!m_writer)
+        return Lease();
+
+    if (m_writerBusy) {
+        if (!wait)
+            return Lease();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        m_connectionReturned.wait(lock, [this] { return !m_writer || !m_writerBusy; });
+        if (!m_writer)
+            return Lease();
+        recordWait(start);
+    }
+
+    m_writerBusy = true;
+    ++m_statistics.writerLeases;
+    return Lease(this, m_writer.get(), writerIndex);
+}
+
+void SQLiteConnectionPool::giveBack(size_t index, std::chrono::steady_clock::time_point leasedAt)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_statistics.leasedNanoseconds += nanosecondsSince(leasedAt);
+        if (index == writerIndex)
+            m_writerBusy = false;
+        else {
+            m_readerBusy[index] = false;
+            --m_busyReaders;
+        }
+    }
+    // Waiters may want a particular reader, so wake them all.
+    m_connectionReturned.notify_all();
+}
+
+SQLiteConnectionPool::Statistics SQLiteConnectionPool::statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    Statistics statistics = m_statistics;
+    statistics.openNanoseconds = m_writer ? nanosecondsSince(m_statisticsStart) : 0;
+    statistics.connections = m_writer ? m_readers.size() + 1 : 0;
+    statistics.busyReaders = m_busyReaders;
+    return statistics;
+}
+
+void SQLiteConnectionPool::resetStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_statistics = Statistics();
+    m_statistics.peakBusyReaders = m_busyReaders;
+    m_statisticsStart = std::chrono::steady_clock::now();
+}
@@ -0,0 +1,157 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteConnectionPool_h
+#define SQLiteConnectionPool_h
+
+#include "SQLiteDatabase.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One writer and N reader connections to the same database file in WAL mode.
+// Readers never wait for the writer or for each other on a connection lock,
+// so reads scale with the number of reader connections; writes are still
+// serialized through the single writer.
+//
+// Connections are leased with reader() and writer() and returned when the
+// Lease goes out of scope. With thread affinity on, a thread gets the same
+// reader back whenever it is free, keeping that connection's page cache and
+// statement cache warm for the queries the thread runs.
+class SQLiteConnectionPool {
+private:
+    SQLiteConnectionPool(const SQLiteConnectionPool&);
+    SQLiteConnectionPool& operator=(const SQLiteConnectionPool&);
+public:
+    class Lease {
+    public:
+        Lease() : m_pool(0), m_database(0), m_index(0), m_leasedAt() { }
+        Lease(Lease&&);
+        Lease& operator=(Lease&&);
+        ~Lease() { release(); }
+
+        // Returns the connection to the pool early.
+        void release();
+
+        bool isValid() const { return m_database; }
+        SQLiteDatabase& database() const { return *m_database; }
+        SQLiteDatabase* operator->() const { return m_database; }
+        SQLiteDatabase& operator*() const { return *m_database; }
+
+    private:
+        friend class SQLiteConnectionPool;
+        Lease(SQLiteConnectionPool*, SQLiteDatabase*, size_t index);
+
+        SQLiteConnectionPool* m_pool;
+        SQLiteDatabase* m_database;
+        // Reader index, or writerIndex.
+        size_t m_index;
+        std::chrono::steady_clock::time_point m_leasedAt;
+    };
+
+    struct Statistics {
+        Statistics()
+            : readerLeases(0), writerLeases(0), leaseWaits(0), leaseWaitNanoseconds(0), maxLeaseWaitNanoseconds(0)
+            , affinityHits(0), affinityMisses(0), leasedNanoseconds(0), openNanoseconds(0), connections(0)
+            , busyReaders(0), peakBusyReaders(0) { }
+
+        // Fraction of connection time spent leased since open() or the last reset.
+        double utilization() const { return openNanoseconds && connections ? static_cast<double>(leasedNanoseconds) / (static_cast<double>(openNanoseconds) * connections) : 0; }
+
+        int64_t readerLeases;
+        int64_t writerLeases;
+        // Leases that had to wait for a connection, and the total time they waited.
+        int64_t leaseWaits;
+        int64_t leaseWaitNanoseconds;
+        int64_t maxLeaseWaitNanoseconds;
+        // Reader leases that got, or could not get, the calling thread's reader.
+        int64_t affinityHits;
+        int64_t affinityMisses;
+        // Time connections were leased, over all connections, counting only
+        // returned leases.
+        int64_t leasedNanoseconds;
+        int64_t openNanoseconds;
+        size_t connections;
+        size_t busyReaders;
+        size_t peakBusyReaders;
+    };
+
+    SQLiteConnectionPool();
+    ~SQLiteConnectionPool();
+
+    // Opens the writer, switches the file to WAL mode and opens readerCount
+    // (at least one) read-only reader connections.
+    bool open(const std::string& filename, size_t readerCount);
+    bool isOpen() const;
+    // Waits for all leases to be returned first.
+    void close();
+
+    size_t readerCount() const;
+
+    void setThreadAffinity(bool enabled);
+    bool threadAffinity() const;
+
+    // Block until a connection is free.
+    Lease reader();
+    Lease writer();
+    // Return an invalid lease instead of waiting.
+    Lease tryReader();
+    Lease tryWriter();
+
+    Statistics statistics() const;
+    void resetStatistics();
+
+private:
+    static const size_t writerIndex = static_cast<size_t>(-1);
+
+    Lease leaseReader(bool wait);
+    Lease leaseWriter(bool wait);
+    // Returns writerIndex if no reader is free.
+    size_t takeFreeReader(bool& affinityHit);
+    void recordWait(std::chrono::steady_clock::time_point start);
+    void giveBack(size_t index, std::chrono::steady_clock::time_point leasedAt);
+
+    std::unique_ptr<SQLiteDatabase> m_writer;
+    std::vector<std::unique_ptr<SQLiteDatabase> > m_readers;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_connectionReturned;
+    bool m_writerBusy;
+    std::vector<bool> m_readerBusy;
+    size_t m_busyReaders;
+    bool m_threadAffinity;
+    // Cleared when full, so threads that have exited do not pile up.
+    std::unordered_map<std::thread::id, size_t> m_affinity;
+    size_t m_nextAffinity;
+
+    std::chrono::steady_clock::time_point m_statisticsStart;
+    Statistics m_statistics;
+};
+
+#endif
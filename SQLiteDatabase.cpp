@@ -28,14 +28,16 @@
 
 #include "DatabaseAuthorizer.h"
 #include "SQLiteFileSystem.h"
+#include "SQLiteLog.h"
+#include "SQLiteSlowQueryLog.h"
 #include "SQLiteStatement.h"
 #include <sqlite3.h>
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <strings.h>
 
-#define D_LOG_DEBUG printf
-#define D_LOG_ERROR printf
 
 #ifndef NDEBUG
 #define ASSERT(x)
@@ -68,19 +70,41 @@ const int SQLResultSchema = SQLITE_SCHEMA;
 const int SQLResultFull = SQLITE_FULL;
 const int SQLResultInterrupt = SQLITE_INTERRUPT;
 const int SQLResultConstraint = SQLITE_CONSTRAINT;
+const int SQLResultRange = SQLITE_RANGE;
 
 static const char notOpenErrorMessage[] = "database is not open";
 
+static const size_t defaultStatementCacheCapacity = 32;
+
+static const int defaultWALAutoCheckpoint = 1000;
+
+// Returns true if the statement starts with a keyword that changes the schema.
+static bool isSchemaStatement(const std::string& sql)
+{
+    size_t start = sql.find_first_not_of(" \t\r\n");
+    if (start == std::string::npos)
+        return false;
+
+    const char* keyword = sql.c_str() + start;
+    return !strncasecmp(keyword, "CREATE", 6) || !strncasecmp(keyword, "DROP", 4) || !strncasecmp(keyword, "ALTER", 5);
+}
+
 SQLiteDatabase::SQLiteDatabase()
     : m_db(0)
     , m_pageSize(-1)
     , m_transactionInProgress(false)
+    , m_transactionDepth(0)
     , m_sharable(false)
     , m_openingThread(0)
     , m_interrupted(false)
     , m_openError(SQLITE_ERROR)
     , m_openErrorMessage()
     , m_lastChangesCount(0)
+    , m_walAutoCheckpoint(defaultWALAutoCheckpoint)
+    , m_hasCheckpointer(false)
+    , m_statementCache(defaultStatementCacheCapacity)
+    , m_isProfiling(false)
+    , m_isSlowQueryLogEnabled(false)
 {
 }
 
@@ -96,7 +120,7 @@ bool SQLiteDatabase::open(const std::string& filename, bool forWebSQLDatabase)
     m_openError = SQLiteFileSystem::openDatabase(filename, &m_db, forWebSQLDatabase);
     if (m_openError != SQLITE_OK) {
         m_openErrorMessage = m_db ? std::string(sqlite3_errmsg(m_db)) : std::string("sqlite_open returned null");
-        D_LOG_ERROR("SQLite database failed to load from %s\nCause - %s", filename.data(), m_openErrorMessage.data());
+        SQLITE_LOG(ERROR) << "SQLite database failed to load from " << filename << "\nCause - " << m_openErrorMessage;
         sqlite3_close(m_db);
         m_db = 0;
         return false;
@@ -105,19 +129,23 @@ bool SQLiteDatabase::open(const std::string& filename, bool forWebSQLDatabase)
     m_openError = sqlite3_extended_result_codes(m_db, 1);
     if (m_openError != SQLITE_OK) {
         m_openErrorMessage = std::string(sqlite3_errmsg(m_db));
-        D_LOG_ERROR("SQLite database error when enabling extended errors - %s", m_openErrorMessage.data());
+        SQLITE_LOG(ERROR) << "SQLite database error when enabling extended errors - " << m_openErrorMessage;
         sqlite3_close(m_db);
         m_db = 0;
         return false;
     }
 
+    m_walAutoCheckpoint = defaultWALAutoCheckpoint;
+
     if (isOpen())
         m_openingThread = std::this_thread::get_id();
     else
         m_openErrorMessage = "sqlite_open returned null";
 
     if (!SQLiteStatement(*this, std::string("PRAGMA temp_store = MEMORY;")).executeCommand())
-        D_LOG_ERROR("SQLite database could not set temp_store to memory");
+        SQLITE_LOG(ERROR) << "SQLite database could not set temp_store to memory";
+
+    installTraceHook();
 
     return isOpen();
 }
@@ -127,6 +155,10 @@ void SQLiteDatabase::close()
     if (m_db) {
         // FIXME: This is being called on the main thread during JS GC. <rdar://problem/5739818>
         // ASSERT(std::this_thread::get_id() == m_openingThread);
+        {
+            std::lock_guard<std::mutex> lock(m_lockingMutex);
+            m_statementCache.clear();
+        }
         sqlite3* db = m_db;
         {
             //MutexLocker locker(m_databaseClosingMutex);
@@ -136,11 +168,100 @@ void SQLiteDatabase::close()
         sqlite3_close(db);
     }
 
+    // Closing the connection rolled back any open transaction.
+    m_transactionInProgress = false;
+    m_transactionDepth = 0;
+
     m_openingThread = (std::thread::id)0;
     m_openError = SQLITE_ERROR;
     m_openErrorMessage = std::string();
 }
 
+SQLitePlanWatchdog& SQLiteDatabase::enablePlanWatchdog(bool logFindings)
+{
+    std::lock_guard<std::mutex> lock(m_lockingMutex);
+    if (!m_planWatchdog)
+        m_planWatchdog.reset(new SQLitePlanWatchdog(logFindings));
+    else
+        m_planWatchdog->setLogFindings(logFindings);
+    return *m_planWatchdog;
+}
+
+void SQLiteDatabase::disablePlanWatchdog()
+{
+    std::lock_guard<std::mutex> lock(m_lockingMutex);
+    m_planWatchdog.reset();
+}
+
+SQLiteSlowQueryLog& SQLiteDatabase::enableSlowQueryLog(const SQLiteSlowQueryLogOptions& options)
+{
+    std::lock_guard<std::mutex> lock(m_lockingMutex);
+    if (!m_slowQueryLog)
+        m_slowQueryLog.reset(new SQLiteSlowQueryLog(options));
+    else
+        m_slowQueryLog->setOptions(options);
+    m_isSlowQueryLogEnabled.store(true, std::memory_order_relaxed);
+    return *m_slowQueryLog;
+}
+
+void SQLiteDatabase::disableSlowQueryLog()
+{
+    m_isSlowQueryLogEnabled.store(false, std::memory_order_relaxed);
+}
+
+SQLiteDatabase::ConnectionStatus SQLiteDatabase::connectionStatus(bool resetCounters)
+{
+    ConnectionStatus status;
+    if (!m_db)
+        return status;
+
+    int reset = resetCounters ? 1 : 0;
+    int highwater = 0;
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_HIT, &status.cacheHits, &highwater, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_MISS, &status.cacheMisses, &highwater, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_WRITE, &status.cacheWrites, &highwater, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_SPILL, &status.cacheSpills, &highwater, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_CACHE_USED, &status.cacheUsed, &highwater, 0);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_LOOKASIDE_USED, &status.lookasideUsed, &status.lookasideHighwater, reset);
+    // The lookaside hit and miss counts are reported in the high-water slot.
+    int current = 0;
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_LOOKASIDE_HIT, &current, &status.lookasideHits, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, &current, &status.lookasideMissesSize, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, &current, &status.lookasideMissesFull, reset);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_SCHEMA_USED, &status.schemaUsed, &highwater, 0);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_STMT_USED, &status.statementUsed, &highwater, 0);
+    sqlite3_db_status(m_db, SQLITE_DBSTATUS_DEFERRED_FKS, &status.deferredForeignKeys, &highwater, 0);
+    return status;
+}
+
+SQLiteProfiler& SQLiteDatabase::enableProfiling()
+{
+    std::lock_guard<std::mutex> lock(m_lockingMutex);
+    if (!m_profiler)
+        m_profiler.reset(new SQLiteProfiler);
+    m_isProfiling = true;
+    installTraceHook();
+    return *m_profiler;
+}
+
+void SQLiteDatabase::disableProfiling()
+{
+    std::lock_guard<std::mutex> lock(m_lockingMutex);
+    m_isProfiling = false;
+    installTraceHook();
+}
+
+void SQLiteDatabase::installTraceHook()
+{
+    if (!m_db)
+        return;
+
+    if (m_isProfiling)
+        sqlite3_trace_v2(m_db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE | SQLITE_TRACE_ROW, &SQLiteProfiler::traceCallback, m_profiler.get());
+    else
+        sqlite3_trace_v2(m_db, 0, 0, 0);
+}
+
 void SQLiteDatabase::interrupt()
 {
     m_interrupted = true;
@@ -200,7 +321,7 @@ void SQLiteDatabase::setMaximumSize(int64_t size)
     SQLiteStatement statement(*this, std::string("PRAGMA max_page_count = ") + std::to_string(newMaxPageCount));
     statement.prepare();
     if (statement.step() != SQLResultRow)
-        D_LOG_ERROR("Failed to set maximum size of database to %lli bytes", static_cast<long long>(size));
+        SQLITE_LOG(ERROR) << "Failed to set maximum size of database to " << size << " bytes";
 
     enableAuthorizer(true);
 
@@ -259,12 +380,55 @@ void SQLiteDatabase::setSynchronous(SynchronousPragma sync)
     executeCommand(std::string("PRAGMA synchronous = ") + std::to_string(sync));
 }
 
+bool SQLiteDatabase::setJournalMode(JournalMode mode)
+{
+    static const char* const modeNames[] = { "delete", "truncate", "persist", "memory", "wal", "off" };
+
+    // The pragma returns the journal mode in effect afterwards.
+    SQLiteStatement statement(*this, std::string("PRAGMA journal_mode = ") + modeNames[mode]);
+    if (statement.prepare() != SQLITE_OK || statement.step() != SQLITE_ROW)
+        return false;
+    std::string newMode = statement.getColumnText(0);
+    if (newMode != modeNames[mode]) {
+        SQLITE_LOG(WARNING) << "SQLite database journal mode is " << newMode << " instead of " << modeNames[mode];
+        return false;
+    }
+    return true;
+}
+
+void SQLiteDatabase::setWALAutoCheckpoint(int frames)
+{
+    if (!m_db) {
+        SQLITE_LOG(INFO) << "WAL autocheckpoint set on non-open database";
+        return;
+    }
+
+    std::lock_guard<std::mutex> locker(m_lockingMutex);
+    m_walAutoCheckpoint = std::max(frames, 0);
+    // sqlite3_wal_autocheckpoint() would replace the checkpointer's hook.
+    if (!m_hasCheckpointer)
+        sqlite3_wal_autocheckpoint(m_db, m_walAutoCheckpoint);
+}
+
+int SQLiteDatabase::checkpoint(CheckpointMode mode, int* walFrames, int* checkpointedFrames)
+{
+    if (walFrames)
+        *walFrames = -1;
+    if (checkpointedFrames)
+        *checkpointedFrames = -1;
+    if (!m_db)
+        return SQLITE_MISUSE;
+
+    std::lock_guard<std::mutex> locker(m_lockingMutex);
+    return sqlite3_wal_checkpoint_v2(m_db, 0, mode, walFrames, checkpointedFrames);
+}
+
 void SQLiteDatabase::setBusyTimeout(int ms)
 {
     if (m_db)
         sqlite3_busy_timeout(m_db, ms);
     else
-        D_LOG_DEBUG("BusyTimeout set on non-open database");
+        SQLITE_LOG(INFO) << "BusyTimeout set on non-open database";
 }
 
 void SQLiteDatabase::setBusyHandler(int(*handler)(void*, int))
@@ -272,7 +436,27 @@ void SQLiteDatabase::setBusyHandler(int(*handler)(void*, int))
     if (m_db)
         sqlite3_busy_handler(m_db, handler, NULL);
     else
-        D_LOG_DEBUG("Busy handler set on non-open database");
+        SQLITE_LOG(INFO) << "Busy handler set on non-open database";
+}
+
+int SQLiteDatabase::busyHandlerFunction(void* userData, int count)
+{
+    return static_cast<SQLiteDatabase*>(userData)->m_busyHandler(count);
+}
+
+void SQLiteDatabase::setBusyHandler(const BusyHandler& handler)
+{
+    if (!m_db) {
+        SQLITE_LOG(INFO) << "Busy handler set on non-open database";
+        return;
+    }
+
+    std::lock_guard<std::mutex> locker(m_lockingMutex);
+    m_busyHandler = handler;
+    if (m_busyHandler)
+        sqlite3_busy_handler(m_db, busyHandlerFunction, this);
+    else
+        sqlite3_busy_handler(m_db, 0, 0);
 }
 
 bool SQLiteDatabase::executeCommand(const std::string& sql)
@@ -302,7 +486,7 @@ void SQLiteDatabase::clearAllTables()
     std::string query = "SELECT name FROM sqlite_master WHERE type='table';";
     std::vector<std::string> tables;
     if (!SQLiteStatement(*this, query).returnTextResults(0, tables)) {
-        D_LOG_DEBUG("Unable to retrieve list of tables from database");
+        SQLITE_LOG(INFO) << "Unable to retrieve list of tables from database";
         return;
     }
 
@@ -310,14 +494,14 @@ void SQLiteDatabase::clearAllTables()
         if (*table == "sqlite_sequence")
             continue;
         if (!executeCommand("DROP TABLE " + *table))
-            D_LOG_DEBUG("Unable to drop table %s", (*table).data());
+            SQLITE_LOG(INFO) << "Unable to drop table " << *table;
     }
 }
 
 int SQLiteDatabase::runVacuumCommand()
 {
     if (!executeCommand(std::string("VACUUM;")))
-        D_LOG_DEBUG("Unable to vacuum database - %s", lastErrorMsg());
+        SQLITE_LOG(INFO) << "Unable to vacuum database - " << lastErrorMsg();
     return lastError();
 }
 
@@ -327,7 +511,7 @@ int SQLiteDatabase::runIncrementalVacuumCommand()
     enableAuthorizer(false);
 
     if (!executeCommand(std::string("PRAGMA incremental_vacuum")))
-        D_LOG_DEBUG("Unable to run incremental vacuum - %s", lastErrorMsg());
+        SQLITE_LOG(INFO) << "Unable to run incremental vacuum - " << lastErrorMsg();
 
     enableAuthorizer(true);
     return lastError();
@@ -459,7 +643,7 @@ int SQLiteDatabase::authorizerFunction(void* userData, int actionCode, const cha
 void SQLiteDatabase::setAuthorizer(std::shared_ptr<DatabaseAuthorizer> auth)
 {
     if (!m_db) {
-        D_LOG_ERROR("Attempt to set an authorizer on a non-open SQL database");
+        SQLITE_LOG(ERROR) << "Attempt to set an authorizer on a non-open SQL database";
         ASSERT_NOT_REACHED();
         return;
     }
@@ -479,6 +663,29 @@ void SQLiteDatabase::enableAuthorizer(bool enable)
         sqlite3_set_authorizer(m_db, NULL, 0);
 }
 
+sqlite3_stmt* SQLiteDatabase::takeCachedStatement(const std::string& sql)
+{
+    if (!m_db || !m_statementCache.capacity())
+        return 0;
+    return m_statementCache.take(sql);
+}
+
+int SQLiteDatabase::releaseCachedStatement(const std::string& sql, sqlite3_stmt* statement)
+{
+    // Statements that outlived the connection they were prepared on, or that
+    // changed the schema, are not worth keeping around.
+    if (!m_db || sqlite3_db_handle(statement) != m_db || !m_statementCache.capacity())
+        return sqlite3_finalize(statement);
+
+    if (!sqlite3_stmt_readonly(statement) && isSchemaStatement(sql)) {
+        int result = sqlite3_finalize(statement);
+        m_statementCache.clear();
+        return result;
+    }
+
+    return m_statementCache.put(sql, statement);
+}
+
 bool SQLiteDatabase::isAutoCommitOn() const
 {
     return sqlite3_get_autocommit(m_db);
@@ -27,9 +27,16 @@
 #ifndef SQLiteDatabase_h
 #define SQLiteDatabase_h
 
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <thread>
 #include <mutex>
+#include <memory>
+
+#include "SQLiteProfiler.h"
+#include "SQLiteQueryPlan.h"
+#include "SQLiteStatementCache.h"
 
 #ifndef ASSERT
 #ifndef NDEBUG
@@ -46,6 +53,9 @@
 #endif
 
 struct sqlite3;
+class SQLiteSlowQueryLog;
+struct SQLiteSlowQueryLogOptions;
+struct sqlite3_stmt;
 
 class DatabaseAuthorizer;
 class SQLiteStatement;
@@ -59,12 +69,16 @@ extern const int SQLResultSchema;
 extern const int SQLResultFull;
 extern const int SQLResultInterrupt;
 extern const int SQLResultConstraint;
+extern const int SQLResultRange;
 
 class SQLiteDatabase {
 private:
     SQLiteDatabase(const SQLiteDatabase&);
     SQLiteDatabase& operator=(const SQLiteDatabase&);
     friend class SQLiteTransaction;
+    friend class SQLiteStatement;
+    friend class SQLiteRunTimer;
+    friend class SQLiteCheckpointer;
 public:
     SQLiteDatabase();
     ~SQLiteDatabase();
@@ -74,6 +88,8 @@ public:
     void close();
     void interrupt();
     bool isInterrupted();
+    // Like isInterrupted(), but without requiring the connection lock.
+    bool isInterruptRequested() const { return m_interrupted.load(std::memory_order_relaxed); }
 
     void updateLastChangesCount();
 
@@ -86,12 +102,19 @@ public:
     int runIncrementalVacuumCommand();
 
     bool transactionInProgress() const { return m_transactionInProgress; }
+    // 1 inside a transaction, plus one for each SQLiteTransaction nested in it.
+    int transactionDepth() const { return m_transactionDepth; }
 
     int64_t lastInsertRowID();
     int lastChanges();
 
     void setBusyTimeout(int ms);
     void setBusyHandler(int(*)(void*, int));
+    // Called by SQLite with the number of times it was already called for the
+    // same lock; returning false gives up with SQLITE_BUSY. See also
+    // SQLiteRetryPolicy::busyHandler(). An empty handler removes it.
+    typedef std::function<bool(int count)> BusyHandler;
+    void setBusyHandler(const BusyHandler&);
 
     void setFullsync(bool);
 
@@ -113,6 +136,30 @@ public:
     enum SynchronousPragma { SyncOff = 0, SyncNormal = 1, SyncFull = 2 };
     void setSynchronous(SynchronousPragma);
 
+    // The SQLite JOURNAL_MODE pragma. WAL lets readers run alongside a writer;
+    // it persists in the database file and is not available for in-memory
+    // databases. Returns false if SQLite did not switch to the requested mode.
+    enum JournalMode { JournalDelete, JournalTruncate, JournalPersist, JournalMemory, JournalWAL, JournalOff };
+    bool setJournalMode(JournalMode);
+
+    // In WAL mode, a commit that leaves at least this many frames in the WAL
+    // runs a PASSIVE checkpoint on the committing thread. 0 turns automatic
+    // checkpoints off. SQLite's default is 1000 and is restored by open().
+    // While a SQLiteCheckpointer runs, the value is only stored, and it takes
+    // effect when the checkpointer stops.
+    void setWALAutoCheckpoint(int frames);
+    int walAutoCheckpoint() const { return m_walAutoCheckpoint; }
+
+    // Values match SQLITE_CHECKPOINT_*. PASSIVE copies as many frames as it can
+    // without waiting; the others wait through the busy handler for writers
+    // (FULL) and readers (RESTART, TRUNCATE) so the WAL can start over, and
+    // TRUNCATE also truncates the WAL file to zero bytes.
+    enum CheckpointMode { CheckpointPassive = 0, CheckpointFull = 1, CheckpointRestart = 2, CheckpointTruncate = 3 };
+    // Returns the SQLite result code; walFrames and checkpointedFrames receive
+    // the size of the WAL and the number of its frames now in the database, or
+    // -1 if the database is not in WAL mode.
+    int checkpoint(CheckpointMode, int* walFrames = 0, int* checkpointedFrames = 0);
+
     int lastError();
     const char* lastErrorMsg();
 
@@ -139,6 +186,75 @@ public:
     enum AutoVacuumPragma { AutoVacuumNone = 0, AutoVacuumFull = 1, AutoVacuumIncremental = 2 };
     bool turnOnIncrementalAutoVacuum();
 
+    // Prepared statements are leased from a per-connection LRU cache keyed by
+    // SQL text, so repeated statements skip sqlite3_prepare_v2. A capacity of 0
+    // disables caching. The cache is cleared on close() and whenever a CREATE,
+    // DROP or ALTER statement is run through this connection.
+    size_t statementCacheCapacity() const { return m_statementCache.capacity(); }
+    void setStatementCacheCapacity(size_t capacity)
+    {
+        std::lock_guard<std::mutex> lock(m_lockingMutex);
+        m_statementCache.setCapacity(capacity);
+    }
+    SQLiteStatementCache::Statistics statementCacheStatistics() { return m_statementCache.statistics(); }
+    void clearStatementCache()
+    {
+        std::lock_guard<std::mutex> lock(m_lockingMutex);
+        m_statementCache.clear();
+    }
+
+    // Records the query plan of each distinct statement the first time it is
+    // prepared and flags full scans, temp B-trees and automatic indexes; see
+    // SQLitePlanWatchdog. Findings are logged as warnings if logFindings is set.
+    SQLitePlanWatchdog& enablePlanWatchdog(bool logFindings = true);
+    void disablePlanWatchdog();
+    // 0 unless the watchdog is enabled.
+    SQLitePlanWatchdog* planWatchdog() const { return m_planWatchdog.get(); }
+
+    // Logs statements whose prepare and steps take longer than a threshold;
+    // see SQLiteSlowQueryLog. Calling it again changes the options.
+    SQLiteSlowQueryLog& enableSlowQueryLog(const SQLiteSlowQueryLogOptions&);
+    void disableSlowQueryLog();
+    // 0 until the log is first enabled; kept after it is disabled.
+    SQLiteSlowQueryLog* slowQueryLog() const { return m_slowQueryLog.get(); }
+
+    // SQLite's sqlite3_db_status counters for this connection. Memory values are
+    // in bytes; lookasideUsed is in slots.
+    struct ConnectionStatus {
+        ConnectionStatus()
+            : cacheHits(0), cacheMisses(0), cacheWrites(0), cacheSpills(0), cacheUsed(0)
+            , lookasideUsed(0), lookasideHighwater(0), lookasideHits(0), lookasideMissesSize(0), lookasideMissesFull(0)
+            , schemaUsed(0), statementUsed(0), deferredForeignKeys(0) { }
+
+        int cacheHits;
+        int cacheMisses;
+        int cacheWrites;
+        int cacheSpills;
+        int cacheUsed;
+        int lookasideUsed;
+        int lookasideHighwater;
+        int lookasideHits;
+        int lookasideMissesSize;
+        int lookasideMissesFull;
+        int schemaUsed;
+        int statementUsed;
+        // Non-zero if deferred foreign key constraints are currently violated.
+        int deferredForeignKeys;
+    };
+
+    // Resetting zeroes the page cache and lookaside counters and the lookaside
+    // high-water mark.
+    ConnectionStatus connectionStatus(bool resetCounters = false);
+
+    // Starts collecting per-query statistics through sqlite3_trace_v2 and
+    // returns the profiler. Profiling stays enabled across close() and open().
+    // Both calls take the connection lock, so they wait for a running step.
+    SQLiteProfiler& enableProfiling();
+    // Stops collecting; statistics gathered so far remain in profiler().
+    void disableProfiling();
+    // 0 until profiling is first enabled.
+    SQLiteProfiler* profiler() const { return m_profiler.get(); }
+
     // Set this flag to allow access from multiple threads.  Not all multi-threaded accesses are safe!
     // See http://www.sqlite.org/cvstrac/wiki?p=MultiThreading for more info.
 #ifndef NDEBUG
@@ -149,15 +265,21 @@ public:
 
 private:
     static int authorizerFunction(void*, int, const char*, const char*, const char*, const char*);
+    static int busyHandlerFunction(void*, int count);
 
     void enableAuthorizer(bool enable);
 
     int pageSize();
 
+    // The caller holds the connection lock, as releasing may finalize.
+    sqlite3_stmt* takeCachedStatement(const std::string& sql);
+    int releaseCachedStatement(const std::string& sql, sqlite3_stmt*);
+
     sqlite3* m_db;
     int m_pageSize;
 
     bool m_transactionInProgress;
+    int m_transactionDepth;
     bool m_sharable;
 
     std::mutex m_authorizerLock;
@@ -169,12 +291,31 @@ private:
     std::thread::id m_openingThread;
 
     std::mutex m_databaseClosingMutex;
-    bool m_interrupted;
+    std::atomic<bool> m_interrupted;
 
     int m_openError;
     std::string m_openErrorMessage;
 
     int m_lastChangesCount;
+    int m_walAutoCheckpoint;
+    // Set while a SQLiteCheckpointer owns the connection's WAL hook.
+    bool m_hasCheckpointer;
+
+    BusyHandler m_busyHandler;
+
+    SQLiteStatementCache m_statementCache;
+
+    std::unique_ptr<SQLiteProfiler> m_profiler;
+    bool m_isProfiling;
+
+    std::unique_ptr<SQLitePlanWatchdog> m_planWatchdog;
+
+    // Read by every step(), so it is checked without taking a lock. The
+    // threshold itself is owned by m_slowQueryLog.
+    std::atomic<bool> m_isSlowQueryLogEnabled;
+    std::unique_ptr<SQLiteSlowQueryLog> m_slowQueryLog;
+
+    void installTraceHook();
 };
 
 #endif
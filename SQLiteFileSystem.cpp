@@ -32,6 +32,7 @@
 #include "SQLiteFileSystem.h"
 
 #include "SQLiteDatabase.h"
+#include "SQLiteLog.h"
 #include "SQLiteStatement.h"
 #include <inttypes.h>
 #include <sqlite3.h>
@@ -40,8 +41,6 @@
 #include <dirent.h>
 #include <unistd.h>
 
-#include <glog/logging.h>
-
 #include <fstream>
 #include <sstream>
 
@@ -71,13 +70,13 @@ int SQLiteFileSystem::openDatabase(const std::string& filename, sqlite3** databa
 std::string SQLiteFileSystem::getFileNameForNewDatabase(const std::string& dbDir, const std::string&,
                                                         const std::string&, SQLiteDatabase* db)
 {
-    DLOG(INFO) << ">>>";
+    SQLITE_LOG(TRACE) << ">>>";
 
     // try to get the next sequence number from the given database
     // if we can't get a number, return an empty string
     SQLiteStatement sequenceStatement(*db, "SELECT seq FROM sqlite_sequence WHERE name='Databases';");
     if (sequenceStatement.prepare() != SQLResultOk) {
-        DLOG(INFO) << "<<< " << std::string();
+        SQLITE_LOG(TRACE) << "<<< " << std::string();
         return std::string();
     }
     int result = sequenceStatement.step();
@@ -85,7 +84,7 @@ std::string SQLiteFileSystem::getFileNameForNewDatabase(const std::string& dbDir
     if (result == SQLResultRow)
         seq = sequenceStatement.getColumnInt64(0);
     else if (result != SQLResultDone) {
-        DLOG(INFO) << "<<< " << std::string();
+        SQLITE_LOG(TRACE) << "<<< " << std::string();
         return std::string();
     }
     sequenceStatement.finalize();
@@ -101,7 +100,7 @@ std::string SQLiteFileSystem::getFileNameForNewDatabase(const std::string& dbDir
         fileName = pathByAppendingComponent(dbDir, stringStream.str());
     } while (fileExists(fileName));
 
-    DLOG(INFO) << "<<< " << stringStream.str();
+    SQLITE_LOG(TRACE) << "<<< " << stringStream.str();
     return stringStream.str();
 }
 
@@ -112,31 +111,31 @@ std::string SQLiteFileSystem::appendDatabaseFileNameToPath(const std::string& pa
 
 bool SQLiteFileSystem::ensureDatabaseDirectoryExists(const std::string& path)
 {
-    DLOG(INFO) << ">>>";
+    SQLITE_LOG(TRACE) << ">>>";
     if (path.empty()) {
-        DLOG(INFO) << "<<< " << "FALSE";
+        SQLITE_LOG(TRACE) << "<<< " << "FALSE";
         return false;
     }
 
-    DLOG(INFO) << "<<<";
+    SQLITE_LOG(TRACE) << "<<<";
     return makeAllDirectories(path);
 }
 
 bool SQLiteFileSystem::ensureDatabaseFileExists(const std::string& fileName, bool checkPathOnly)
 {
-    DLOG(INFO) << ">>>";
+    SQLITE_LOG(TRACE) << ">>>";
     if (fileName.empty()) {
-        DLOG(INFO) << "<<< " << "FALSE";
+        SQLITE_LOG(TRACE) << "<<< " << "FALSE";
         return false;
     }
 
     if (checkPathOnly) {
         std::string dir = directoryName(fileName);
-        DLOG(INFO) << "<<<";
+        SQLITE_LOG(TRACE) << "<<<";
         return ensureDatabaseDirectoryExists(dir);
     }
 
-    DLOG(INFO) << "<<<";
+    SQLITE_LOG(TRACE) << "<<<";
     return fileExists(fileName);
 }
 
@@ -235,13 +234,14 @@ bool SQLiteFileSystem::deleteEmptyDirectory(const std::string& path)
     return true;
 }
 
-bool SQLiteFileSystem::getFileSize(const std::string& fileName, int64_t& size)
+bool SQLiteFileSystem::getFileSize(const std::string& fileName, long long& size)
 {
     struct stat fileStats;
 
-    if(stat(fileName.c_str(), &fileStats) != -1)
-        size = reinterpret_cast<int64_t>(&fileStats.st_size);
+    if(stat(fileName.c_str(), &fileStats) == -1)
+        return false;
 
+    size = static_cast<long long>(fileStats.st_size);
     return true;
 }
 
@@ -0,0 +1,202 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteGroupCommitQueue.h"
+
+#include "SQLiteDatabase.h"
+#include "SQLiteLog.h"
+#include "SQLiteTransaction.h"
+
+#include <algorithm>
+#include <exception>
+
+SQLiteGroupCommitQueue::SQLiteGroupCommitQueue(SQLiteDatabase& db, const Options& options)
+    : m_database(db)
+    , m_options(options)
+    , m_running(false)
+    , m_stopping(false)
+{
+    m_options.maxBatchSize = std::max<size_t>(m_options.maxBatchSize, 1);
+}
+
+SQLiteGroupCommitQueue::~SQLiteGroupCommitQueue()
+{
+    stop();
+}
+
+void SQLiteGroupCommitQueue::start()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (m_running)
+        return;
+
+    m_running = true;
+    m_stopping = false;
+    m_thread = std::thread(&SQLiteGroupCommitQueue::run, this);
+}
+
+void SQLiteGroupCommitQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running)
+            return;
+        m_running = false;
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    m_thread.join();
+}
+
+bool SQLiteGroupCommitQueue::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_running;
+}
+
+std::future<bool> SQLiteGroupCommitQueue::submit(const Write& write)
+{
+    PendingWrite pending;
+    pending.write = write;
+    pending.queuedAt = std::chrono::steady_clock::now();
+    std::future<bool> future = pending.done.get_future();
+
+    bool wakeUp;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_running) {
+            pending.done.set_value(false);
+            return future;
+        }
+        m_queue.push_back(std::move(pending));
+        // The committer only needs waking for the first write of a window
+        // and for a full batch.
+        wakeUp = m_queue.size() == 1 || m_queue.size() == m_options.maxBatchSize;
+    }
+    if (wakeUp)
+        m_wakeUp.notify_one();
+    return future;
+}
+
+SQLiteGroupCommitQueue::Statistics SQLiteGroupCommitQueue::statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_statistics;
+}
+
+void SQLiteGroupCommitQueue::run()
+{
+    std::vector<PendingWrite> batch;
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (true) {
+        m_wakeUp.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+        if (m_queue.empty())
+            break;
+
+        // Keep the window open for more writes, unless stopping.
+        std::chrono::steady_clock::time_point windowEnd = m_queue.front().queuedAt + m_options.maxDelay;
+        m_wakeUp.wait_until(lock, windowEnd, [this]() { return m_stopping || m_queue.size() >= m_options.maxBatchSize; });
+
+        size_t count = std::min(m_queue.size(), m_options.maxBatchSize);
+        for (size_t i = 0; i < count; ++i) {
+            batch.push_back(std::move(m_queue.front()));
+            m_queue.pop_front();
+        }
+
+        lock.unlock();
+        commit(batch);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void SQLiteGroupCommitQueue::commit(std::vector<PendingWrite>& batch)
+{
+    std::vector<bool> results(batch.size(), false);
+    std::vector<std::exception_ptr> exceptions(batch.size());
+    size_t rolledBack = 0;
+
+    SQLiteTransaction transaction(m_database);
+    transaction.begin();
+    bool committed = transaction.inProgress();
+    for (size_t i = 0; committed && i < batch.size(); ++i) {
+        // Nested, so it runs as a savepoint of the batch.
+        SQLiteTransaction write(m_database);
+        write.begin();
+        if (!write.inProgress()) {
+            committed = false;
+            break;
+        }
+        try {
+            results[i] = batch[i].write(m_database);
+        } catch (...) {
+            // Rolled back below, like a closure that returned false.
+            exceptions[i] = std::current_exception();
+            results[i] = false;
+        }
+        if (transaction.wasRolledBackBySqlite()) {
+            // An error such as SQLITE_FULL took the whole batch with it.
+            write.stop();
+            committed = false;
+            break;
+        }
+        if (results[i])
+            write.commit();
+        if (write.inProgress()) {
+            results[i] = false;
+            write.rollback();
+            ++rolledBack;
+        }
+    }
+    if (committed) {
+        transaction.commit();
+        committed = !transaction.inProgress();
+    }
+    if (!committed) {
+        SQLITE_LOG(WARNING) << "SQLite group commit of " << batch.size() << " writes failed - " << m_database.lastErrorMsg();
+        if (transaction.wasRolledBackBySqlite())
+            transaction.stop();
+        else
+            transaction.rollback();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        ++m_statistics.batches;
+        m_statistics.maxBatchSize = std::max(m_statistics.maxBatchSize, batch.size());
+        if (committed) {
+            m_statistics.writesCommitted += batch.size() - rolledBack;
+            m_statistics.writesRolledBack += rolledBack;
+        } else {
+            ++m_statistics.failedBatches;
+            m_statistics.writesRolledBack += batch.size();
+        }
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        if (exceptions[i])
+            batch[i].done.set_exception(exceptions[i]);
+        else
+            batch[i].done.set_value(committed && results[i]);
+    }
+}
@@ -0,0 +1,113 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteGroupCommitQueue_h
+#define SQLiteGroupCommitQueue_h
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class SQLiteDatabase;
+
+// Coalesces small write transactions from many threads into one.
+//
+// Producers submit write closures; a committer thread runs everything queued
+// within a window of maxDelay (or maxBatchSize closures, whichever comes
+// first) in a single BEGIN IMMEDIATE / COMMIT, so the batch pays for one
+// fsync instead of one per closure. Each closure runs inside its own
+// savepoint: a closure that returns false or throws is rolled back alone and
+// the rest of the batch still commits. Futures complete after the COMMIT,
+// with false for closures that were rolled back or whose batch failed to
+// commit. The future of a closure that threw rethrows its exception.
+//
+// The queue must be the only writer on the connection while it runs.
+class SQLiteGroupCommitQueue {
+public:
+    typedef std::function<bool(SQLiteDatabase&)> Write;
+
+    struct Options {
+        Options()
+            : maxBatchSize(256)
+            , maxDelay(std::chrono::microseconds(2000)) { }
+
+        size_t maxBatchSize;
+        // How long the oldest queued closure may wait for others to join it.
+        std::chrono::microseconds maxDelay;
+    };
+
+    struct Statistics {
+        Statistics()
+            : batches(0), failedBatches(0), writesCommitted(0), writesRolledBack(0), maxBatchSize(0) { }
+
+        double averageBatchSize() const { return batches ? static_cast<double>(writesCommitted + writesRolledBack) / batches : 0; }
+
+        int64_t batches;
+        // Batches that could not begin or commit; all their writes fail.
+        int64_t failedBatches;
+        int64_t writesCommitted;
+        int64_t writesRolledBack;
+        size_t maxBatchSize;
+    };
+
+    SQLiteGroupCommitQueue(SQLiteDatabase&, const Options& = Options());
+    ~SQLiteGroupCommitQueue();
+
+    void start();
+    // Commits whatever is still queued, then stops the committer thread.
+    void stop();
+    bool isRunning() const;
+
+    // The future is false right away if the queue is not running.
+    std::future<bool> submit(const Write&);
+
+    Statistics statistics() const;
+
+private:
+    struct PendingWrite {
+        Write write;
+        std::promise<bool> done;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    void run();
+    void commit(std::vector<PendingWrite>&);
+
+    SQLiteDatabase& m_database;
+    Options m_options;
+
+    mutable std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    std::deque<PendingWrite> m_queue;
+    bool m_running;
+    bool m_stopping;
+    Statistics m_statistics;
+    std::thread m_thread;
+};
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteLog.h"
+
+#include <glog/logging.h>
+
+#include <chrono>
+#include <string.h>
+
+std::atomic<SQLiteAsyncLogSink*> SQLiteAsyncLogSink::s_installed(0);
+
+SQLiteLogMessage::SQLiteLogMessage(int level, const char* file, int line)
+    : m_level(level)
+    , m_file(file)
+    , m_line(line)
+{
+}
+
+SQLiteLogMessage::~SQLiteLogMessage()
+{
+    std::string message = m_stream.str();
+    SQLiteAsyncLogSink* sink = SQLiteAsyncLogSink::installed();
+    if (!sink) {
+        SQLiteAsyncLogSink::writeToGlog(m_level, message);
+        return;
+    }
+
+    // glog records its own file and line, which for the writer thread would
+    // always be this file.
+    std::ostringstream located;
+    const char* slash = strrchr(m_file, '/');
+    located << (slash ? slash + 1 : m_file) << ':' << m_line << "] " << message;
+    sink->push(m_level, located.str());
+}
+
+SQLiteAsyncLogSink::SQLiteAsyncLogSink(size_t capacity, const Writer& writer)
+    : m_writer(writer ? writer : Writer(&SQLiteAsyncLogSink::writeToGlog))
+    , m_enqueuePosition(0)
+    , m_dequeuePosition(0)
+    , m_written(0)
+    , m_dropped(0)
+    , m_running(true)
+{
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    m_slots.reset(new Slot[size]);
+    m_mask = size - 1;
+    for (size_t i = 0; i < size; ++i)
+        m_slots[i].sequence.store(i, std::memory_order_relaxed);
+
+    m_thread = std::thread(&SQLiteAsyncLogSink::run, this);
+}
+
+SQLiteAsyncLogSink::~SQLiteAsyncLogSink()
+{
+    uninstall();
+    m_running.store(false, std::memory_order_release);
+    m_thread.join();
+    while (pop()) { }
+}
+
+bool SQLiteAsyncLogSink::install()
+{
+    SQLiteAsyncLogSink* expected = 0;
+    return s_installed.compare_exchange_strong(expected, this, std::memory_order_acq_rel);
+}
+
+void SQLiteAsyncLogSink::uninstall()
+{
+    SQLiteAsyncLogSink* expected = this;
+    s_installed.compare_exchange_strong(expected, 0, std::memory_order_acq_rel);
+}
+
+bool SQLiteAsyncLogSink::push(int level, std::string&& message)
+{
+    // Bounded multi-producer queue: each slot's sequence number says whether
+    // it is free for the producer that claimed position pos (sequence == pos)
+    // or holds a line for the consumer (sequence == pos + 1).
+    size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+    Slot* slot;
+    for (;;) {
+        slot = &m_slots[position & m_mask];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+        if (!difference) {
+            if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0) {
+            m_dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else
+            position = m_enqueuePosition.load(std::memory_order_relaxed);
+    }
+
+    slot->level = level;
+    slot->message = std::move(message);
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool SQLiteAsyncLogSink::pop()
+{
+    Slot& slot = m_slots[m_dequeuePosition & m_mask];
+    if (slot.sequence.load(std::memory_order_acquire) != m_dequeuePosition + 1)
+        return false;
+
+    std::string message;
+    message.swap(slot.message);
+    int level = slot.level;
+    slot.sequence.store(m_dequeuePosition + m_mask + 1, std::memory_order_release);
+    ++m_dequeuePosition;
+
+    m_writer(level, message);
+    m_written.fetch_add(1, std::memory_order_release);
+    return true;
+}
+
+void SQLiteAsyncLogSink::run()
+{
+    while (m_running.load(std::memory_order_acquire)) {
+        if (!pop())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+void SQLiteAsyncLogSink::flush()
+{
+    // A slot is claimed before it is filled, so a line counted in the enqueue
+    // position may still be in flight; waiting on m_written covers it.
+    size_t target = m_enqueuePosition.load(std::memory_order_acquire);
+    while (m_written.load(std::memory_order_acquire) < target)
+        std::this_thread::yield();
+}
+
+void SQLiteAsyncLogSink::writeToGlog(int level, const std::string& message)
+{
+    switch (level) {
+        case SQLITE_LOG_LEVEL_TRACE:
+        case SQLITE_LOG_LEVEL_INFO:
+            LOG(INFO) << message;
+            break;
+        case SQLITE_LOG_LEVEL_WARNING:
+            LOG(WARNING) << message;
+            break;
+        default:
+            LOG(ERROR) << message;
+            break;
+    }
+}
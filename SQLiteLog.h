@@ -0,0 +1,134 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteLog_h
+#define SQLiteLog_h
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <sstream>
+#include <string>
+#include <thread>
+
+// Log levels, lowest first. SQLITE_LOG_LEVEL selects the lowest level that is
+// compiled in; statements below it compile to nothing and their arguments are
+// never evaluated. Trace covers per-call statement tracing (prepare, step,
+// reset, finalize) and by default is only compiled into debug builds.
+#define SQLITE_LOG_LEVEL_TRACE 0
+#define SQLITE_LOG_LEVEL_INFO 1
+#define SQLITE_LOG_LEVEL_WARNING 2
+#define SQLITE_LOG_LEVEL_ERROR 3
+#define SQLITE_LOG_LEVEL_NONE 4
+
+#ifndef SQLITE_LOG_LEVEL
+#ifdef NDEBUG
+#define SQLITE_LOG_LEVEL SQLITE_LOG_LEVEL_WARNING
+#else
+#define SQLITE_LOG_LEVEL SQLITE_LOG_LEVEL_TRACE
+#endif
+#endif
+
+// Usage: SQLITE_LOG(ERROR) << "sqlite3_step failed (" << error << ")";
+#define SQLITE_LOG(level) \
+    (SQLITE_LOG_LEVEL_##level < SQLITE_LOG_LEVEL) ? (void) 0 \
+        : SQLiteLogVoidify() & SQLiteLogMessage(SQLITE_LOG_LEVEL_##level, __FILE__, __LINE__).stream()
+
+// Collects one log line and hands it, when destroyed, to the installed
+// SQLiteAsyncLogSink, or to glog if there is none.
+class SQLiteLogMessage {
+public:
+    SQLiteLogMessage(int level, const char* file, int line);
+    ~SQLiteLogMessage();
+
+    std::ostream& stream() { return m_stream; }
+
+private:
+    int m_level;
+    const char* m_file;
+    int m_line;
+    std::ostringstream m_stream;
+};
+
+struct SQLiteLogVoidify {
+    void operator&(std::ostream&) { }
+};
+
+// Moves log lines off the logging threads. Producers append to a bounded
+// lock-free ring buffer and never block: if the buffer is full the line is
+// dropped and counted. A single background thread drains the buffer into the
+// writer, glog by default, so worker threads no longer contend on the glog
+// mutex.
+//
+// Only one sink can be installed at a time. Uninstall it (or destroy it) only
+// once no other thread can still be logging.
+class SQLiteAsyncLogSink {
+public:
+    typedef std::function<void(int level, const std::string& message)> Writer;
+
+    explicit SQLiteAsyncLogSink(size_t capacity = 4096, const Writer& = Writer());
+    ~SQLiteAsyncLogSink();
+
+    // Routes SQLITE_LOG output through this sink. Returns false if another
+    // sink is already installed.
+    bool install();
+    void uninstall();
+
+    // Never blocks. Returns false if the buffer was full and the line dropped.
+    bool push(int level, std::string&& message);
+    // Waits until every line pushed before the call has been written.
+    void flush();
+
+    uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+    static SQLiteAsyncLogSink* installed() { return s_installed.load(std::memory_order_acquire); }
+
+    // Writes a line to glog; the default writer.
+    static void writeToGlog(int level, const std::string& message);
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        int level;
+        std::string message;
+    };
+
+    bool pop();
+    void run();
+
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+    Writer m_writer;
+    std::atomic<size_t> m_enqueuePosition;
+    // Only touched by the writer thread.
+    size_t m_dequeuePosition;
+    std::atomic<size_t> m_written;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<bool> m_running;
+    std::thread m_thread;
+
+    static std::atomic<SQLiteAsyncLogSink*> s_installed;
+};
+
+#endif
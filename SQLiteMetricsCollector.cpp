@@ -0,0 +1,98 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteMetricsCollector.h"
+
+#include <sqlite3.h>
+
+SQLiteMetricsCollector::SQLiteMetricsCollector(SQLiteDatabase& db, std::chrono::milliseconds interval, const Consumer& consumer)
+    : m_database(db)
+    , m_interval(interval)
+    , m_consumer(consumer)
+    , m_stopping(false)
+{
+}
+
+SQLiteMetricsCollector::~SQLiteMetricsCollector()
+{
+    stop();
+}
+
+void SQLiteMetricsCollector::start()
+{
+    if (m_thread.joinable())
+        return;
+
+    m_stopping = false;
+    m_thread = std::thread(&SQLiteMetricsCollector::run, this);
+}
+
+void SQLiteMetricsCollector::stop()
+{
+    if (!m_thread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+    }
+    m_wakeUp.notify_all();
+    m_thread.join();
+}
+
+SQLiteMetricsCollector::Sample SQLiteMetricsCollector::collect()
+{
+    Sample sample;
+    sample.time = std::chrono::system_clock::now();
+
+    // Statements are only walked between steps, never while one is running.
+    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    if (!m_database.isOpen())
+        return sample;
+
+    sample.connection = m_database.connectionStatus();
+    sqlite3* db = m_database.sqlite3Handle();
+    for (sqlite3_stmt* statement = sqlite3_next_stmt(db, 0); statement; statement = sqlite3_next_stmt(db, statement)) {
+        StatementSample statementSample;
+        const char* sql = sqlite3_sql(statement);
+        statementSample.sql = sql ? sql : "";
+        statementSample.status = SQLiteStatement::statementStatus(statement);
+        sample.statements.push_back(statementSample);
+    }
+    return sample;
+}
+
+void SQLiteMetricsCollector::run()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    while (!m_stopping) {
+        if (m_wakeUp.wait_for(lock, m_interval, [this]() { return m_stopping; }))
+            break;
+
+        lock.unlock();
+        Sample sample = collect();
+        if (m_consumer)
+            m_consumer(sample);
+        lock.lock();
+    }
+}
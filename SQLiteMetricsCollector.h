@@ -0,0 +1,82 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteMetricsCollector_h
+#define SQLiteMetricsCollector_h
+
+#include "SQLiteDatabase.h"
+#include "SQLiteStatement.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Samples a connection's sqlite3_db_status counters and the
+// sqlite3_stmt_status counters of every statement prepared on it, including
+// idle ones held by the statement cache, on a background thread.
+//
+// Counters are cumulative; the consumer diffs consecutive samples. Stop the
+// collector (or destroy it) before closing the database.
+class SQLiteMetricsCollector {
+public:
+    struct StatementSample {
+        std::string sql;
+        SQLiteStatement::StatementStatus status;
+    };
+
+    struct Sample {
+        std::chrono::system_clock::time_point time;
+        SQLiteDatabase::ConnectionStatus connection;
+        std::vector<StatementSample> statements;
+    };
+
+    typedef std::function<void(const Sample&)> Consumer;
+
+    SQLiteMetricsCollector(SQLiteDatabase&, std::chrono::milliseconds interval, const Consumer&);
+    ~SQLiteMetricsCollector();
+
+    void start();
+    void stop();
+    bool isRunning() const { return m_thread.joinable(); }
+
+    // Takes one sample on the calling thread.
+    Sample collect();
+
+private:
+    void run();
+
+    SQLiteDatabase& m_database;
+    std::chrono::milliseconds m_interval;
+    Consumer m_consumer;
+
+    std::mutex m_lock;
+    std::condition_variable m_wakeUp;
+    bool m_stopping;
+    std::thread m_thread;
+};
+
+#endif
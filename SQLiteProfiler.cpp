@@ -0,0 +1,364 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteProfiler.h"
+
+#include <sqlite3.h>
+
+#include <algorithm>
+#include <ctype.h>
+#include <iomanip>
+#include <sstream>
+#include <string.h>
+
+static const size_t maxCachedStatements = 1024;
+
+static std::atomic<uint64_t> s_nextProfilerID(1);
+
+// A shard this thread records into. The profiler owns the shard; the raw
+// pointer is only followed by the profiler itself, which keeps it alive, and
+// the weak one tells whether the profiler is gone so the slot can be dropped.
+struct ThreadShard {
+    uint64_t profilerID;
+    void* shard;
+    std::weak_ptr<void> owner;
+};
+
+// Profiler ids are never reused, so a slot left behind by a destroyed
+// profiler never matches; slots are pruned when a new shard is added.
+static thread_local std::vector<ThreadShard> t_shards;
+
+static thread_local unsigned t_ignoreDepth = 0;
+
+SQLiteProfiler::Entry::Entry()
+    : calls(0)
+    , rows(0)
+    , totalNanoseconds(0)
+    , maxNanoseconds(0)
+{
+    for (size_t i = 0; i < histogramBuckets; ++i)
+        histogram[i].store(0, std::memory_order_relaxed);
+}
+
+SQLiteProfiler::SQLiteProfiler()
+    : m_id(s_nextProfilerID.fetch_add(1))
+{
+}
+
+SQLiteProfiler::~SQLiteProfiler()
+{
+}
+
+size_t SQLiteProfiler::bucketForNanoseconds(uint64_t nanoseconds)
+{
+    if (nanoseconds < 8)
+        return nanoseconds;
+    int exponent = 63 - __builtin_clzll(nanoseconds);
+    if (exponent > 39)
+        return histogramBuckets - 1;
+    return (exponent - 2) * 8 + ((nanoseconds >> (exponent - 3)) & 7);
+}
+
+uint64_t SQLiteProfiler::bucketLowerBound(size_t bucket)
+{
+    if (bucket < 8)
+        return bucket;
+    int exponent = bucket / 8 + 2;
+    return (8 + bucket % 8) << (exponent - 3);
+}
+
+uint64_t SQLiteProfiler::bucketUpperBound(size_t bucket)
+{
+    if (bucket + 1 >= histogramBuckets)
+        return UINT64_MAX;
+    return bucketLowerBound(bucket + 1) - 1;
+}
+
+uint64_t SQLiteProfiler::QueryStatistics::percentileNanoseconds(double percentile) const
+{
+    if (!calls)
+        return 0;
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < histogram.size(); ++i)
+        total += histogram[i];
+    uint64_t rank = static_cast<uint64_t>(percentile / 100.0 * total + 0.5);
+    rank = std::max<uint64_t>(rank, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram.size(); ++i) {
+        seen += histogram[i];
+        if (seen >= rank)
+            return std::min(bucketUpperBound(i), maxNanoseconds);
+    }
+    return maxNanoseconds;
+}
+
+std::string SQLiteProfiler::normalizeSQL(const char* sql)
+{
+    std::string normalized;
+    if (!sql)
+        return normalized;
+
+    bool pendingSpace = false;
+    for (const char* c = sql; *c; ) {
+        if (isspace(static_cast<unsigned char>(*c))) {
+            pendingSpace = !normalized.empty();
+            ++c;
+            continue;
+        }
+        if (pendingSpace) {
+            normalized += ' ';
+            pendingSpace = false;
+        }
+
+        bool startsIdentifier = !normalized.empty() && (isalnum(static_cast<unsigned char>(normalized.back())) || normalized.back() == '_');
+        if (*c == '\'') {
+            // '' inside a literal is an escaped quote.
+            for (++c; *c; ++c) {
+                if (*c == '\'' && *(c + 1) != '\'')
+                    break;
+                if (*c == '\'')
+                    ++c;
+            }
+            if (*c)
+                ++c;
+            normalized += '?';
+        } else if (isdigit(static_cast<unsigned char>(*c)) && !startsIdentifier) {
+            while (isalnum(static_cast<unsigned char>(*c)) || *c == '.')
+                ++c;
+            normalized += '?';
+        } else
+            normalized += *c++;
+    }
+    return normalized;
+}
+
+SQLiteProfiler::Shard& SQLiteProfiler::currentShard()
+{
+    for (size_t i = t_shards.size(); i > 0; --i) {
+        if (t_shards[i - 1].profilerID == m_id)
+            return *static_cast<Shard*>(t_shards[i - 1].shard);
+    }
+
+    std::shared_ptr<Shard> shard(new Shard);
+    {
+        std::lock_guard<std::mutex> lock(m_shardsLock);
+        m_shards.push_back(shard);
+    }
+    t_shards.erase(std::remove_if(t_shards.begin(), t_shards.end(), [](const ThreadShard& slot) {
+        return slot.owner.expired();
+    }), t_shards.end());
+    t_shards.push_back(ThreadShard { m_id, shard.get(), std::weak_ptr<void>(shard) });
+    return *shard;
+}
+
+SQLiteProfiler::Entry& SQLiteProfiler::entryFor(Shard& shard, sqlite3_stmt* statement)
+{
+    const char* sql = sqlite3_sql(statement);
+    if (!sql)
+        sql = "";
+
+    // The same statement handle is normally stepped many times; only look
+    // the SQL up again if the handle was reused for a different query.
+    std::unordered_map<sqlite3_stmt*, std::pair<std::string, Entry*> >::iterator cached = shard.byStatement.find(statement);
+    if (cached != shard.byStatement.end() && cached->second.first == sql)
+        return *cached->second.second;
+
+    std::string normalized = normalizeSQL(sql);
+    Entry* entry;
+    {
+        std::lock_guard<std::mutex> lock(shard.lock);
+        std::unordered_map<std::string, Entry*>::iterator found = shard.bySQL.find(normalized);
+        if (found != shard.bySQL.end())
+            entry = found->second;
+        else {
+            shard.entries.emplace_back();
+            entry = &shard.entries.back();
+            entry->sql = normalized;
+            shard.bySQL[normalized] = entry;
+        }
+    }
+
+    // Finalized handles are never removed, so start over once the map has
+    // collected a lot of them.
+    if (shard.byStatement.size() >= maxCachedStatements)
+        shard.byStatement.clear();
+    shard.byStatement[statement] = std::make_pair(std::string(sql), entry);
+    return *entry;
+}
+
+SQLiteProfiler::Entry& SQLiteProfiler::runningEntry(Shard& shard, sqlite3_stmt* statement)
+{
+    if (shard.lastStatement == statement)
+        return *shard.lastEntry;
+
+    Entry* entry;
+    std::unordered_map<sqlite3_stmt*, Entry*>::iterator found = shard.running.find(statement);
+    if (found != shard.running.end())
+        entry = found->second;
+    else {
+        // The run started before profiling was enabled.
+        entry = &entryFor(shard, statement);
+        shard.running[statement] = entry;
+    }
+    shard.lastStatement = statement;
+    shard.lastEntry = entry;
+    return *entry;
+}
+
+void SQLiteProfiler::recordStart(sqlite3_stmt* statement)
+{
+    Shard& shard = currentShard();
+    Entry& entry = entryFor(shard, statement);
+
+    // A run whose profile event never came, because profiling was disabled
+    // in the middle of it, leaves its handle behind.
+    if (shard.running.size() >= maxCachedStatements)
+        shard.running.clear();
+    shard.running[statement] = &entry;
+    shard.lastStatement = statement;
+    shard.lastEntry = &entry;
+}
+
+void SQLiteProfiler::recordProfile(sqlite3_stmt* statement, uint64_t nanoseconds)
+{
+    Shard& shard = currentShard();
+    Entry& entry = runningEntry(shard, statement);
+    shard.running.erase(statement);
+    shard.lastStatement = nullptr;
+    entry.calls.fetch_add(1, std::memory_order_relaxed);
+    entry.totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+    entry.histogram[bucketForNanoseconds(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+    // Only this thread raises the shard's maximum; reset() may lower it.
+    if (nanoseconds > entry.maxNanoseconds.load(std::memory_order_relaxed))
+        entry.maxNanoseconds.store(nanoseconds, std::memory_order_relaxed);
+}
+
+void SQLiteProfiler::recordRow(sqlite3_stmt* statement)
+{
+    runningEntry(currentShard(), statement).rows.fetch_add(1, std::memory_order_relaxed);
+}
+
+SQLiteProfiler::IgnoreScope::IgnoreScope()
+{
+    ++t_ignoreDepth;
+}
+
+SQLiteProfiler::IgnoreScope::~IgnoreScope()
+{
+    --t_ignoreDepth;
+}
+
+int SQLiteProfiler::traceCallback(unsigned type, void* context, void* p, void* x)
+{
+    if (t_ignoreDepth)
+        return 0;
+
+    SQLiteProfiler* profiler = static_cast<SQLiteProfiler*>(context);
+    sqlite3_stmt* statement = static_cast<sqlite3_stmt*>(p);
+    if (type == SQLITE_TRACE_STMT) {
+        // Triggers report their start as a comment on the same handle, in
+        // the middle of its run.
+        if (strncmp(static_cast<const char*>(x), "-- TRIGGER ", 11))
+            profiler->recordStart(statement);
+    } else if (type == SQLITE_TRACE_PROFILE)
+        profiler->recordProfile(statement, static_cast<uint64_t>(*static_cast<sqlite3_int64*>(x)));
+    else if (type == SQLITE_TRACE_ROW)
+        profiler->recordRow(statement);
+    return 0;
+}
+
+std::vector<SQLiteProfiler::QueryStatistics> SQLiteProfiler::snapshot() const
+{
+    std::unordered_map<std::string, size_t> indexes;
+    std::vector<QueryStatistics> statistics;
+
+    std::lock_guard<std::mutex> shardsLock(m_shardsLock);
+    for (size_t s = 0; s < m_shards.size(); ++s) {
+        Shard& shard = *m_shards[s];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        for (std::deque<Entry>::iterator entry = shard.entries.begin(); entry != shard.entries.end(); ++entry) {
+            std::pair<std::unordered_map<std::string, size_t>::iterator, bool> inserted = indexes.insert(std::make_pair(entry->sql, statistics.size()));
+            if (inserted.second) {
+                statistics.push_back(QueryStatistics());
+                statistics.back().sql = entry->sql;
+            }
+
+            QueryStatistics& query = statistics[inserted.first->second];
+            query.calls += entry->calls.load(std::memory_order_relaxed);
+            query.rows += entry->rows.load(std::memory_order_relaxed);
+            query.totalNanoseconds += entry->totalNanoseconds.load(std::memory_order_relaxed);
+            query.maxNanoseconds = std::max(query.maxNanoseconds, entry->maxNanoseconds.load(std::memory_order_relaxed));
+            for (size_t i = 0; i < histogramBuckets; ++i)
+                query.histogram[i] += entry->histogram[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    std::sort(statistics.begin(), statistics.end(), [](const QueryStatistics& a, const QueryStatistics& b) {
+        return a.totalNanoseconds > b.totalNanoseconds;
+    });
+    return statistics;
+}
+
+void SQLiteProfiler::reset()
+{
+    std::lock_guard<std::mutex> shardsLock(m_shardsLock);
+    for (size_t s = 0; s < m_shards.size(); ++s) {
+        Shard& shard = *m_shards[s];
+        std::lock_guard<std::mutex> lock(shard.lock);
+        for (std::deque<Entry>::iterator entry = shard.entries.begin(); entry != shard.entries.end(); ++entry) {
+            entry->calls.store(0, std::memory_order_relaxed);
+            entry->rows.store(0, std::memory_order_relaxed);
+            entry->totalNanoseconds.store(0, std::memory_order_relaxed);
+            entry->maxNanoseconds.store(0, std::memory_order_relaxed);
+            for (size_t i = 0; i < histogramBuckets; ++i)
+                entry->histogram[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::string SQLiteProfiler::dump(size_t limit) const
+{
+    std::vector<QueryStatistics> statistics = snapshot();
+    if (limit && statistics.size() > limit)
+        statistics.resize(limit);
+
+    std::ostringstream out;
+    out << std::setw(10) << "calls" << std::setw(12) << "rows" << std::setw(12) << "total ms"
+        << std::setw(12) << "mean us" << std::setw(12) << "p50 us" << std::setw(12) << "p99 us"
+        << std::setw(12) << "max us" << "  sql\n";
+    for (size_t i = 0; i < statistics.size(); ++i) {
+        const QueryStatistics& query = statistics[i];
+        if (!query.calls && !query.rows)
+            continue;
+        out << std::setw(10) << query.calls << std::setw(12) << query.rows
+            << std::setw(12) << std::fixed << std::setprecision(3) << query.totalNanoseconds / 1e6
+            << std::setw(12) << std::setprecision(1) << query.meanNanoseconds() / 1e3
+            << std::setw(12) << query.percentileNanoseconds(50) / 1e3
+            << std::setw(12) << query.percentileNanoseconds(99) / 1e3
+            << std::setw(12) << query.maxNanoseconds / 1e3
+            << "  " << query.sql << '\n';
+    }
+    return out.str();
+}
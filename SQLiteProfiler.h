@@ -0,0 +1,147 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteProfiler_h
+#define SQLiteProfiler_h
+
+#include <atomic>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct sqlite3_stmt;
+
+// Per-query latency statistics collected through sqlite3_trace_v2.
+//
+// Queries are grouped by normalized SQL: whitespace is collapsed and string
+// and numeric literals are replaced by '?', so "WHERE id = 1" and
+// "WHERE id = 2" share one entry. For each entry the profiler keeps the call
+// count, the rows returned, the total and maximum time, and a log-linear
+// latency histogram (eight sub-buckets per power of two, so percentiles are
+// within about 12% of the true value).
+//
+// Each thread that steps statements records into its own shard, using
+// relaxed atomic increments and no locks. A shard's mutex is only taken when
+// a thread sees a new query for the first time, and by snapshot(). The entry
+// a statement records into is resolved once per run, when the run starts;
+// row and profile events of the run only find it by statement handle.
+//
+// Enable it with SQLiteDatabase::enableProfiling().
+class SQLiteProfiler {
+public:
+    static const size_t histogramBuckets = 304;
+
+    struct QueryStatistics {
+        QueryStatistics() : calls(0), rows(0), totalNanoseconds(0), maxNanoseconds(0), histogram(histogramBuckets) { }
+
+        std::string sql;
+        uint64_t calls;
+        uint64_t rows;
+        uint64_t totalNanoseconds;
+        uint64_t maxNanoseconds;
+        std::vector<uint64_t> histogram;
+
+        uint64_t meanNanoseconds() const { return calls ? totalNanoseconds / calls : 0; }
+        // percentile is in [0, 100]. Returns the upper bound of the bucket
+        // the percentile falls in.
+        uint64_t percentileNanoseconds(double percentile) const;
+    };
+
+    SQLiteProfiler();
+    ~SQLiteProfiler();
+
+    // Merged over all threads, slowest total time first.
+    std::vector<QueryStatistics> snapshot() const;
+    // Zeroes every counter. Queries seen so far keep their entries.
+    void reset();
+    // One line per query: calls, rows, total, mean, p50, p99 and max, then SQL.
+    // A limit of 0 prints every query.
+    std::string dump(size_t limit = 0) const;
+
+    // Bucket boundaries, in nanoseconds.
+    static size_t bucketForNanoseconds(uint64_t);
+    static uint64_t bucketLowerBound(size_t bucket);
+    static uint64_t bucketUpperBound(size_t bucket);
+
+    static std::string normalizeSQL(const char* sql);
+
+    // The sqlite3_trace_v2 callback; context is the profiler.
+    static int traceCallback(unsigned type, void* context, void* p, void* x);
+
+    // While one is alive, statements the thread steps are not recorded by
+    // any profiler. Wraps the wrapper's own EXPLAIN QUERY PLAN runs.
+    class IgnoreScope {
+    public:
+        IgnoreScope();
+        ~IgnoreScope();
+
+    private:
+        IgnoreScope(const IgnoreScope&);
+        IgnoreScope& operator=(const IgnoreScope&);
+    };
+
+private:
+    struct Entry {
+        Entry();
+
+        std::string sql;
+        std::atomic<uint64_t> calls;
+        std::atomic<uint64_t> rows;
+        std::atomic<uint64_t> totalNanoseconds;
+        std::atomic<uint64_t> maxNanoseconds;
+        std::atomic<uint64_t> histogram[histogramBuckets];
+    };
+
+    struct Shard {
+        // Guards inserting into entries/bySQL; counters are atomics.
+        std::mutex lock;
+        std::deque<Entry> entries;
+        std::unordered_map<std::string, Entry*> bySQL;
+        // Owner thread only: the entry each statement last resolved to, with
+        // the raw SQL it was resolved from.
+        std::unordered_map<sqlite3_stmt*, std::pair<std::string, Entry*> > byStatement;
+        // Owner thread only: the entries of the runs in progress, and the
+        // one that last had an event, which is usually the next one's too.
+        std::unordered_map<sqlite3_stmt*, Entry*> running;
+        sqlite3_stmt* lastStatement = nullptr;
+        Entry* lastEntry = nullptr;
+    };
+
+    Shard& currentShard();
+    Entry& entryFor(Shard&, sqlite3_stmt*);
+    Entry& runningEntry(Shard&, sqlite3_stmt*);
+    void recordStart(sqlite3_stmt*);
+    void recordProfile(sqlite3_stmt*, uint64_t nanoseconds);
+    void recordRow(sqlite3_stmt*);
+
+    const uint64_t m_id;
+    mutable std::mutex m_shardsLock;
+    std::vector<std::shared_ptr<Shard> > m_shards;
+};
+
+#endif
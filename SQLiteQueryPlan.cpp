@@ -0,0 +1,249 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteQueryPlan.h"
+
+#include "SQLiteLog.h"
+#include "SQLiteProfiler.h"
+#include <sqlite3.h>
+
+#include <sstream>
+#include <string.h>
+
+static bool contains(const std::string& string, const char* part)
+{
+    return string.find(part) != std::string::npos;
+}
+
+static bool startsWith(const std::string& string, const char* prefix)
+{
+    return !string.compare(0, strlen(prefix), prefix);
+}
+
+static SQLiteQueryPlanNode* findNode(std::vector<SQLiteQueryPlanNode>& nodes, int id)
+{
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        if (nodes[i].id == id)
+            return &nodes[i];
+        if (SQLiteQueryPlanNode* found = findNode(nodes[i].children, id))
+            return found;
+    }
+    return 0;
+}
+
+int SQLiteQueryPlan::explain(sqlite3* db, const std::string& sql, SQLiteQueryPlan& plan)
+{
+    plan.clear();
+    if (!db)
+        return SQLITE_MISUSE;
+
+    SQLiteProfiler::IgnoreScope ignoreScope;
+    std::string explainSQL = "EXPLAIN QUERY PLAN " + sql;
+    sqlite3_stmt* statement = 0;
+    int error = sqlite3_prepare_v2(db, explainSQL.data(), explainSQL.length() + 1, &statement, 0);
+    if (error != SQLITE_OK)
+        return error;
+
+    // Columns are id, parent, notused and detail. Parents are always listed
+    // before their children.
+    while ((error = sqlite3_step(statement)) == SQLITE_ROW) {
+        SQLiteQueryPlanNode node;
+        node.id = sqlite3_column_int(statement, 0);
+        node.parentID = sqlite3_column_int(statement, 1);
+        const char* detail = reinterpret_cast<const char*>(sqlite3_column_text(statement, 3));
+        node.detail = detail ? detail : "";
+
+        SQLiteQueryPlanNode* parent = node.parentID ? findNode(plan.m_roots, node.parentID) : 0;
+        if (parent)
+            parent->children.push_back(node);
+        else
+            plan.m_roots.push_back(node);
+    }
+    sqlite3_finalize(statement);
+    return error == SQLITE_DONE ? SQLITE_OK : error;
+}
+
+unsigned SQLiteQueryPlan::issuesForDetail(const std::string& detail)
+{
+    unsigned issues = NoIssues;
+    // "SCAN t" (or "SCAN TABLE t" before SQLite 3.36) without "USING ... INDEX".
+    if (startsWith(detail, "SCAN ") && !contains(detail, " USING ") && !contains(detail, "CONSTANT ROW")
+        && !contains(detail, "VIRTUAL TABLE") && !startsWith(detail, "SCAN SUBQUERY"))
+        issues |= FullTableScan;
+    if (startsWith(detail, "USE TEMP B-TREE FOR ")) {
+        if (contains(detail, "ORDER BY"))
+            issues |= TempBTreeForOrderBy;
+        if (contains(detail, "GROUP BY"))
+            issues |= TempBTreeForGroupBy;
+        if (contains(detail, "DISTINCT"))
+            issues |= TempBTreeForDistinct;
+    }
+    if (contains(detail, "AUTOMATIC ") && contains(detail, "INDEX"))
+        issues |= AutomaticIndex;
+    return issues;
+}
+
+static void collectIssues(const std::vector<SQLiteQueryPlanNode>& nodes, unsigned& issues, std::vector<std::string>* details)
+{
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        unsigned nodeIssues = SQLiteQueryPlan::issuesForDetail(nodes[i].detail);
+        issues |= nodeIssues;
+        if (nodeIssues && details)
+            details->push_back(nodes[i].detail);
+        collectIssues(nodes[i].children, issues, details);
+    }
+}
+
+unsigned SQLiteQueryPlan::issues() const
+{
+    unsigned issues = NoIssues;
+    collectIssues(m_roots, issues, 0);
+    return issues;
+}
+
+std::vector<std::string> SQLiteQueryPlan::flaggedDetails() const
+{
+    unsigned issues = NoIssues;
+    std::vector<std::string> details;
+    collectIssues(m_roots, issues, &details);
+    return details;
+}
+
+std::string SQLiteQueryPlan::describeIssues(unsigned issues)
+{
+    static const struct {
+        Issue issue;
+        const char* description;
+    } descriptions[] = {
+        { FullTableScan, "full table scan" },
+        { TempBTreeForOrderBy, "temp b-tree for ORDER BY" },
+        { TempBTreeForGroupBy, "temp b-tree for GROUP BY" },
+        { TempBTreeForDistinct, "temp b-tree for DISTINCT" },
+        { AutomaticIndex, "automatic index" },
+    };
+
+    std::string description;
+    for (size_t i = 0; i < sizeof(descriptions) / sizeof(descriptions[0]); ++i) {
+        if (!(issues & descriptions[i].issue))
+            continue;
+        if (!description.empty())
+            description += ", ";
+        description += descriptions[i].description;
+    }
+    return description;
+}
+
+static void appendNodes(std::ostringstream& out, const std::vector<SQLiteQueryPlanNode>& nodes, int depth)
+{
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        out << std::string(depth * 2, ' ') << nodes[i].detail << '\n';
+        appendNodes(out, nodes[i].children, depth + 1);
+    }
+}
+
+std::string SQLiteQueryPlan::toString() const
+{
+    std::ostringstream out;
+    appendNodes(out, m_roots, 0);
+    return out.str();
+}
+
+SQLitePlanWatchdog::SQLitePlanWatchdog(bool logFindings)
+    : m_logFindings(logFindings)
+{
+}
+
+void SQLitePlanWatchdog::setLogFindings(bool logFindings)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_logFindings = logFindings;
+}
+
+bool SQLitePlanWatchdog::logFindings() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_logFindings;
+}
+
+std::vector<SQLitePlanWatchdog::Finding> SQLitePlanWatchdog::findings() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_findings;
+}
+
+size_t SQLitePlanWatchdog::inspectedStatementCount() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_inspected.size();
+}
+
+std::string SQLitePlanWatchdog::report() const
+{
+    std::vector<Finding> findings = this->findings();
+    std::ostringstream out;
+    for (size_t i = 0; i < findings.size(); ++i) {
+        out << findings[i].sql << "\n  issues: " << SQLiteQueryPlan::describeIssues(findings[i].issues) << '\n';
+        std::istringstream plan(findings[i].plan.toString());
+        for (std::string line; std::getline(plan, line); )
+            out << "  " << line << '\n';
+    }
+    return out.str();
+}
+
+void SQLitePlanWatchdog::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_inspected.clear();
+    m_findings.clear();
+}
+
+void SQLitePlanWatchdog::inspect(sqlite3* db, const std::string& sql)
+{
+    Finding finding;
+    finding.normalizedSQL = SQLiteProfiler::normalizeSQL(sql.c_str());
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_inspected.count(finding.normalizedSQL))
+            return;
+        if (m_inspected.size() >= maxInspectedStatements)
+            m_inspected.clear();
+        m_inspected.insert(finding.normalizedSQL);
+    }
+
+    finding.sql = sql;
+    if (SQLiteQueryPlan::explain(db, sql, finding.plan) != SQLITE_OK)
+        return;
+    finding.issues = finding.plan.issues();
+    if (!finding.issues)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    for (size_t i = 0; i < m_findings.size(); ++i) {
+        if (m_findings[i].normalizedSQL == finding.normalizedSQL)
+            return;
+    }
+    if (m_logFindings)
+        SQLITE_LOG(WARNING) << "Query plan: " << SQLiteQueryPlan::describeIssues(finding.issues) << " - " << sql << "\n" << finding.plan.toString();
+    if (m_findings.size() < maxInspectedStatements)
+        m_findings.push_back(finding);
+}
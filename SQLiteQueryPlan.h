@@ -0,0 +1,131 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteQueryPlan_h
+#define SQLiteQueryPlan_h
+
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+struct sqlite3;
+
+// One line of EXPLAIN QUERY PLAN output and the lines nested under it.
+struct SQLiteQueryPlanNode {
+    SQLiteQueryPlanNode() : id(0), parentID(0) { }
+
+    int id;
+    int parentID;
+    std::string detail;
+    std::vector<SQLiteQueryPlanNode> children;
+};
+
+// The parsed EXPLAIN QUERY PLAN tree of a statement.
+class SQLiteQueryPlan {
+public:
+    enum Issue {
+        NoIssues = 0,
+        // SCAN of a table without an index.
+        FullTableScan = 1 << 0,
+        TempBTreeForOrderBy = 1 << 1,
+        TempBTreeForGroupBy = 1 << 2,
+        TempBTreeForDistinct = 1 << 3,
+        // SQLite builds an index on every run of the statement.
+        AutomaticIndex = 1 << 4
+    };
+
+    // Runs EXPLAIN QUERY PLAN for sql on db. The caller must hold the
+    // connection lock. The run is hidden from SQLiteProfiler.
+    static int explain(sqlite3* db, const std::string& sql, SQLiteQueryPlan&);
+
+    const std::vector<SQLiteQueryPlanNode>& roots() const { return m_roots; }
+    bool isEmpty() const { return m_roots.empty(); }
+
+    // Bitwise OR of Issue values found anywhere in the tree.
+    unsigned issues() const;
+    // The detail lines that raised issues, in plan order.
+    std::vector<std::string> flaggedDetails() const;
+
+    static unsigned issuesForDetail(const std::string& detail);
+    static std::string describeIssues(unsigned issues);
+
+    // The tree, one line per node, indented by depth.
+    std::string toString() const;
+
+    void clear() { m_roots.clear(); }
+
+private:
+    std::vector<SQLiteQueryPlanNode> m_roots;
+};
+
+// Records the query plan of each distinct statement the first time it is
+// prepared on a connection, and flags plans with full table scans, temporary
+// B-trees for ORDER BY, GROUP BY or DISTINCT, or automatic indexes. Enable it
+// with SQLiteDatabase::enablePlanWatchdog().
+//
+// Statements are told apart by their normalized SQL (see
+// SQLiteProfiler::normalizeSQL), so queries differing only in literals are
+// inspected once. Statements taken from the statement cache are not
+// inspected again, so the cost is one extra prepare per distinct query. Up to
+// maxInspectedStatements queries are remembered; past that the set starts
+// over, and a query seen again is inspected again but not reported twice.
+class SQLitePlanWatchdog {
+public:
+    static const size_t maxInspectedStatements = 1024;
+
+    struct Finding {
+        // The SQL of the first statement flagged for the query.
+        std::string sql;
+        std::string normalizedSQL;
+        SQLiteQueryPlan plan;
+        unsigned issues;
+    };
+
+    explicit SQLitePlanWatchdog(bool logFindings);
+
+    void setLogFindings(bool logFindings);
+    bool logFindings() const;
+
+    // Flagged statements only, in the order they were first prepared. At
+    // most maxInspectedStatements are kept.
+    std::vector<Finding> findings() const;
+    // Distinct queries inspected since the set last started over.
+    size_t inspectedStatementCount() const;
+    // Text report of the findings, with their plans.
+    std::string report() const;
+    // Forgets everything, so statements are inspected again.
+    void clear();
+
+    // Called by SQLiteStatement::prepare with the connection lock held.
+    void inspect(sqlite3* db, const std::string& sql);
+
+private:
+    mutable std::mutex m_lock;
+    bool m_logFindings;
+    std::unordered_set<std::string> m_inspected;
+    std::vector<Finding> m_findings;
+};
+
+#endif
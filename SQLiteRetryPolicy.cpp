@@ -0,0 +1,216 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteRetryPolicy.h"
+
+#include "SQLiteLog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <random>
+#include <thread>
+
+#include <sqlite3.h>
+
+static int64_t nanosecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+static std::minstd_rand& jitterGenerator()
+{
+    // Seeded per thread, so threads that hit the same lock draw different waits.
+    thread_local std::minstd_rand generator(static_cast<unsigned>(std::hash<std::thread::id>()(std::this_thread::get_id())
+        ^ std::chrono::steady_clock::now().time_since_epoch().count()));
+    return generator;
+}
+
+SQLiteRetryPolicy::SQLiteRetryPolicy(const Options& options)
+    : m_options(options)
+{
+}
+
+bool SQLiteRetryPolicy::isBusy(int result)
+{
+    // Other SQLITE_LOCKED codes come from a conflict within the connection
+    // itself, such as dropping a table it is still reading, which waiting
+    // never clears.
+    return (result & 0xff) == SQLITE_BUSY || result == SQLITE_LOCKED_SHAREDCACHE;
+}
+
+std::chrono::microseconds SQLiteRetryPolicy::backoffDelay(int retry) const
+{
+    double ceiling = m_options.initialDelay.count() * std::pow(m_options.multiplier, std::max(retry, 0));
+    ceiling = std::min(ceiling, static_cast<double>(m_options.maxDelay.count()));
+    std::uniform_real_distribution<double> distribution(ceiling / 2, ceiling);
+    return std::chrono::microseconds(static_cast<int64_t>(distribution(jitterGenerator())));
+}
+
+#if SQLITE_UNLOCK_NOTIFY
+namespace {
+
+struct SQLiteUnlockWaiter {
+    SQLiteUnlockWaiter() : unlocked(false) { }
+
+    std::mutex lock;
+    std::condition_variable wakeUp;
+    bool unlocked;
+};
+
+}
+
+static void unlockNotify(void** arguments, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        SQLiteUnlockWaiter* waiter = static_cast<SQLiteUnlockWaiter*>(arguments[i]);
+        std::lock_guard<std::mutex> lock(waiter->lock);
+        waiter->unlocked = true;
+        waiter->wakeUp.notify_all();
+    }
+}
+#endif
+
+bool SQLiteRetryPolicy::waitForUnlock(SQLiteDatabase& db, std::chrono::steady_clock::time_point deadline)
+{
+#if SQLITE_UNLOCK_NOTIFY
+    SQLiteUnlockWaiter waiter;
+    int result;
+    {
+        std::lock_guard<std::mutex> lock(db.databaseMutex());
+        // May call unlockNotify right away if the blocking connection is done.
+        result = sqlite3_unlock_notify(db.sqlite3Handle(), unlockNotify, &waiter);
+    }
+    if (result != SQLITE_OK) {
+        SQLITE_LOG(WARNING) << "SQLite unlock notification refused, the connections would deadlock";
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lock(waiter.lock);
+    if (waiter.wakeUp.wait_until(lock, deadline, [&waiter]() { return waiter.unlocked; }))
+        return true;
+    lock.unlock();
+
+    // Cancel, so SQLite does not call back into the waiter after it is gone.
+    std::lock_guard<std::mutex> databaseLock(db.databaseMutex());
+    sqlite3_unlock_notify(db.sqlite3Handle(), 0, 0);
+    return false;
+#else
+    (void)db;
+    (void)deadline;
+    return false;
+#endif
+}
+
+int SQLiteRetryPolicy::run(SQLiteDatabase& db, const char* callSite, const std::function<int()>& operation)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point deadline = start + m_options.maxTotalWait;
+    int64_t busyWaitNanoseconds = 0;
+    int unlockNotifyWaits = 0;
+    int retries = 0;
+
+    int result = operation();
+    while (isBusy(result) && retries < m_options.maxRetries) {
+        std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+        if (waitStart >= deadline)
+            break;
+
+        bool unlocked = false;
+#if SQLITE_UNLOCK_NOTIFY
+        if (m_options.useUnlockNotify && result == SQLITE_LOCKED_SHAREDCACHE) {
+            ++unlockNotifyWaits;
+            unlocked = waitForUnlock(db, deadline);
+            if (!unlocked) {
+                busyWaitNanoseconds += nanosecondsSince(waitStart);
+                break;
+            }
+        }
+#endif
+        if (!unlocked)
+            std::this_thread::sleep_until(std::min(waitStart + backoffDelay(retries), deadline));
+        busyWaitNanoseconds += nanosecondsSince(waitStart);
+
+        ++retries;
+        result = operation();
+    }
+
+    bool failed = isBusy(result);
+    if (failed)
+        SQLITE_LOG(INFO) << "SQLite still busy after " << retries << " retries at " << (callSite ? callSite : "unknown call site");
+    record(callSite ? callSite : "", retries, failed, unlockNotifyWaits, busyWaitNanoseconds);
+    return result;
+}
+
+SQLiteDatabase::BusyHandler SQLiteRetryPolicy::busyHandler(const std::string& callSite)
+{
+    // Runs inside sqlite3_step with the retry number SQLite keeps for the call.
+    return [this, callSite](int retry) {
+        if (retry >= m_options.maxRetries) {
+            std::lock_guard<std::mutex> lock(m_lock);
+            ++m_statistics[callSite].failures;
+            return false;
+        }
+        std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+        std::this_thread::sleep_for(backoffDelay(retry));
+        std::lock_guard<std::mutex> lock(m_lock);
+        SiteStatistics& statistics = m_statistics[callSite];
+        if (!retry)
+            ++statistics.calls;
+        ++statistics.retries;
+        statistics.busyWaitNanoseconds += nanosecondsSince(waitStart);
+        return true;
+    };
+}
+
+void SQLiteRetryPolicy::record(const std::string& callSite, int retries, bool failed, int unlockNotifyWaits, int64_t busyWaitNanoseconds)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    SiteStatistics& statistics = m_statistics[callSite];
+    ++statistics.calls;
+    statistics.retries += retries;
+    if (failed)
+        ++statistics.failures;
+    statistics.unlockNotifyWaits += unlockNotifyWaits;
+    statistics.busyWaitNanoseconds += busyWaitNanoseconds;
+    statistics.maxBusyWaitNanoseconds = std::max(statistics.maxBusyWaitNanoseconds, busyWaitNanoseconds);
+}
+
+std::map<std::string, SQLiteRetryPolicy::SiteStatistics> SQLiteRetryPolicy::statistics() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_statistics;
+}
+
+SQLiteRetryPolicy::SiteStatistics SQLiteRetryPolicy::statistics(const std::string& callSite) const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::map<std::string, SiteStatistics>::const_iterator it = m_statistics.find(callSite);
+    return it == m_statistics.end() ? SiteStatistics() : it->second;
+}
+
+void SQLiteRetryPolicy::resetStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_statistics.clear();
+}
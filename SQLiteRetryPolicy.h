@@ -0,0 +1,123 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteRetryPolicy_h
+#define SQLiteRetryPolicy_h
+
+#include "SQLiteDatabase.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+
+#define SQLITE_RETRY_STRINGIFY_(x) #x
+#define SQLITE_RETRY_STRINGIFY(x) SQLITE_RETRY_STRINGIFY_(x)
+// Names the calling line, for the per call site statistics.
+#define SQLITE_CALL_SITE __FILE__ ":" SQLITE_RETRY_STRINGIFY(__LINE__)
+
+// Retries operations that fail with SQLITE_BUSY, or with
+// SQLITE_LOCKED_SHAREDCACHE on a shared-cache connection. Any other
+// SQLITE_LOCKED is a conflict within the connection and is returned at once.
+//
+// Retries are spaced by exponential backoff with jitter: each wait is drawn
+// between half and all of initialDelay * multiplier^retry, capped at
+// maxDelay, so contending connections spread out instead of retrying in
+// lockstep. The connection lock is not held while waiting. When a
+// shared-cache connection is blocked with SQLITE_LOCKED and unlock
+// notification is available, the policy sleeps until SQLite reports that
+// the blocking connection has finished instead.
+//
+// Retry counts and busy-wait time are kept per call site. One policy can be
+// shared by any number of connections and threads.
+class SQLiteRetryPolicy {
+public:
+    struct Options {
+        Options()
+            : maxRetries(50)
+            , initialDelay(std::chrono::microseconds(500))
+            , maxDelay(std::chrono::milliseconds(100))
+            , maxTotalWait(std::chrono::seconds(5))
+            , multiplier(2)
+            , useUnlockNotify(true) { }
+
+        int maxRetries;
+        std::chrono::microseconds initialDelay;
+        std::chrono::microseconds maxDelay;
+        // Gives up once this much time was spent waiting.
+        std::chrono::microseconds maxTotalWait;
+        double multiplier;
+        // Only effective if built with SQLITE_UNLOCK_NOTIFY.
+        bool useUnlockNotify;
+    };
+
+    struct SiteStatistics {
+        SiteStatistics()
+            : calls(0), retries(0), failures(0), unlockNotifyWaits(0), busyWaitNanoseconds(0), maxBusyWaitNanoseconds(0) { }
+
+        int64_t calls;
+        int64_t retries;
+        // Calls still busy when the policy gave up.
+        int64_t failures;
+        int64_t unlockNotifyWaits;
+        int64_t busyWaitNanoseconds;
+        // Longest total wait of a single call.
+        int64_t maxBusyWaitNanoseconds;
+    };
+
+    explicit SQLiteRetryPolicy(const Options& = Options());
+
+    const Options& options() const { return m_options; }
+
+    // Runs operation, which returns a SQLite result code, until it succeeds,
+    // fails with an error that is not retried, or the policy gives up.
+    // Returns the last result.
+    int run(SQLiteDatabase&, const char* callSite, const std::function<int()>& operation);
+    // Whether run() retries an operation that returned result.
+    static bool isBusy(int result);
+
+    // The wait before the given retry, counting from 0.
+    std::chrono::microseconds backoffDelay(int retry) const;
+
+    // A handler for SQLiteDatabase::setBusyHandler() applying the same backoff
+    // inside SQLite, for statements that are not run through run(). The
+    // connection lock stays held while it sleeps.
+    SQLiteDatabase::BusyHandler busyHandler(const std::string& callSite);
+
+    std::map<std::string, SiteStatistics> statistics() const;
+    SiteStatistics statistics(const std::string& callSite) const;
+    void resetStatistics();
+
+private:
+    // Returns false if SQLite reports a deadlock or the deadline passed.
+    bool waitForUnlock(SQLiteDatabase&, std::chrono::steady_clock::time_point deadline);
+    void record(const std::string& callSite, int retries, bool failed, int unlockNotifyWaits, int64_t busyWaitNanoseconds);
+
+    Options m_options;
+
+    mutable std::mutex m_lock;
+    std::map<std::string, SiteStatistics> m_statistics;
+};
+
+#endif
@@ -0,0 +1,210 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteSlowQueryLog.h"
+
+#include "SQLiteProfiler.h"
+#include "SQLiteQueryPlan.h"
+#include <sqlite3.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <sstream>
+
+static const size_t maxCachedPlans = 1024;
+
+static void appendJSONString(std::ostringstream& out, const std::string& string)
+{
+    out << '"';
+    for (size_t i = 0; i < string.size(); ++i) {
+        unsigned char c = string[i];
+        switch (c) {
+            case '"':
+                out << "\\\"";
+                break;
+            case '\\':
+                out << "\\\\";
+                break;
+            case '\n':
+                out << "\\n";
+                break;
+            case '\t':
+                out << "\\t";
+                break;
+            default:
+                if (c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out << escaped;
+                } else
+                    out << c;
+        }
+    }
+    out << '"';
+}
+
+SQLiteSlowQueryLog::SQLiteSlowQueryLog(const Options& options)
+    : m_options(options)
+    , m_tokens(options.burst)
+    , m_lastRefill(std::chrono::steady_clock::now())
+    , m_fileBytes(0)
+    , m_thresholdNanoseconds(std::chrono::duration_cast<std::chrono::nanoseconds>(options.threshold).count())
+    , m_recorded(0)
+    , m_sampledOut(0)
+    , m_writer(1024, [this](int, const std::string& line) { write(line); })
+{
+}
+
+SQLiteSlowQueryLog::~SQLiteSlowQueryLog()
+{
+    m_writer.flush();
+}
+
+SQLiteSlowQueryLog::Options SQLiteSlowQueryLog::options() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_options;
+}
+
+void SQLiteSlowQueryLog::setOptions(const Options& options)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    std::lock_guard<std::mutex> fileLock(m_fileLock);
+    if (options.path != m_options.path && m_file.is_open())
+        m_file.close();
+    m_options = options;
+    m_tokens = options.burst;
+    m_thresholdNanoseconds.store(std::chrono::duration_cast<std::chrono::nanoseconds>(options.threshold).count(), std::memory_order_relaxed);
+}
+
+bool SQLiteSlowQueryLog::takeToken()
+{
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - m_lastRefill).count();
+    m_lastRefill = now;
+    m_tokens = std::min<double>(m_options.burst, m_tokens + seconds * m_options.maxRecordsPerSecond);
+    if (m_tokens < 1)
+        return false;
+    m_tokens -= 1;
+    return true;
+}
+
+void SQLiteSlowQueryLog::record(sqlite3* db, sqlite3_stmt* statement, const std::string& sql, uint64_t elapsedNanoseconds, uint64_t lockWaitNanoseconds, uint64_t rows,
+                                const SQLiteStatement::StatementStatus& status)
+{
+    Record record;
+    record.normalizedSQL = SQLiteProfiler::normalizeSQL(sql.c_str());
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!takeToken()) {
+            m_sampledOut.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        std::unordered_map<std::string, std::string>::iterator plan = m_plans.find(record.normalizedSQL);
+        if (plan != m_plans.end())
+            record.plan = plan->second;
+        else {
+            SQLiteQueryPlan queryPlan;
+            if (SQLiteQueryPlan::explain(db, sql, queryPlan) == SQLITE_OK)
+                record.plan = queryPlan.toString();
+            if (m_plans.size() >= maxCachedPlans)
+                m_plans.clear();
+            m_plans[record.normalizedSQL] = record.plan;
+        }
+    }
+
+    if (char* expanded = statement ? sqlite3_expanded_sql(statement) : 0) {
+        record.expandedSQL = expanded;
+        sqlite3_free(expanded);
+    }
+    record.elapsedNanoseconds = elapsedNanoseconds;
+    record.lockWaitNanoseconds = lockWaitNanoseconds;
+    record.rows = rows;
+    record.status = status;
+
+    if (m_writer.push(SQLITE_LOG_LEVEL_WARNING, format(record)))
+        m_recorded.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::string SQLiteSlowQueryLog::format(const Record& record)
+{
+    std::ostringstream out;
+    out << "{\"time\":" << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    out << ",\"sql\":";
+    appendJSONString(out, record.normalizedSQL);
+    out << ",\"expandedSQL\":";
+    appendJSONString(out, record.expandedSQL);
+    out << ",\"elapsedUs\":" << record.elapsedNanoseconds / 1000
+        << ",\"lockWaitUs\":" << record.lockWaitNanoseconds / 1000
+        << ",\"rows\":" << record.rows
+        << ",\"fullScanSteps\":" << record.status.fullScanSteps
+        << ",\"sorts\":" << record.status.sorts
+        << ",\"autoIndexes\":" << record.status.autoIndexes
+        << ",\"vmSteps\":" << record.status.vmSteps
+        << ",\"reprepares\":" << record.status.reprepares
+        << ",\"runs\":" << record.status.runs
+        << ",\"memoryUsed\":" << record.status.memoryUsed
+        << ",\"plan\":";
+    appendJSONString(out, record.plan);
+    out << '}';
+    return out.str();
+}
+
+void SQLiteSlowQueryLog::rotate()
+{
+    m_file.close();
+
+    // m_lock is not held here; m_options only changes under m_fileLock too.
+    const std::string& path = m_options.path;
+    if (!m_options.maxFiles)
+        remove(path.c_str());
+    else {
+        remove((path + "." + std::to_string(m_options.maxFiles)).c_str());
+        for (unsigned i = m_options.maxFiles; i > 1; --i)
+            rename((path + "." + std::to_string(i - 1)).c_str(), (path + "." + std::to_string(i)).c_str());
+        rename(path.c_str(), (path + ".1").c_str());
+    }
+}
+
+void SQLiteSlowQueryLog::write(const std::string& line)
+{
+    std::lock_guard<std::mutex> lock(m_fileLock);
+    if (m_options.path.empty())
+        return;
+
+    if (!m_file.is_open()) {
+        m_file.open(m_options.path.c_str(), std::ios::out | std::ios::app);
+        m_file.seekp(0, std::ios::end);
+        m_fileBytes = static_cast<uint64_t>(std::max<std::streamoff>(m_file.tellp(), 0));
+    }
+    if (m_fileBytes && m_fileBytes + line.size() + 1 > m_options.maxFileBytes) {
+        rotate();
+        m_file.open(m_options.path.c_str(), std::ios::out | std::ios::trunc);
+        m_fileBytes = 0;
+    }
+
+    m_file << line << '\n';
+    m_file.flush();
+    m_fileBytes += line.size() + 1;
+}
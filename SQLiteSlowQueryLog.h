@@ -0,0 +1,135 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteSlowQueryLog_h
+#define SQLiteSlowQueryLog_h
+
+#include "SQLiteLog.h"
+#include "SQLiteStatement.h"
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+struct SQLiteSlowQueryLogOptions {
+    SQLiteSlowQueryLogOptions() : threshold(100000), maxRecordsPerSecond(10), burst(20), maxFileBytes(16 * 1024 * 1024), maxFiles(4) { }
+
+    std::string path;
+    std::chrono::microseconds threshold;
+    double maxRecordsPerSecond;
+    unsigned burst;
+    uint64_t maxFileBytes;
+    // Rotated files kept besides the current one.
+    unsigned maxFiles;
+};
+
+// Appends statements whose prepare and steps together took longer than a
+// threshold to a local file, one JSON object per line. A record has:
+// - the normalized and the expanded SQL (sqlite3_expanded_sql)
+// - the wall time, the time spent waiting for the connection lock, and the rows returned
+// - the sqlite3_stmt_status counters and the query plan
+//
+// A run ends when step() returns anything but SQLResultRow, or when the
+// statement is reset or finalized.
+//
+// The caller's thread builds the record; the plan is explained once per
+// normalized SQL and then cached. A background thread does the file writes.
+// A token bucket limits how many records are accepted per second. When the
+// file reaches maxFileBytes it is renamed to path.1, path.1 to path.2 and so
+// on, and the oldest file is removed.
+//
+// Enable it with SQLiteDatabase::enableSlowQueryLog().
+class SQLiteSlowQueryLog {
+public:
+    typedef SQLiteSlowQueryLogOptions Options;
+
+    struct Record {
+        Record() : elapsedNanoseconds(0), lockWaitNanoseconds(0), rows(0) { }
+
+        std::string normalizedSQL;
+        std::string expandedSQL;
+        uint64_t elapsedNanoseconds;
+        uint64_t lockWaitNanoseconds;
+        uint64_t rows;
+        SQLiteStatement::StatementStatus status;
+        std::string plan;
+    };
+
+    explicit SQLiteSlowQueryLog(const Options&);
+    ~SQLiteSlowQueryLog();
+
+    Options options() const;
+    void setOptions(const Options&);
+
+    // options().threshold, readable without taking the lock.
+    uint64_t thresholdNanoseconds() const { return m_thresholdNanoseconds.load(std::memory_order_relaxed); }
+
+    // Called by SQLiteStatement, with the connection lock held, for a run
+    // that exceeded the threshold. status holds the counters of that run only.
+    void record(sqlite3* db, sqlite3_stmt*, const std::string& sql, uint64_t elapsedNanoseconds, uint64_t lockWaitNanoseconds, uint64_t rows,
+                const SQLiteStatement::StatementStatus&);
+
+    // Waits until every accepted record is in the file.
+    void flush() { m_writer.flush(); }
+
+    // Records accepted, and records turned away by the rate limit or because
+    // the writer fell behind.
+    uint64_t recordedCount() const { return m_recorded.load(std::memory_order_relaxed); }
+    uint64_t sampledOutCount() const { return m_sampledOut.load(std::memory_order_relaxed) + m_writer.dropped(); }
+
+    static std::string format(const Record&);
+
+private:
+    bool takeToken();
+    void write(const std::string& line);
+    void rotate();
+
+    mutable std::mutex m_lock;
+    Options m_options;
+    double m_tokens;
+    std::chrono::steady_clock::time_point m_lastRefill;
+    std::unordered_map<std::string, std::string> m_plans;
+
+    // Only touched by the writer thread, and by setOptions() under m_fileLock.
+    std::mutex m_fileLock;
+    std::ofstream m_file;
+    uint64_t m_fileBytes;
+
+    // Read by every statement run that the log times.
+    std::atomic<uint64_t> m_thresholdNanoseconds;
+    std::atomic<uint64_t> m_recorded;
+    std::atomic<uint64_t> m_sampledOut;
+
+    // Declared last so that its thread stops before the members it writes to
+    // are destroyed.
+    SQLiteAsyncLogSink m_writer;
+};
+
+#endif
@@ -26,17 +26,20 @@
 #include "SQLiteStatement.h"
 
 #include "SQLValue.h"
+#include "SQLiteColumnarResult.h"
+#include "SQLiteLog.h"
+#include "SQLiteQueryPlan.h"
+#include "SQLiteRetryPolicy.h"
+#include "SQLiteSlowQueryLog.h"
 #include <sqlite3.h>
 #include <strings.h>
 
 #include <thread>
 #include <algorithm>
+#include <chrono>
 
 #include <glog/logging.h>
 
-// Unicode char as char
-#define UChar char
-
 #ifndef NDEBUG
 #define ASSERT(x)
 #else
@@ -71,8 +74,16 @@ SQLiteStatement::SQLiteStatement(SQLiteDatabase& db, const std::string& sql)
     : m_database(db)
     , m_query(sql)
     , m_statement(0)
+    , m_isCacheable(false)
+    , m_parameterCount(0)
+    , m_runNanoseconds(0)
+    , m_runLockWaitNanoseconds(0)
+    , m_runRows(0)
+    , m_runHasStartStatus(false)
+    , m_isLockedByCursor(false)
 #ifndef NDEBUG
     , m_isPrepared(false)
+    , m_rowGeneration(std::make_shared<unsigned>(0))
 #endif
 {
 }
@@ -82,17 +93,89 @@ SQLiteStatement::~SQLiteStatement()
     finalize();
 }
 
+// Adds the time from construction to stop(), and the part of it spent
+// waiting for the connection lock, to the statement's current run. Does
+// nothing unless the slow query log is enabled.
+class SQLiteRunTimer {
+public:
+    explicit SQLiteRunTimer(SQLiteStatement& statement)
+        : m_statement(statement)
+        , m_isTiming(statement.m_database.m_isSlowQueryLogEnabled.load(std::memory_order_relaxed))
+    {
+        if (m_isTiming)
+            m_start = std::chrono::steady_clock::now();
+    }
+
+    ~SQLiteRunTimer() { stop(); }
+
+    bool isTiming() const { return m_isTiming; }
+
+    void lockAcquired()
+    {
+        if (m_isTiming)
+            m_statement.m_runLockWaitNanoseconds += nanosecondsSince(m_start);
+    }
+
+    void stop()
+    {
+        if (!m_isTiming)
+            return;
+        m_statement.m_runNanoseconds += std::max<uint64_t>(nanosecondsSince(m_start), 1);
+        m_isTiming = false;
+    }
+
+private:
+    static uint64_t nanosecondsSince(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    SQLiteStatement& m_statement;
+    bool m_isTiming;
+    std::chrono::steady_clock::time_point m_start;
+};
+
+void SQLiteStatement::startRun()
+{
+    if (m_runHasStartStatus || !m_statement)
+        return;
+    m_runStartStatus = statementStatus(m_statement);
+    m_runHasStartStatus = true;
+}
+
+void SQLiteStatement::finishRun()
+{
+    SQLiteSlowQueryLog* log = m_database.m_isSlowQueryLogEnabled.load(std::memory_order_relaxed) ? m_database.m_slowQueryLog.get() : 0;
+    if (log && m_runNanoseconds >= log->thresholdNanoseconds()) {
+        // Differences only: SQLiteMetricsCollector reads the same counters as
+        // running totals, so they are never reset here.
+        StatementStatus status = statementStatus(m_statement);
+        if (m_runHasStartStatus)
+            status = status.since(m_runStartStatus);
+        else
+            status = status.since(status);
+        log->record(m_database.sqlite3Handle(), m_statement, m_query, m_runNanoseconds, m_runLockWaitNanoseconds, m_runRows, status);
+    }
+
+    m_runHasStartStatus = false;
+    m_runNanoseconds = 0;
+    m_runLockWaitNanoseconds = 0;
+    m_runRows = 0;
+}
+
 int SQLiteStatement::prepare()
 {
-    DLOG(INFO) << __func__ << " >>>";
+    SQLITE_LOG(TRACE) << __func__ << " >>>";
 #ifndef NDEBUG
     ASSERT(!m_isPrepared);
 #endif
 
-    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    SQLiteRunTimer timer(*this);
+    std::unique_lock<std::mutex> lock = lockDatabase();
+    timer.lockAcquired();
     if (m_database.isInterrupted())
     {
-        DLOG(INFO) << __func__ << " <<< " << "SQLITE_INTERRUPT";
+        SQLITE_LOG(TRACE) << __func__ << " <<< " << "SQLITE_INTERRUPT";
         return SQLITE_INTERRUPT;
     }
 
@@ -100,7 +183,18 @@ int SQLiteStatement::prepare()
     std::string query = m_query;
     //query.erase(std::remove_if(query.begin(), query.end(), ::isspace), query.end());
 
-    DLOG(INFO) << "SQL - prepare - " << query.data();
+    SQLITE_LOG(TRACE) << "SQL - prepare - " << query.data();
+
+    m_statement = m_database.takeCachedStatement(query);
+    if (m_statement) {
+        m_isCacheable = true;
+        m_parameterCount = sqlite3_bind_parameter_count(m_statement);
+#ifndef NDEBUG
+        m_isPrepared = true;
+#endif
+        SQLITE_LOG(TRACE) << __func__ << " <<< " << "OK (cached)";
+        return SQLITE_OK;
+    }
 
     // Pass the length of the string including the null character to sqlite3_prepare_v2;
     // this lets SQLite avoid an extra string copy.
@@ -110,25 +204,33 @@ int SQLiteStatement::prepare()
     int error = sqlite3_prepare_v2(m_database.sqlite3Handle(), query.data(), lengthIncludingNullCharacter, &m_statement, &tail);
 
     if (error != SQLITE_OK)
-        LOG(ERROR) << "sqlite3_prepare16 failed " << "(" << error << ")\n" << query.data() << "\n" << sqlite3_errmsg(m_database.sqlite3Handle());
+        SQLITE_LOG(ERROR) << "sqlite3_prepare16 failed " << "(" << error << ")\n" << query.data() << "\n" << sqlite3_errmsg(m_database.sqlite3Handle());
 
     if (tail && *tail)
         error = SQLITE_ERROR;
 
+    m_isCacheable = error == SQLITE_OK;
+    m_parameterCount = m_statement ? sqlite3_bind_parameter_count(m_statement) : 0;
+
+    if (error == SQLITE_OK && m_database.m_planWatchdog && !sqlite3_stmt_isexplain(m_statement))
+        m_database.m_planWatchdog->inspect(m_database.sqlite3Handle(), query);
+
 #ifndef NDEBUG
     m_isPrepared = error == SQLITE_OK;
 #endif
-    DLOG(INFO) << __func__ << " <<< " << ((error == SQLITE_OK) ? "OK" : "ERROR");
+    SQLITE_LOG(TRACE) << __func__ << " <<< " << ((error == SQLITE_OK) ? "OK" : "ERROR");
     return error;
 }
 
 int SQLiteStatement::step()
 {
-    DLOG(INFO) << __func__ << " >>>";
-    std::lock_guard<std::mutex> lock(m_database.databaseMutex());
+    SQLITE_LOG(TRACE) << __func__ << " >>>";
+    SQLiteRunTimer timer(*this);
+    std::unique_lock<std::mutex> lock = lockDatabase();
+    timer.lockAcquired();
     if (m_database.isInterrupted())
     {
-        DLOG(INFO) << __func__ << " <<< " << "SQLITE_INTERRUPT";
+        SQLITE_LOG(TRACE) << __func__ << " <<< " << "SQLITE_INTERRUPT";
         return SQLITE_INTERRUPT;
     }
 #ifndef NDEBUG
@@ -137,39 +239,106 @@ int SQLiteStatement::step()
 
     if (!m_statement)
     {
-        DLOG(INFO) << __func__ << " <<< " << "SQLITE_OK";
+        SQLITE_LOG(TRACE) << __func__ << " <<< " << "SQLITE_OK";
         return SQLITE_OK;
     }
 
+    return stepTimed(timer, true);
+}
+
+int SQLiteStatement::stepTimed(SQLiteRunTimer& timer, bool updateChangesCount)
+{
+    if (timer.isTiming())
+        startRun();
+    int error = stepLocked(updateChangesCount);
+    if (timer.isTiming()) {
+        timer.stop();
+        if (error == SQLITE_ROW)
+            ++m_runRows;
+        else
+            finishRun();
+    }
+    return error;
+}
+
+std::unique_lock<std::mutex> SQLiteStatement::lockDatabase()
+{
+    // A SQLiteLockedCursor on this statement already holds the lock.
+    if (m_isLockedByCursor)
+        return std::unique_lock<std::mutex>();
+    return std::unique_lock<std::mutex>(m_database.databaseMutex());
+}
+
+int SQLiteStatement::step(SQLiteRetryPolicy& policy, const char* callSite)
+{
+    int error = step();
+    if (!SQLiteRetryPolicy::isBusy(error))
+        return error;
+    if (!m_database.isAutoCommitOn())
+        return error;
+
+    bool first = true;
+    return policy.run(m_database, callSite, [this, &first, error]() {
+        // The failed step above counts as the first attempt.
+        if (first) {
+            first = false;
+            return error;
+        }
+        return step();
+    });
+}
+
+int SQLiteStatement::stepLocked(bool updateChangesCount)
+{
     // The database needs to update its last changes count before each statement
     // in order to compute properly the lastChanges() return value.
-    m_database.updateLastChangesCount();
+    if (updateChangesCount)
+        m_database.updateLastChangesCount();
 
-    DLOG(INFO) << "SQL - step - " << m_query.data();
+#ifndef NDEBUG
+    ++*m_rowGeneration;
+#endif
+
+    SQLITE_LOG(TRACE) << "SQL - step - " << m_query.data();
     int error = sqlite3_step(m_statement);
     if (error != SQLITE_DONE && error != SQLITE_ROW) {
-        LOG(ERROR) << "sqlite3_step failed (" << error << ")\nQuery - " << m_query.data() << "\nError - " << sqlite3_errmsg(m_database.sqlite3Handle());
+        SQLITE_LOG(ERROR) << "sqlite3_step failed (" << error << ")\nQuery - " << m_query.data() << "\nError - " << sqlite3_errmsg(m_database.sqlite3Handle());
     }
 
-    DLOG(INFO) << __func__ << " <<< " << ((error == SQLITE_OK) ? "OK" : "ERROR");
+    SQLITE_LOG(TRACE) << __func__ << " <<< " << ((error == SQLITE_OK) ? "OK" : "ERROR");
     return error;
 }
 
 int SQLiteStatement::finalize()
 {
-    DLOG(INFO) << __func__ << " >>>";
+    SQLITE_LOG(TRACE) << __func__ << " >>>";
 #ifndef NDEBUG
     m_isPrepared = false;
+    ++*m_rowGeneration;
 #endif
     if (!m_statement)
     {
-        DLOG(INFO) << __func__ << " <<< " << "SQLITE_OK";
+        SQLITE_LOG(TRACE) << __func__ << " <<< " << "SQLITE_OK";
         return SQLITE_OK;
     }
-    DLOG(INFO) << "SQL - finalize - " << m_query.data();
-    int result = sqlite3_finalize(m_statement);
+    SQLITE_LOG(TRACE) << "SQL - finalize - " << m_query.data();
+    int result;
+    {
+        // Statements are only freed under the connection lock, so that
+        // walking them with sqlite3_next_stmt() under the same lock is safe.
+        std::unique_lock<std::mutex> lock = lockDatabase();
+        if (m_runNanoseconds)
+            finishRun();
+        result = m_isCacheable ? m_database.releaseCachedStatement(m_query, m_statement) : sqlite3_finalize(m_statement);
+    }
     m_statement = 0;
-    DLOG(INFO) << __func__ << " <<< " << "result=" << result;
+    m_isCacheable = false;
+    // SQLite no longer references the adopted buffers once the statement is
+    // finalized or its bindings have been cleared by the statement cache.
+    m_adoptedBindings.clear();
+    m_parameterCount = 0;
+    m_parameterIndexes.clear();
+    SQLITE_LOG(TRACE) << __func__ << " <<< " << "result=" << result;
     return result;
 }
 
@@ -177,10 +346,15 @@ int SQLiteStatement::reset()
 {
 #ifndef NDEBUG
     ASSERT(m_isPrepared);
+    ++*m_rowGeneration;
 #endif
     if (!m_statement)
         return SQLITE_OK;
-    DLOG(INFO) << "SQL - reset - " << m_query.data();
+    SQLITE_LOG(TRACE) << "SQL - reset - " << m_query.data();
+    if (m_runNanoseconds) {
+        std::unique_lock<std::mutex> lock = lockDatabase();
+        finishRun();
+    }
     return sqlite3_reset(m_statement);
 }
 
@@ -215,7 +389,12 @@ bool SQLiteStatement::returnsAtLeastOneResult()
 
 }
 
-int SQLiteStatement::bindBlob(int index, const void* blob, int size)
+static void deleteAdoptedArray(void* buffer)
+{
+    delete[] static_cast<char*>(buffer);
+}
+
+int SQLiteStatement::bindBlob(int index, const void* blob, int size, BindLifetime lifetime)
 {
 #ifndef NDEBUG
     ASSERT(m_isPrepared);
@@ -228,43 +407,91 @@ int SQLiteStatement::bindBlob(int index, const void* blob, int size)
     if (!m_statement)
         return SQLITE_ERROR;
 
-    return sqlite3_bind_blob(m_statement, index, blob, size, SQLITE_TRANSIENT);
+    int result = sqlite3_bind_blob(m_statement, index, blob, size, lifetime == BindBorrow ? SQLITE_STATIC : SQLITE_TRANSIENT);
+    releaseAdoptedBinding(index);
+    return result;
+}
+
+int SQLiteStatement::bindBlob(int index, std::string_view blob, BindLifetime lifetime)
+{
+    // SQLite treats a null pointer as a null value, so we supply a non-null
+    // pointer for the empty blob.
+    static const char emptyBlob = 0;
+    return bindBlob(index, blob.empty() ? &emptyBlob : blob.data(), blob.length(), lifetime);
 }
 
-int SQLiteStatement::bindBlob(int index, const std::string& text)
+int SQLiteStatement::bindText(int index, std::string_view text, BindLifetime lifetime)
 {
-    // String::characters() returns 0 for the empty string, which SQLite
-    // treats as a null, so we supply a non-null pointer for that case.
-    UChar anyCharacter = 0;
-    const UChar* characters;
-    if (!text.length())
-        characters = &anyCharacter;
-    else
-        //characters = text.characters();
-        characters = text.data();
+#ifndef NDEBUG
+    ASSERT(m_isPrepared);
+#endif
+    ASSERT(index > 0);
+    ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
+
+    // SQLite treats a null pointer as a null value, so we supply a non-null
+    // pointer for the empty string.
+    static const char emptyText = 0;
+    const char* characters = text.empty() ? &emptyText : text.data();
 
-    return bindBlob(index, characters, text.length() * sizeof(UChar));
+    // Strings are UTF-8 encoded, which is also the database encoding, so
+    // binding with an explicit byte length lets SQLite skip transcoding
+    // and the strlen() it would otherwise do.
+    int result = sqlite3_bind_text64(m_statement, index, characters, text.length(), lifetime == BindBorrow ? SQLITE_STATIC : SQLITE_TRANSIENT, SQLITE_UTF8);
+    releaseAdoptedBinding(index);
+    return result;
 }
 
-int SQLiteStatement::bindText(int index, const std::string& text)
+int SQLiteStatement::bindAdoptedBlob(int index, std::vector<char>&& blob)
+{
+    std::shared_ptr<std::vector<char> > adopted = std::make_shared<std::vector<char> >(std::move(blob));
+    int result = bindBlob(index, std::string_view(adopted->data(), adopted->size()), BindBorrow);
+    if (result == SQLITE_OK)
+        adoptBinding(index, adopted);
+    return result;
+}
+
+int SQLiteStatement::bindAdoptedBlob(int index, std::string&& blob)
+{
+    std::shared_ptr<std::string> adopted = std::make_shared<std::string>(std::move(blob));
+    int result = bindBlob(index, *adopted, BindBorrow);
+    if (result == SQLITE_OK)
+        adoptBinding(index, adopted);
+    return result;
+}
+
+int SQLiteStatement::bindAdoptedBlob(int index, std::unique_ptr<char[]> blob, int size)
 {
 #ifndef NDEBUG
     ASSERT(m_isPrepared);
 #endif
     ASSERT(index > 0);
     ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
+    ASSERT(blob);
+    ASSERT(size >= 0);
+
+    if (!m_statement)
+        return SQLITE_ERROR;
 
-    // String::characters() returns 0 for the empty string, which SQLite
-    // treats as a null, so we supply a non-null pointer for that case.
-    UChar anyCharacter = 0;
-    const UChar* characters;
-    if (!text.length())
-        characters = &anyCharacter;
-    else
-        //characters = text.characters();
-        characters = text.data();
+    // SQLite calls the destructor even if binding fails.
+    int result = sqlite3_bind_blob(m_statement, index, blob.release(), size, deleteAdoptedArray);
+    releaseAdoptedBinding(index);
+    return result;
+}
 
-    return sqlite3_bind_text16(m_statement, index, characters, sizeof(UChar) * text.length(), SQLITE_TRANSIENT);
+int SQLiteStatement::bindAdoptedText(int index, std::string&& text)
+{
+    std::shared_ptr<std::string> adopted = std::make_shared<std::string>(std::move(text));
+    int result = bindText(index, *adopted, BindBorrow);
+    if (result == SQLITE_OK)
+        adoptBinding(index, adopted);
+    return result;
+}
+
+void SQLiteStatement::adoptBinding(int index, std::shared_ptr<void> buffer)
+{
+    if (static_cast<unsigned>(index) >= m_adoptedBindings.size())
+        m_adoptedBindings.resize(index + 1);
+    m_adoptedBindings[index] = buffer;
 }
 
 int SQLiteStatement::bindInt(int index, int integer)
@@ -275,7 +502,9 @@ int SQLiteStatement::bindInt(int index, int integer)
     ASSERT(index > 0);
     ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
 
-    return sqlite3_bind_int(m_statement, index, integer);
+    int result = sqlite3_bind_int(m_statement, index, integer);
+    releaseAdoptedBinding(index);
+    return result;
 }
 
 int SQLiteStatement::bindInt64(int index, int64_t integer)
@@ -286,7 +515,9 @@ int SQLiteStatement::bindInt64(int index, int64_t integer)
     ASSERT(index > 0);
     ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
 
-    return sqlite3_bind_int64(m_statement, index, integer);
+    int result = sqlite3_bind_int64(m_statement, index, integer);
+    releaseAdoptedBinding(index);
+    return result;
 }
 
 int SQLiteStatement::bindDouble(int index, double number)
@@ -297,7 +528,9 @@ int SQLiteStatement::bindDouble(int index, double number)
     ASSERT(index > 0);
     ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
 
-    return sqlite3_bind_double(m_statement, index, number);
+    int result = sqlite3_bind_double(m_statement, index, number);
+    releaseAdoptedBinding(index);
+    return result;
 }
 
 int SQLiteStatement::bindNull(int index)
@@ -308,16 +541,39 @@ int SQLiteStatement::bindNull(int index)
     ASSERT(index > 0);
     ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
 
-    return sqlite3_bind_null(m_statement, index);
+    int result = sqlite3_bind_null(m_statement, index);
+    releaseAdoptedBinding(index);
+    return result;
+}
+
+int SQLiteStatement::bindZeroBlob(int index, int64_t size)
+{
+#ifndef NDEBUG
+    ASSERT(m_isPrepared);
+#endif
+    ASSERT(index > 0);
+    ASSERT(static_cast<unsigned>(index) <= bindParameterCount());
+    ASSERT(size >= 0);
+
+    if (!m_statement)
+        return SQLITE_ERROR;
+
+    int result = sqlite3_bind_zeroblob64(m_statement, index, size);
+    releaseAdoptedBinding(index);
+    return result;
 }
 
 int SQLiteStatement::bindValue(int index, const SQLValue& value)
 {
     switch (value.type()) {
         case SQLValue::StringValue:
-            return bindText(index, value.string());
+            return bindText(index, value.textView());
+        case SQLValue::BlobValue:
+            return bindBlob(index, value.blobView());
         case SQLValue::NumberValue:
             return bindDouble(index, value.number());
+        case SQLValue::IntegerValue:
+            return bindInt64(index, value.integer());
         case SQLValue::NullValue:
             return bindNull(index);
     }
@@ -331,9 +587,24 @@ unsigned SQLiteStatement::bindParameterCount() const
 #ifndef NDEBUG
     ASSERT(m_isPrepared);
 #endif
+    return m_parameterCount;
+}
+
+int SQLiteStatement::bindParameterIndex(std::string_view name)
+{
     if (!m_statement)
         return 0;
-    return sqlite3_bind_parameter_count(m_statement);
+
+    for (size_t i = 0; i < m_parameterIndexes.size(); ++i) {
+        if (m_parameterIndexes[i].first == name)
+            return m_parameterIndexes[i].second;
+    }
+
+    int index = sqlite3_bind_parameter_index(m_statement, std::string(name).c_str());
+    if (!index)
+        SQLITE_LOG(ERROR) << "No parameter named " << name << " in " << m_query;
+    m_parameterIndexes.push_back(std::make_pair(std::string(name), index));
+    return index;
 }
 
 int SQLiteStatement::columnCount()
@@ -366,7 +637,8 @@ bool SQLiteStatement::isColumnDeclaredAsBlob(int col)
             return false;
     }
 
-    return !strcasecmp(std::string("BLOB").c_str(), std::string(reinterpret_cast<const UChar*>(sqlite3_column_decltype16(m_statement, col))).c_str()) ? true : false;
+    const char* declaredType = sqlite3_column_decltype(m_statement, col);
+    return declaredType && !strcasecmp("BLOB", declaredType);
 }
 
 std::string SQLiteStatement::getColumnName(int col)
@@ -377,10 +649,20 @@ std::string SQLiteStatement::getColumnName(int col)
             return std::string();
     if (columnCount() <= col)
         return std::string();
-    return std::string(reinterpret_cast<const UChar*>(sqlite3_column_name16(m_statement, col)));
+    const char* name = sqlite3_column_name(m_statement, col);
+    return name ? std::string(name) : std::string();
 }
 
 SQLValue SQLiteStatement::getColumnValue(int col)
+{
+    SQLValue value = columnValueView(col);
+    if (!value.isBorrowed())
+        return value;
+    // Copies the payload, inline if it is short enough.
+    return value.type() == SQLValue::BlobValue ? SQLValue::blob(value.blobView()) : SQLValue::text(value.textView());
+}
+
+SQLValue SQLiteStatement::columnValueView(int col)
 {
     ASSERT(col >= 0);
     if (!m_statement)
@@ -391,15 +673,18 @@ SQLValue SQLiteStatement::getColumnValue(int col)
 
     // SQLite is typed per value. optional column types are
     // "(mostly) ignored"
-    sqlite3_value* value = sqlite3_column_value(m_statement, col);
-    switch (sqlite3_value_type(value)) {
-        case SQLITE_INTEGER:    // SQLValue and JS don't represent integers, so use FLOAT -case
+    switch (sqlite3_column_type(m_statement, col)) {
+        case SQLITE_INTEGER:
+            return SQLValue(static_cast<int64_t>(sqlite3_column_int64(m_statement, col)));
         case SQLITE_FLOAT:
-            return SQLValue(sqlite3_value_double(value));
-        case SQLITE_BLOB:       // SQLValue and JS don't represent blobs, so use TEXT -case
+            return SQLValue(sqlite3_column_double(m_statement, col));
+        case SQLITE_BLOB: {
+            const char* blob = static_cast<const char*>(sqlite3_column_blob(m_statement, col));
+            return SQLValue::borrowedBlob(std::string_view(blob, blob ? sqlite3_column_bytes(m_statement, col) : 0));
+        }
         case SQLITE_TEXT: {
-            const UChar* string = reinterpret_cast<const UChar*>(sqlite3_value_text16(value));
-            return SQLValue(std::string(string));
+            const char* string = reinterpret_cast<const char*>(sqlite3_column_text(m_statement, col));
+            return SQLValue::borrowedText(std::string_view(string, string ? sqlite3_column_bytes(m_statement, col) : 0));
         }
         case SQLITE_NULL:
             return SQLValue();
@@ -418,7 +703,12 @@ std::string SQLiteStatement::getColumnText(int col)
             return std::string();
     if (columnCount() <= col)
         return std::string();
-    return std::string(reinterpret_cast<const UChar*>(sqlite3_column_text16(m_statement, col)), sqlite3_column_bytes16(m_statement, col) / sizeof(UChar));
+    // Call sqlite3_column_text() before sqlite3_column_bytes() so the byte
+    // count refers to the UTF-8 representation.
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(m_statement, col));
+    if (!text)
+        return std::string();
+    return std::string(text, sqlite3_column_bytes(m_statement, col));
 }
 
 double SQLiteStatement::getColumnDouble(int col)
@@ -472,8 +762,7 @@ std::string SQLiteStatement::getColumnBlobAsString(int col)
     if (size < 0)
         return std::string();
 
-    ASSERT(!(size % sizeof(UChar)));
-    return std::string(static_cast<const UChar*>(blob), size / sizeof(UChar));
+    return std::string(static_cast<const char*>(blob), size);
 }
 
 void SQLiteStatement::getColumnBlobAsVector(int col, std::vector<char>& result)
@@ -497,9 +786,7 @@ void SQLiteStatement::getColumnBlobAsVector(int col, std::vector<char>& result)
     }
 
     int size = sqlite3_column_bytes(m_statement, col);
-    result.resize((size_t)size);
-    for (int i = 0; i < size; ++i)
-        result[i] = (static_cast<const unsigned char*>(blob))[i];
+    result.assign(static_cast<const char*>(blob), static_cast<const char*>(blob) + size);
 }
 
 const void* SQLiteStatement::getColumnBlob(int col, int& size)
@@ -508,16 +795,8 @@ const void* SQLiteStatement::getColumnBlob(int col, int& size)
 
     size = 0;
 
-    if (finalize() != SQLITE_OK)
-        DLOG(INFO) << "Finalize failed";
-    if (prepare() != SQLITE_OK) {
-        DLOG(INFO) << "Prepare failed";
-        return 0;
-    }
-    if (step() != SQLITE_ROW) {
-        DLOG(INFO) << "Step wasn't a row";
+    if (!m_statement && prepareAndStep() != SQLITE_ROW)
         return 0;
-    }
 
     if (columnCount() <= col)
         return 0;
@@ -530,6 +809,71 @@ const void* SQLiteStatement::getColumnBlob(int col, int& size)
     return blob;
 }
 
+SQLiteColumnView SQLiteStatement::columnTextView(int col)
+{
+    ASSERT(col >= 0);
+
+    if (!m_statement && prepareAndStep() != SQLITE_ROW)
+        return SQLiteColumnView();
+
+    if (columnCount() <= col)
+        return SQLiteColumnView();
+
+    // Call sqlite3_column_text() before sqlite3_column_bytes() so the byte
+    // count refers to the UTF-8 representation.
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(m_statement, col));
+    if (!text)
+        return SQLiteColumnView(this, 0, 0);
+    return SQLiteColumnView(this, text, sqlite3_column_bytes(m_statement, col));
+}
+
+SQLiteColumnView SQLiteStatement::columnBlobSpan(int col)
+{
+    ASSERT(col >= 0);
+
+    if (!m_statement && prepareAndStep() != SQLITE_ROW)
+        return SQLiteColumnView();
+
+    if (columnCount() <= col)
+        return SQLiteColumnView();
+
+    const char* blob = static_cast<const char*>(sqlite3_column_blob(m_statement, col));
+    if (!blob)
+        return SQLiteColumnView(this, 0, 0);
+    return SQLiteColumnView(this, blob, sqlite3_column_bytes(m_statement, col));
+}
+
+int SQLiteStatement::declaredColumnCount() const
+{
+    return m_statement ? sqlite3_column_count(m_statement) : 0;
+}
+
+bool SQLiteStatement::readColumnIsNull(int col) const
+{
+    return sqlite3_column_type(m_statement, col) == SQLITE_NULL;
+}
+
+int SQLiteStatement::readColumnInt(int col) const
+{
+    return sqlite3_column_int(m_statement, col);
+}
+
+int64_t SQLiteStatement::readColumnInt64(int col) const
+{
+    return sqlite3_column_int64(m_statement, col);
+}
+
+double SQLiteStatement::readColumnDouble(int col) const
+{
+    return sqlite3_column_double(m_statement, col);
+}
+
+SQLiteColumnView SQLiteStatement::readColumnText(int col) const
+{
+    const char* text = reinterpret_cast<const char*>(sqlite3_column_text(m_statement, col));
+    return SQLiteColumnView(this, text, text ? sqlite3_column_bytes(m_statement, col) : 0);
+}
+
 bool SQLiteStatement::returnTextResults(int col, std::vector<std::string>& v)
 {
     ASSERT(col >= 0);
@@ -546,7 +890,7 @@ bool SQLiteStatement::returnTextResults(int col, std::vector<std::string>& v)
     bool result = true;
     if (m_database.lastError() != SQLITE_DONE) {
         result = false;
-        DLOG(INFO) << "Error reading results from database query " << m_query.data();
+        SQLITE_LOG(INFO) << "Error reading results from database query " << m_query.data();
     }
     finalize();
     return result;
@@ -566,7 +910,7 @@ bool SQLiteStatement::returnIntResults(int col, std::vector<int>& v)
     bool result = true;
     if (m_database.lastError() != SQLITE_DONE) {
         result = false;
-        DLOG(INFO) << "Error reading results from database query " << m_query.data();
+        SQLITE_LOG(INFO) << "Error reading results from database query " << m_query.data();
     }
     finalize();
     return result;
@@ -586,7 +930,7 @@ bool SQLiteStatement::returnInt64Results(int col, std::vector<int64_t>& v)
     bool result = true;
     if (m_database.lastError() != SQLITE_DONE) {
         result = false;
-        DLOG(INFO) << "Error reading results from database query " << m_query.data();
+        SQLITE_LOG(INFO) << "Error reading results from database query " << m_query.data();
     }
     finalize();
     return result;
@@ -606,14 +950,198 @@ bool SQLiteStatement::returnDoubleResults(int col, std::vector<double>& v)
     bool result = true;
     if (m_database.lastError() != SQLITE_DONE) {
         result = false;
-        DLOG(INFO) << "Error reading results from database query " << m_query.data();
+        SQLITE_LOG(INFO) << "Error reading results from database query " << m_query.data();
     }
     finalize();
     return result;
 }
 
+bool SQLiteStatement::returnColumnarResults(SQLiteColumnarResult& columns, size_t expectedRows)
+{
+    columns.clear();
+
+    if (!m_statement && prepare() != SQLITE_OK)
+        return false;
+
+    int error = step();
+    columns.setUpColumns(m_statement, error == SQLITE_ROW, expectedRows);
+    while (error == SQLITE_ROW) {
+        columns.appendRow(m_statement);
+        error = step();
+    }
+
+    bool result = true;
+    if (error != SQLITE_DONE) {
+        result = false;
+        SQLITE_LOG(INFO) << "Error reading results from database query " << m_query.data();
+    }
+    reset();
+    return result;
+}
+
+static SQLiteStatement::StreamControl deliverChunk(const SQLiteColumnarResult& chunk, const SQLiteStatement::ChunkConsumer& consume, SQLiteStatement::StreamStatistics* statistics)
+{
+    if (statistics) {
+        statistics->rows += chunk.rowCount();
+        ++statistics->chunks;
+        statistics->peakChunkBytes = std::max(statistics->peakChunkBytes, chunk.byteSize());
+        statistics->peakAllocatedBytes = std::max(statistics->peakAllocatedBytes, chunk.allocatedBytes());
+    }
+    return consume(chunk);
+}
+
+int SQLiteStatement::streamResults(SQLiteColumnarResult& chunk, const ChunkConsumer& consume, size_t maxRows, size_t maxBytes, StreamStatistics* statistics)
+{
+    if (!m_statement) {
+        chunk.clear();
+        int error = prepare();
+        if (error != SQLITE_OK)
+            return error;
+    }
+    chunk.clearRows();
+
+    int error;
+    while ((error = step()) == SQLITE_ROW) {
+        if (!chunk.columnCount())
+            chunk.setUpColumns(m_statement, true, maxRows);
+        chunk.appendRow(m_statement);
+
+        if ((maxRows && chunk.rowCount() >= maxRows) || (maxBytes && chunk.byteSize() >= maxBytes)) {
+            StreamControl control = deliverChunk(chunk, consume, statistics);
+            chunk.clearRows();
+            if (control == StreamPause)
+                return SQLITE_ROW;
+            if (control == StreamCancel) {
+                reset();
+                return SQLITE_INTERRUPT;
+            }
+        }
+    }
+
+    if (error != SQLITE_DONE) {
+        SQLITE_LOG(INFO) << "Error reading results from database query " << m_query.data();
+        return error;
+    }
+
+    if (chunk.rowCount()) {
+        StreamControl control = deliverChunk(chunk, consume, statistics);
+        chunk.clearRows();
+        if (control == StreamCancel) {
+            reset();
+            return SQLITE_INTERRUPT;
+        }
+    }
+    return SQLITE_DONE;
+}
+
 bool SQLiteStatement::isExpired()
 {
     return !m_statement || sqlite3_expired(m_statement);
 }
 
+
+SQLiteColumnView::SQLiteColumnView(const SQLiteStatement* statement, const char* data, size_t size)
+    : m_view(data, size)
+#ifndef NDEBUG
+    , m_statementRowGeneration(statement->m_rowGeneration)
+    , m_rowGeneration(*statement->m_rowGeneration)
+#endif
+{
+}
+
+#ifndef NDEBUG
+void SQLiteColumnView::checkRow() const
+{
+    DCHECK(!m_statementRowGeneration || *m_statementRowGeneration == m_rowGeneration)
+        << "Column view used after its row was stepped, reset or finalized";
+}
+#endif
+
+SQLiteLockedCursor::SQLiteLockedCursor(SQLiteStatement& statement)
+    : m_statement(statement)
+    , m_prepareResult(SQLITE_OK)
+    , m_isReadOnly(false)
+{
+    // prepare() takes the connection lock itself.
+    if (!m_statement.m_statement)
+        m_prepareResult = m_statement.prepare();
+
+    m_lock = std::unique_lock<std::mutex>(m_statement.m_database.databaseMutex());
+    m_statement.m_isLockedByCursor = true;
+    m_isReadOnly = m_statement.m_statement && sqlite3_stmt_readonly(m_statement.m_statement);
+}
+
+SQLiteLockedCursor::~SQLiteLockedCursor()
+{
+    release();
+}
+
+int SQLiteLockedCursor::step()
+{
+    if (m_prepareResult != SQLITE_OK)
+        return m_prepareResult;
+    if (!m_lock.owns_lock())
+        return SQLITE_MISUSE;
+    if (m_statement.m_database.isInterruptRequested()) {
+        // Let interrupt(), which waits for the lock, return.
+        release();
+        return SQLITE_INTERRUPT;
+    }
+    if (!m_statement.m_statement)
+        return SQLITE_OK;
+
+    // The lock was taken once for the cursor, so no lock wait is recorded.
+    SQLiteRunTimer timer(m_statement);
+    int error = m_statement.stepTimed(timer, !m_isReadOnly);
+    if (error == SQLITE_INTERRUPT)
+        release();
+    return error;
+}
+
+void SQLiteLockedCursor::release()
+{
+    if (!m_lock.owns_lock())
+        return;
+    m_statement.m_isLockedByCursor = false;
+    m_lock.unlock();
+}
+
+SQLiteStatement::StatementStatus SQLiteStatement::StatementStatus::since(const StatementStatus& earlier) const
+{
+    StatementStatus difference(*this);
+    difference.fullScanSteps -= earlier.fullScanSteps;
+    difference.sorts -= earlier.sorts;
+    difference.autoIndexes -= earlier.autoIndexes;
+    difference.vmSteps -= earlier.vmSteps;
+    difference.reprepares -= earlier.reprepares;
+    difference.runs -= earlier.runs;
+    return difference;
+}
+
+SQLiteStatement::StatementStatus SQLiteStatement::statementStatus(bool resetCounters)
+{
+    return statementStatus(m_statement, resetCounters);
+}
+
+SQLiteStatement::StatementStatus SQLiteStatement::statementStatus(sqlite3_stmt* statement, bool resetCounters)
+{
+    StatementStatus status;
+    if (!statement)
+        return status;
+
+    int reset = resetCounters ? 1 : 0;
+    status.fullScanSteps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, reset);
+    status.sorts = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_SORT, reset);
+    status.autoIndexes = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_AUTOINDEX, reset);
+    status.vmSteps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_VM_STEP, reset);
+    status.reprepares = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_REPREPARE, reset);
+    status.runs = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_RUN, reset);
+    status.memoryUsed = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_MEMUSED, 0);
+    return status;
+}
+
+int SQLiteStatement::queryPlan(SQLiteQueryPlan& plan)
+{
+    std::unique_lock<std::mutex> lock = lockDatabase();
+    return SQLiteQueryPlan::explain(m_database.sqlite3Handle(), m_query, plan);
+}
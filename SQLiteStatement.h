@@ -28,12 +28,67 @@
 
 #include "SQLiteDatabase.h"
 
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 struct sqlite3_stmt;
 
 class SQLValue;
+class SQLiteColumnarResult;
+class SQLiteQueryPlan;
+class SQLiteRetryPolicy;
+class SQLiteRunTimer;
+class SQLiteStatement;
+
+template<typename T> struct SQLiteColumnReader;
+template<typename... Columns> class SQLiteRowRange;
+
+// A borrowed view of a text or blob column. It points into memory owned by
+// SQLite and is only valid until the next step(), reset() or finalize() of
+// the statement that produced it. Debug builds check this on every access,
+// through a row counter the view shares with the statement, so a view that
+// outlives its statement is caught too.
+class SQLiteColumnView {
+public:
+    SQLiteColumnView()
+#ifndef NDEBUG
+        : m_rowGeneration(0)
+#endif
+    {
+    }
+
+    const char* data() const { checkRow(); return m_view.data(); }
+    size_t size() const { checkRow(); return m_view.size(); }
+    bool empty() const { checkRow(); return m_view.empty(); }
+
+    std::string_view view() const { checkRow(); return m_view; }
+    operator std::string_view() const { return view(); }
+    std::string toString() const { return std::string(view()); }
+
+private:
+    friend class SQLiteStatement;
+    SQLiteColumnView(const SQLiteStatement*, const char* data, size_t size);
+
+#ifndef NDEBUG
+    void checkRow() const;
+#else
+    void checkRow() const { }
+#endif
+
+    std::string_view m_view;
+#ifndef NDEBUG
+    std::shared_ptr<const unsigned> m_statementRowGeneration;
+    unsigned m_rowGeneration;
+#endif
+};
 
 class SQLiteStatement {
 private:
@@ -43,18 +98,78 @@ public:
     SQLiteStatement(SQLiteDatabase&, const std::string&);
     ~SQLiteStatement();
 
+    // How SQLite treats the memory of a bound blob or text.
+    // BindCopy - SQLite makes a private copy before the bind call returns.
+    // BindBorrow - SQLite reads the caller's memory directly. The caller must keep
+    //              it alive and unchanged until the parameter is bound again or the
+    //              statement is finalized.
+    enum BindLifetime { BindCopy, BindBorrow };
+
     int prepare();
-    int bindBlob(int index, const void* blob, int size);
-    int bindBlob(int index, const std::string&);
-    int bindText(int index, const std::string&);
+    int bindBlob(int index, const void* blob, int size, BindLifetime = BindCopy);
+    int bindBlob(int index, std::string_view, BindLifetime = BindCopy);
+    int bindText(int index, std::string_view, BindLifetime = BindCopy);
+
+    // Binds a buffer without copying it by taking ownership of it. Strings and
+    // vectors are kept alive by the statement until the parameter is bound again
+    // or the statement is finalized; arrays are handed to SQLite, which deletes
+    // them when it is done with them.
+    int bindAdoptedBlob(int index, std::vector<char>&&);
+    int bindAdoptedBlob(int index, std::string&&);
+    int bindAdoptedBlob(int index, std::unique_ptr<char[]>, int size);
+    int bindAdoptedText(int index, std::string&&);
     int bindInt(int index, int);
     int bindInt64(int index, int64_t);
     int bindDouble(int index, double);
     int bindNull(int index);
+    // Binds a zero-filled blob of size bytes without allocating it, to be
+    // filled in later through SQLiteBlobStream.
+    int bindZeroBlob(int index, int64_t size);
     int bindValue(int index, const SQLValue&);
     unsigned bindParameterCount() const;
 
+    // Returns the index of a named parameter such as ":name", or 0 if there is
+    // none. Names are resolved once per prepared statement.
+    int bindParameterIndex(std::string_view name);
+
+    // Overloads picked by value type, for bindAll() and named binding. Every
+    // integral type binds as a 64-bit integer; unsigned values above
+    // INT64_MAX wrap.
+    template<typename Integer, std::enable_if_t<std::is_integral<Integer>::value, int> = 0>
+    int bind(int index, Integer value) { return bindInt64(index, static_cast<int64_t>(value)); }
+    int bind(int index, double value) { return bindDouble(index, value); }
+    int bind(int index, std::string_view value) { return bindText(index, value); }
+    int bind(int index, const std::string& value) { return bindText(index, value); }
+    int bind(int index, const char* value) { return bindText(index, value); }
+    int bind(int index, std::nullptr_t) { return bindNull(index); }
+    int bind(int index, const SQLValue& value) { return bindValue(index, value); }
+
+    template<typename T>
+    int bind(std::string_view name, const T& value)
+    {
+        int index = bindParameterIndex(name);
+        if (!index)
+            return SQLResultRange;
+        return bind(index, value);
+    }
+
+    // Binds the arguments to parameters 1, 2, ... in order and stops at the
+    // first error. Returns SQLResultRange if the number of arguments does
+    // not match the statement; SQLiteCheckedStatement checks that at compile
+    // time instead.
+    template<typename... Arguments>
+    int bindAll(const Arguments&... arguments)
+    {
+        if (sizeof...(Arguments) != bindParameterCount())
+            return SQLResultRange;
+        return bindInOrder(arguments...);
+    }
+
     int step();
+    // Retries while the database is busy, if the statement runs in autocommit
+    // mode. Inside a transaction SQLITE_BUSY is returned at once, as only
+    // retrying the whole transaction can resolve it.
+    int step(SQLiteRetryPolicy&, const char* callSite);
     int finalize();
     int reset();
 
@@ -88,22 +203,405 @@ public:
     std::string getColumnBlobAsString(int col);
     void getColumnBlobAsVector(int col, std::vector<char>&);
 
+    // Borrowed accessors that do not copy the column value. See SQLiteColumnView
+    // for how long the returned view stays valid.
+    SQLiteColumnView columnTextView(int col);
+    SQLiteColumnView columnBlobSpan(int col);
+    // Like getColumnValue, but text and blob values borrow the column's memory
+    // instead of copying it, with the same lifetime as SQLiteColumnView.
+    SQLValue columnValueView(int col);
+
+    // Steps through the remaining result rows, decoding each one into a
+    // std::tuple<Columns...>:
+    //
+    //   for (auto [id, name, weight] : statement.rows<int64_t, std::string_view, std::optional<double>>())
+    //
+    // Supported column types are int, int64_t, double, std::string,
+    // std::string_view, SQLiteColumnView and std::optional of any of them,
+    // which is empty for NULL. Views are only valid until the next row.
+    // The statement is prepared if needed and the column count is checked
+    // once, before the first row is decoded.
+    template<typename... Columns>
+    SQLiteRowRange<Columns...> rows() { return SQLiteRowRange<Columns...>(*this); }
+
     bool returnTextResults(int col, std::vector<std::string>&);
     bool returnIntResults(int col, std::vector<int>&);
     bool returnInt64Results(int col, std::vector<int64_t>&);
     bool returnDoubleResults(int col, std::vector<double>&);
 
+    // Reads every column of every row into a column-oriented result in one
+    // pass. expectedRows, if known, sizes the column buffers up front.
+    // The statement is prepared if needed and stepped as it is, so values
+    // bound beforehand apply; it is reset afterwards, keeping its bindings.
+    bool returnColumnarResults(SQLiteColumnarResult&, size_t expectedRows = 0);
+
+    // Streams the result set to a consumer in chunks of at most maxRows rows,
+    // or of roughly maxBytes bytes of column data (a chunk is handed over as
+    // soon as it reaches maxBytes). Either limit may be 0 for no limit. The
+    // chunk is the caller's and is reused for every delivery, so memory use
+    // is bounded by the largest chunk rather than by the result set.
+    //
+    // The consumer returns StreamContinue for more, StreamPause to return
+    // SQLResultRow and resume on the next call with the same chunk, or
+    // StreamCancel to reset the statement and return SQLResultInterrupt.
+    // Returns SQLResultDone once every row has been delivered. Parameters
+    // bound before the first call are kept.
+    enum StreamControl { StreamContinue, StreamPause, StreamCancel };
+    typedef std::function<StreamControl(const SQLiteColumnarResult&)> ChunkConsumer;
+
+    struct StreamStatistics {
+        StreamStatistics() : rows(0), chunks(0), peakChunkBytes(0), peakAllocatedBytes(0) { }
+
+        uint64_t rows;
+        uint64_t chunks;
+        size_t peakChunkBytes;
+        size_t peakAllocatedBytes;
+    };
+
+    int streamResults(SQLiteColumnarResult& chunk, const ChunkConsumer&, size_t maxRows, size_t maxBytes = 0, StreamStatistics* = 0);
+
+    // Runs EXPLAIN QUERY PLAN for this statement's SQL. The statement does not
+    // have to be prepared.
+    int queryPlan(SQLiteQueryPlan&);
+
+    // SQLite's sqlite3_stmt_status counters for this statement.
+    struct StatementStatus {
+        StatementStatus() : fullScanSteps(0), sorts(0), autoIndexes(0), vmSteps(0), reprepares(0), runs(0), memoryUsed(0) { }
+
+        // Rows stepped through by full table scans.
+        int fullScanSteps;
+        int sorts;
+        // Rows inserted into automatic indexes built for this statement.
+        int autoIndexes;
+        int vmSteps;
+        int reprepares;
+        int runs;
+        int memoryUsed;
+
+        // The counters accumulated since an earlier snapshot of the same handle.
+        StatementStatus since(const StatementStatus& earlier) const;
+    };
+
+    // Counters accumulate over every run of the statement, including runs
+    // through other SQLiteStatement objects sharing the cached handle. Resetting
+    // zeroes them (memoryUsed is not a counter and is never reset).
+    StatementStatus statementStatus(bool resetCounters = false);
+    static StatementStatus statementStatus(sqlite3_stmt*, bool resetCounters = false);
+
     SQLiteDatabase* database() { return &m_database; }
 
     const std::string& query() const { return m_query; }
 
+protected:
+    template<typename... Arguments>
+    int bindInOrder(const Arguments&... arguments)
+    {
+        int index = 0;
+        int result = SQLResultOk;
+        ((result = result == SQLResultOk ? bind(++index, arguments) : result), ...);
+        return result;
+    }
+
 private:
+    friend class SQLiteColumnView;
+    template<typename T> friend struct SQLiteColumnReader;
+    template<typename... Columns> friend class SQLiteRowRange;
+    friend class SQLiteLockedCursor;
+    friend class SQLiteRunTimer;
+
+    // step() without taking the connection lock or checking for interruption;
+    // the caller has done both.
+    int stepLocked(bool updateChangesCount);
+    // stepLocked() feeding the slow query log's run timing.
+    int stepTimed(SQLiteRunTimer&, bool updateChangesCount);
+    // Takes the connection lock, unless a SQLiteLockedCursor on this statement
+    // holds it already, in which case the returned lock is empty.
+    std::unique_lock<std::mutex> lockDatabase();
+    // Snapshots the statement counters at the start of a timed run, as a
+    // cached handle carries them over from earlier runs. The caller holds the
+    // connection lock.
+    void startRun();
+    // Hands the run just finished to the slow query log if it took longer than
+    // the threshold. The caller holds the connection lock.
+    void finishRun();
+
+    // Column accessors for the typed row range, which has already checked
+    // that the statement is on a row with enough columns.
+    int declaredColumnCount() const;
+    bool readColumnIsNull(int col) const;
+    int readColumnInt(int col) const;
+    int64_t readColumnInt64(int col) const;
+    double readColumnDouble(int col) const;
+    SQLiteColumnView readColumnText(int col) const;
+
+    void adoptBinding(int index, std::shared_ptr<void>);
+    void releaseAdoptedBinding(int index)
+    {
+        if (static_cast<unsigned>(index) < m_adoptedBindings.size())
+            m_adoptedBindings[index].reset();
+    }
+
     SQLiteDatabase& m_database;
     std::string m_query;
     sqlite3_stmt* m_statement;
+    // True if m_statement is returned to the database's statement cache
+    // instead of being finalized.
+    bool m_isCacheable;
+    unsigned m_parameterCount;
+    std::vector<std::pair<std::string, int> > m_parameterIndexes;
+    // Time and rows of the current run, kept while the slow query log is on.
+    uint64_t m_runNanoseconds;
+    uint64_t m_runLockWaitNanoseconds;
+    uint64_t m_runRows;
+    bool m_runHasStartStatus;
+    StatementStatus m_runStartStatus;
+    bool m_isLockedByCursor;
+    // Buffers adopted by bindAdopted*, indexed by parameter index.
+    std::vector<std::shared_ptr<void> > m_adoptedBindings;
 #ifndef NDEBUG
     bool m_isPrepared;
+    // Bumped whenever the current row goes away, to catch stale column views.
+    // Shared with the views, which may outlive the statement.
+    std::shared_ptr<unsigned> m_rowGeneration;
 #endif
 };
 
+// Returns the number of host parameters in SQL text, the way
+// sqlite3_bind_parameter_count() does: "?" takes the next index, "?NNN"
+// index NNN, and ":name", "@name" and "$name" the next index the first time
+// a name is seen. Quoted strings, identifiers (including [bracketed] ones)
+// and comments are skipped. Returns -1 if the SQL has more distinct names
+// than sqliteMaxCheckedParameterNames.
+constexpr size_t sqliteMaxCheckedParameterNames = 64;
+
+constexpr bool sqliteIsParameterNameCharacter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_' || (c & 0x80);
+}
+
+constexpr bool sqliteParameterNamesEqual(const char* sql, size_t first, size_t second, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (sql[first + i] != sql[second + i])
+            return false;
+    }
+    return true;
+}
+
+constexpr int sqliteParameterCount(const char* sql)
+{
+    // Names found so far, as offsets and lengths into sql.
+    size_t nameStarts[sqliteMaxCheckedParameterNames] = { };
+    size_t nameLengths[sqliteMaxCheckedParameterNames] = { };
+    size_t nameCount = 0;
+
+    int count = 0;
+    size_t i = 0;
+    while (sql[i]) {
+        char c = sql[i];
+        if (c == '\'' || c == '"' || c == '`' || c == '[') {
+            char close = c == '[' ? ']' : c;
+            for (++i; sql[i] && sql[i] != close; ++i) { }
+            if (sql[i])
+                ++i;
+        } else if (c == '-' && sql[i + 1] == '-') {
+            while (sql[i] && sql[i] != '\n')
+                ++i;
+        } else if (c == '/' && sql[i + 1] == '*') {
+            for (i += 2; sql[i] && !(sql[i] == '*' && sql[i + 1] == '/'); ++i) { }
+            if (sql[i])
+                i += 2;
+        } else if (c == '?') {
+            int number = 0;
+            bool numbered = false;
+            for (++i; sql[i] >= '0' && sql[i] <= '9'; ++i) {
+                number = number * 10 + (sql[i] - '0');
+                numbered = true;
+            }
+            count = numbered ? (number > count ? number : count) : count + 1;
+        } else if ((c == ':' || c == '@' || c == '$') && sqliteIsParameterNameCharacter(sql[i + 1])) {
+            size_t start = i;
+            for (++i; sqliteIsParameterNameCharacter(sql[i]); ++i) { }
+            size_t length = i - start;
+            bool seen = false;
+            for (size_t name = 0; name < nameCount && !seen; ++name)
+                seen = nameLengths[name] == length && sqliteParameterNamesEqual(sql, nameStarts[name], start, length);
+            if (!seen) {
+                if (nameCount == sqliteMaxCheckedParameterNames)
+                    return -1;
+                nameStarts[nameCount] = start;
+                nameLengths[nameCount] = length;
+                ++nameCount;
+                ++count;
+            }
+        } else
+            ++i;
+    }
+    return count;
+}
+
+// A statement whose SQL is a string literal, so that bindAll() can check the
+// number of arguments at compile time. Create it with the
+// SQLITE_CHECKED_STATEMENT macro:
+//
+//   auto insert = SQLITE_CHECKED_STATEMENT(db, "INSERT INTO user (lastName, age) VALUES (?, ?)");
+//   insert.prepare();
+//   insert.bindAll(lastName, age);
+template<int ParameterCount>
+class SQLiteCheckedStatement : public SQLiteStatement {
+public:
+    SQLiteCheckedStatement(SQLiteDatabase& db, const char* sql) : SQLiteStatement(db, sql) { }
+
+    static_assert(ParameterCount >= 0, "too many distinct parameter names to check at compile time");
+
+    template<typename... Arguments>
+    int bindAll(const Arguments&... arguments)
+    {
+        static_assert(sizeof...(Arguments) == ParameterCount, "bindAll() argument count does not match the SQL parameters");
+        return bindInOrder(arguments...);
+    }
+};
+
+#define SQLITE_CHECKED_STATEMENT(db, sql) SQLiteCheckedStatement<sqliteParameterCount(sql)>(db, sql)
+
+template<> struct SQLiteColumnReader<int> {
+    static int read(const SQLiteStatement& statement, int col) { return statement.readColumnInt(col); }
+};
+
+template<> struct SQLiteColumnReader<int64_t> {
+    static int64_t read(const SQLiteStatement& statement, int col) { return statement.readColumnInt64(col); }
+};
+
+template<> struct SQLiteColumnReader<double> {
+    static double read(const SQLiteStatement& statement, int col) { return statement.readColumnDouble(col); }
+};
+
+template<> struct SQLiteColumnReader<SQLiteColumnView> {
+    static SQLiteColumnView read(const SQLiteStatement& statement, int col) { return statement.readColumnText(col); }
+};
+
+template<> struct SQLiteColumnReader<std::string_view> {
+    static std::string_view read(const SQLiteStatement& statement, int col) { return statement.readColumnText(col).view(); }
+};
+
+template<> struct SQLiteColumnReader<std::string> {
+    static std::string read(const SQLiteStatement& statement, int col) { return statement.readColumnText(col).toString(); }
+};
+
+template<typename T> struct SQLiteColumnReader<std::optional<T> > {
+    static std::optional<T> read(const SQLiteStatement& statement, int col)
+    {
+        if (statement.readColumnIsNull(col))
+            return std::nullopt;
+        return SQLiteColumnReader<T>::read(statement, col);
+    }
+};
+
+// The range returned by SQLiteStatement::rows(). Iterating it steps the
+// statement; result() holds the last step() result once iteration is over,
+// SQLResultDone if every row was read.
+template<typename... Columns>
+class SQLiteRowRange {
+public:
+    typedef std::tuple<Columns...> Row;
+
+    class iterator {
+    public:
+        iterator() : m_range(0) { }
+        explicit iterator(SQLiteRowRange* range) : m_range(range) { }
+
+        Row operator*() const { return m_range->currentRow(std::index_sequence_for<Columns...>()); }
+
+        iterator& operator++()
+        {
+            if (!m_range->stepToNextRow())
+                m_range = 0;
+            return *this;
+        }
+
+        bool operator==(const iterator& other) const { return m_range == other.m_range; }
+        bool operator!=(const iterator& other) const { return m_range != other.m_range; }
+
+    private:
+        SQLiteRowRange* m_range;
+    };
+
+    explicit SQLiteRowRange(SQLiteStatement& statement)
+        : m_statement(statement)
+        , m_result(SQLResultOk)
+    {
+    }
+
+    iterator begin()
+    {
+        if (!m_statement.m_statement && (m_result = m_statement.prepare()) != SQLResultOk)
+            return end();
+        if (m_statement.declaredColumnCount() < static_cast<int>(sizeof...(Columns))) {
+            m_result = SQLResultError;
+            return end();
+        }
+        return stepToNextRow() ? iterator(this) : end();
+    }
+
+    iterator end() { return iterator(); }
+
+    int result() const { return m_result; }
+
+private:
+    bool stepToNextRow()
+    {
+        m_result = m_statement.step();
+        return m_result == SQLResultRow;
+    }
+
+    template<size_t... Indexes>
+    Row currentRow(std::index_sequence<Indexes...>) const
+    {
+        return Row(SQLiteColumnReader<Columns>::read(m_statement, Indexes)...);
+    }
+
+    SQLiteStatement& m_statement;
+    int m_result;
+};
+
+// Steps a statement while holding the connection lock for as long as the
+// cursor exists, rather than taking it on every step() call. For read-only
+// statements (sqlite3_stmt_readonly) the per-row lastChanges() bookkeeping is
+// skipped as well. Steps are profiled and timed for the slow query log like
+// SQLiteStatement::step().
+//
+// Other calls on the cursor's own statement (getColumn*, reset(),
+// finalize(), queryPlan()) know the lock is held and do not take it again.
+// No other statement on the same connection may be stepped or prepared while
+// the cursor is alive, from this thread or any other; they would wait for
+// the lock.
+//
+// SQLiteDatabase::interrupt() waits for the connection lock, so it blocks
+// until the cursor's next step(), which then returns SQLResultInterrupt and
+// releases the lock. Keep the scope to the loop:
+//
+//   {
+//       SQLiteLockedCursor cursor(statement);
+//       while (cursor.step() == SQLResultRow)
+//           total += statement.getColumnInt64(0);
+//   }
+class SQLiteLockedCursor {
+public:
+    explicit SQLiteLockedCursor(SQLiteStatement&);
+    ~SQLiteLockedCursor();
+
+    int step();
+    // Releases the connection lock early; step() fails afterwards.
+    void release();
+
+    bool isReadOnly() const { return m_isReadOnly; }
+    SQLiteStatement& statement() { return m_statement; }
+
+private:
+    SQLiteStatement& m_statement;
+    std::unique_lock<std::mutex> m_lock;
+    int m_prepareResult;
+    bool m_isReadOnly;
+};
+
 #endif // SQLiteStatement_h
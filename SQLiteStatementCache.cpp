@@ -0,0 +1,143 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SQLiteStatementCache.h"
+
+#include <sqlite3.h>
+
+SQLiteStatementCache::SQLiteStatementCache(size_t capacity)
+    : m_capacity(capacity)
+    , m_nextUse(0)
+{
+}
+
+SQLiteStatementCache::~SQLiteStatementCache()
+{
+    clear();
+}
+
+sqlite3_stmt* SQLiteStatementCache::take(const std::string& sql)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    std::pair<EntryMap::iterator, EntryMap::iterator> range = m_entryMap.equal_range(sql);
+    if (range.first == range.second) {
+        ++m_statistics.misses;
+        return 0;
+    }
+
+    // The most recently used handle has the warmest caches, and leaving the
+    // others idle lets them age out of the cache.
+    EntryMap::iterator it = range.first;
+    for (EntryMap::iterator candidate = range.first; candidate != range.second; ++candidate) {
+        if (candidate->second->use > it->second->use)
+            it = candidate;
+    }
+
+    sqlite3_stmt* statement = it->second->statement;
+    m_entries.erase(it->second);
+    m_entryMap.erase(it);
+    ++m_statistics.hits;
+    return statement;
+}
+
+int SQLiteStatementCache::put(const std::string& sql, sqlite3_stmt* statement)
+{
+    if (!statement)
+        return SQLITE_OK;
+
+    int result = sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    if (!m_capacity) {
+        sqlite3_finalize(statement);
+        return result;
+    }
+
+    m_entries.push_front(Entry(sql, statement, m_nextUse++));
+    m_entryMap.insert(std::make_pair(sql, m_entries.begin()));
+    evictToCapacity();
+    return result;
+}
+
+void SQLiteStatementCache::clear()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    for (EntryList::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+        sqlite3_finalize(it->statement);
+    m_entries.clear();
+    m_entryMap.clear();
+}
+
+size_t SQLiteStatementCache::capacity() const
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_capacity;
+}
+
+void SQLiteStatementCache::setCapacity(size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    m_capacity = capacity;
+    evictToCapacity();
+}
+
+size_t SQLiteStatementCache::size()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_entries.size();
+}
+
+SQLiteStatementCache::Statistics SQLiteStatementCache::statistics()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return m_statistics;
+}
+
+void SQLiteStatementCache::resetStatistics()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_statistics = Statistics();
+}
+
+void SQLiteStatementCache::evictToCapacity()
+{
+    while (m_entries.size() > m_capacity) {
+        EntryList::iterator last = --m_entries.end();
+
+        std::pair<EntryMap::iterator, EntryMap::iterator> range = m_entryMap.equal_range(last->sql);
+        for (EntryMap::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == last) {
+                m_entryMap.erase(it);
+                break;
+            }
+        }
+
+        sqlite3_finalize(last->statement);
+        m_entries.erase(last);
+        ++m_statistics.evictions;
+    }
+}
@@ -0,0 +1,103 @@
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * ``AS IS'' AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED.  IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDERS OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SQLiteStatementCache_h
+#define SQLiteStatementCache_h
+
+#include <iostream>
+#include <list>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+
+struct sqlite3_stmt;
+
+// A least-recently-used cache of prepared statements, keyed by SQL text.
+//
+// Statements are leased: take() removes an idle handle from the cache and
+// hands it to the caller, put() resets it, clears its bindings and makes it
+// available again. A handle is therefore never shared by two SQLiteStatement
+// objects at the same time.
+//
+// put(), clear() and setCapacity() may finalize statements, so the owning
+// connection's lock must be held around them; SQLiteMetricsCollector walks
+// the connection's statements under that lock.
+class SQLiteStatementCache {
+private:
+    SQLiteStatementCache(const SQLiteStatementCache&);
+    SQLiteStatementCache& operator=(const SQLiteStatementCache&);
+public:
+    struct Statistics {
+        Statistics() : hits(0), misses(0), evictions(0) { }
+
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    explicit SQLiteStatementCache(size_t capacity);
+    ~SQLiteStatementCache();
+
+    // Returns the most recently returned idle statement for sql, or 0 on a
+    // miss.
+    sqlite3_stmt* take(const std::string& sql);
+
+    // Returns a leased statement to the cache. The statement is reset and its
+    // bindings cleared; the least recently used entry is finalized if the cache
+    // is over capacity. Returns the result of sqlite3_reset().
+    int put(const std::string& sql, sqlite3_stmt*);
+
+    // Finalizes every idle statement. Leased statements are not affected.
+    void clear();
+
+    size_t capacity() const;
+    void setCapacity(size_t);
+
+    size_t size();
+    Statistics statistics();
+    void resetStatistics();
+
+private:
+    struct Entry {
+        Entry(const std::string& s, sqlite3_stmt* st, uint64_t u) : sql(s), statement(st), use(u) { }
+
+        std::string sql;
+        sqlite3_stmt* statement;
+        // Orders the handles of one SQL text without walking the list.
+        uint64_t use;
+    };
+    typedef std::list<Entry> EntryList;
+    typedef std::unordered_multimap<std::string, EntryList::iterator> EntryMap;
+
+    void evictToCapacity();
+
+    mutable std::mutex m_lock;
+    size_t m_capacity;
+    uint64_t m_nextUse;
+    // Most recently used entries are at the front.
+    EntryList m_entries;
+    EntryMap m_entryMap;
+    Statistics m_statistics;
+};
+
+#endif // SQLiteStatementCache_h
@@ -26,6 +26,9 @@
 #include "SQLiteTransaction.h"
 
 #include "SQLiteDatabase.h"
+#include "SQLiteRetryPolicy.h"
+
+#include <sqlite3.h>
 
 #ifndef NDEBUG
 #define ASSERT(x)
@@ -43,6 +46,7 @@ SQLiteTransaction::SQLiteTransaction(SQLiteDatabase& db, bool readOnly)
     : m_db(db)
     , m_inProgress(false)
     , m_readOnly(readOnly)
+    , m_depth(0)
 {
 }
 
@@ -52,32 +56,94 @@ SQLiteTransaction::~SQLiteTransaction()
         rollback();
 }
 
+std::string SQLiteTransaction::savepointName() const
+{
+    return "SQLiteTransaction" + std::to_string(m_depth);
+}
+
+bool SQLiteTransaction::isStillOpen() const
+{
+    return m_db.m_transactionDepth > m_depth;
+}
+
 void SQLiteTransaction::begin()
 {
-    if (!m_inProgress) {
-        ASSERT(!m_db.m_transactionInProgress);
-        // Call BEGIN IMMEDIATE for a write transaction to acquire
-        // a RESERVED lock on the DB file. Otherwise, another write
-        // transaction (on another connection) could make changes
-        // to the same DB file before this transaction gets to execute
-        // any statements. If that happens, this transaction will fail.
-        // http://www.sqlite.org/lang_transaction.html
-        // http://www.sqlite.org/lockingv3.html#locking
-        if (m_readOnly)
-            m_inProgress = m_db.executeCommand("BEGIN");
-        else
-            m_inProgress = m_db.executeCommand("BEGIN IMMEDIATE");
-        m_db.m_transactionInProgress = m_inProgress;
+    if (m_inProgress)
+        return;
+
+    if (m_db.m_transactionDepth) {
+        // Nested inside a transaction that is already in progress; the read-only
+        // flag does not matter here, as the outer transaction took the locks.
+        m_depth = m_db.m_transactionDepth;
+        m_inProgress = m_db.executeCommand("SAVEPOINT " + savepointName());
+        if (m_inProgress)
+            ++m_db.m_transactionDepth;
+        return;
     }
+
+    ASSERT(!m_db.m_transactionInProgress);
+    m_depth = 0;
+    // Call BEGIN IMMEDIATE for a write transaction to acquire
+    // a RESERVED lock on the DB file. Otherwise, another write
+    // transaction (on another connection) could make changes
+    // to the same DB file before this transaction gets to execute
+    // any statements. If that happens, this transaction will fail.
+    // http://www.sqlite.org/lang_transaction.html
+    // http://www.sqlite.org/lockingv3.html#locking
+    if (m_readOnly)
+        m_inProgress = m_db.executeCommand("BEGIN");
+    else
+        m_inProgress = m_db.executeCommand("BEGIN IMMEDIATE");
+    m_db.m_transactionInProgress = m_inProgress;
+    m_db.m_transactionDepth = m_inProgress ? 1 : 0;
 }
 
 void SQLiteTransaction::commit()
 {
-    if (m_inProgress) {
-        ASSERT(m_db.m_transactionInProgress);
-        m_inProgress = !m_db.executeCommand("COMMIT");
-        m_db.m_transactionInProgress = m_inProgress;
+    if (!m_inProgress)
+        return;
+
+    if (m_depth) {
+        if (!isStillOpen()) {
+            m_inProgress = false;
+            return;
+        }
+        ASSERT(m_db.m_transactionDepth == m_depth + 1);
+        // RELEASE keeps the changes, which now belong to the enclosing transaction.
+        m_inProgress = !m_db.executeCommand("RELEASE " + savepointName());
+        if (!m_inProgress)
+            m_db.m_transactionDepth = m_depth;
+        return;
     }
+
+    ASSERT(m_db.m_transactionInProgress);
+    m_inProgress = !m_db.executeCommand("COMMIT");
+    m_db.m_transactionInProgress = m_inProgress;
+    if (!m_inProgress)
+        m_db.m_transactionDepth = 0;
+}
+
+void SQLiteTransaction::begin(SQLiteRetryPolicy& policy, const char* callSite)
+{
+    if (m_inProgress)
+        return;
+
+    policy.run(m_db, callSite, [this]() {
+        begin();
+        return m_inProgress ? SQLITE_OK : m_db.lastError();
+    });
+}
+
+void SQLiteTransaction::commit(SQLiteRetryPolicy& policy, const char* callSite)
+{
+    if (!m_inProgress)
+        return;
+
+    // A busy COMMIT leaves the transaction open, so it can be retried.
+    policy.run(m_db, callSite, [this]() {
+        commit();
+        return m_inProgress ? m_db.lastError() : SQLITE_OK;
+    });
 }
 
 void SQLiteTransaction::rollback()
@@ -86,20 +152,40 @@ void SQLiteTransaction::rollback()
     // because m_inProgress should always be set to false after a ROLLBACK, and
     // m_db.executeCommand("ROLLBACK") can sometimes harmlessly fail, thus returning
     // a non-zero/true result (http://www.sqlite.org/lang_transaction.html).
-    if (m_inProgress) {
-        ASSERT(m_db.m_transactionInProgress);
-        m_db.executeCommand("ROLLBACK");
-        m_inProgress = false;
-        m_db.m_transactionInProgress = false;
+    if (!m_inProgress)
+        return;
+
+    m_inProgress = false;
+    if (m_depth) {
+        if (!isStillOpen())
+            return;
+        // ROLLBACK TO leaves the savepoint on the stack, so release it as well.
+        m_db.executeCommand("ROLLBACK TO " + savepointName());
+        m_db.executeCommand("RELEASE " + savepointName());
+        m_db.m_transactionDepth = m_depth;
+        return;
     }
+
+    ASSERT(m_db.m_transactionInProgress);
+    m_db.executeCommand("ROLLBACK");
+    m_db.m_transactionInProgress = false;
+    m_db.m_transactionDepth = 0;
 }
 
 void SQLiteTransaction::stop()
 {
-    if (m_inProgress) {
-        m_inProgress = false;
-        m_db.m_transactionInProgress = false;
+    if (!m_inProgress)
+        return;
+
+    m_inProgress = false;
+    if (m_depth) {
+        if (isStillOpen())
+            m_db.m_transactionDepth = m_depth;
+        return;
     }
+
+    m_db.m_transactionInProgress = false;
+    m_db.m_transactionDepth = 0;
 }
 
 bool SQLiteTransaction::wasRolledBackBySqlite() const
@@ -27,9 +27,15 @@
 #define SQLiteTransaction_h
 
 #include <iostream>
+#include <string>
 
 class SQLiteDatabase;
+class SQLiteRetryPolicy;
 
+// A transaction begun while another one is in progress on the same
+// connection is nested inside it as a SAVEPOINT: committing it releases the
+// savepoint and rolling it back undoes only its own changes, leaving the
+// enclosing transaction open. Nested transactions must end innermost first.
 class SQLiteTransaction {
 private:
     SQLiteTransaction(const SQLiteTransaction&);
@@ -40,15 +46,26 @@ public:
 
     void begin();
     void commit();
+    // Retry BEGIN IMMEDIATE and COMMIT while the database is busy.
+    void begin(SQLiteRetryPolicy&, const char* callSite);
+    void commit(SQLiteRetryPolicy&, const char* callSite);
     void rollback();
     void stop();
 
     bool inProgress() const { return m_inProgress; }
     bool wasRolledBackBySqlite() const;
+    // True while this transaction is a savepoint inside another one.
+    bool isNested() const { return m_inProgress && m_depth > 0; }
 private:
+    std::string savepointName() const;
+    // False if an enclosing transaction already ended, taking this one with it.
+    bool isStillOpen() const;
+
     SQLiteDatabase& m_db;
     bool m_inProgress;
     bool m_readOnly;
+    // Number of transactions this one is nested in.
+    int m_depth;
 };
 
 #endif // SQLiteTransation_H
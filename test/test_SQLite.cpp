@@ -1,15 +1,28 @@
+#include "AsyncSQLiteDatabase.h"
 #include "DatabaseAuthorizer.h"
 #include "SQLValue.h"
 #include "SQLiteDatabase.h"
+#include "SQLiteLog.h"
+#include "SQLiteMetricsCollector.h"
+#include "SQLiteQueryPlan.h"
+#include "SQLiteRetryPolicy.h"
+#include "SQLiteSlowQueryLog.h"
 #include "SQLiteTransaction.h"
 #include "SQLiteStatement.h"
 #include "SQLiteFileSystem.h"
+#include "SQLiteBatchInserter.h"
+#include "SQLiteBlobStream.h"
+#include "SQLiteCheckpointer.h"
+#include "SQLiteColumnarResult.h"
+#include "SQLiteConnectionPool.h"
+#include "SQLiteGroupCommitQueue.h"
 
 #include <iostream>
 #include <fstream>
 #include <thread>
 #include <algorithm>
 #include <vector>
+#include <stdexcept>
 #include <cstdio>
 
 #include <time.h>
@@ -166,6 +179,1829 @@ TEST(SQLiteWrapperCPPWebkit, test_statement_step_sqlitedb)
     std::remove(filenameDB.c_str());
 }
 
+TEST(SQLiteWrapperCPPWebkit, test_statement_cache_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(sqliteDB->executeCommand(std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)")));
+
+    // The CREATE statement clears the cache, the first insert is a miss
+    // and all the following ones reuse the same prepared statement.
+    SQLiteStatementCache::Statistics before = sqliteDB->statementCacheStatistics();
+    for (int i = 0; i < 10; ++i) {
+        SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO user (lastName) VALUES (?)"));
+        ASSERT_EQ(insert.prepare(), SQLITE_OK);
+        ASSERT_EQ(insert.bindText(1, std::string("Lehmann")), SQLITE_OK);
+        ASSERT_EQ(insert.step(), SQLITE_DONE);
+    }
+    SQLiteStatementCache::Statistics after = sqliteDB->statementCacheStatistics();
+    ASSERT_EQ(after.misses - before.misses, 1u);
+    ASSERT_EQ(after.hits - before.hits, 9u);
+
+    // Bindings are cleared when a statement goes back to the cache.
+    SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO user (lastName) VALUES (?)"));
+    ASSERT_EQ(insert.prepare(), SQLITE_OK);
+    ASSERT_NE(insert.step(), SQLITE_DONE);
+    insert.finalize();
+
+    // A capacity of one evicts the least recently used statement.
+    sqliteDB->setStatementCacheCapacity(1);
+    before = sqliteDB->statementCacheStatistics();
+    ASSERT_TRUE(sqliteDB->returnsAtLeastOneResult(std::string("SELECT userID FROM user")));
+    ASSERT_TRUE(sqliteDB->returnsAtLeastOneResult(std::string("SELECT lastName FROM user")));
+    after = sqliteDB->statementCacheStatistics();
+    ASSERT_GE(after.evictions - before.evictions, 1u);
+
+    // Of several idle handles for the same SQL, the most recently returned
+    // one is taken.
+    {
+        SQLiteStatementCache cache(4);
+        const std::string sql("SELECT lastName FROM user");
+        sqlite3_stmt* first = 0;
+        sqlite3_stmt* second = 0;
+        ASSERT_EQ(sqlite3_prepare_v2(sqliteDB->sqlite3Handle(), sql.c_str(), -1, &first, 0), SQLITE_OK);
+        ASSERT_EQ(sqlite3_prepare_v2(sqliteDB->sqlite3Handle(), sql.c_str(), -1, &second, 0), SQLITE_OK);
+        cache.put(sql, first);
+        cache.put(sql, second);
+        ASSERT_EQ(cache.take(sql), second);
+        cache.put(sql, second);
+        ASSERT_EQ(cache.take(sql), second);
+        ASSERT_EQ(cache.take(sql), first);
+        cache.put(sql, second);
+        cache.put(sql, first);
+        ASSERT_EQ(cache.take(sql), first);
+        cache.put(sql, first);
+        ASSERT_EQ(cache.capacity(), 4u);
+    }
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_utf8_text_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, data BLOB)")).executeCommand());
+
+    // Non-ASCII text must survive a bind/read round trip unchanged.
+    const std::string lastName("M\xc3\xbcller-\xce\xb1\xce\xb2\xce\xb3");
+    SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO user (userID, lastName) VALUES (1, ?)"));
+    ASSERT_EQ(insert.prepare(), SQLITE_OK);
+    ASSERT_EQ(insert.bindText(1, lastName), SQLITE_OK);
+    ASSERT_EQ(insert.step(), SQLITE_DONE);
+    insert.finalize();
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT lastName, data FROM user WHERE userID = 1"));
+    ASSERT_EQ(select.prepare(), SQLITE_OK);
+    ASSERT_EQ(select.step(), SQLITE_ROW);
+    ASSERT_EQ(select.getColumnText(0), lastName);
+    ASSERT_EQ(select.getColumnValue(0).string(), lastName);
+    ASSERT_EQ(select.getColumnName(0), std::string("lastName"));
+    ASSERT_FALSE(select.isColumnDeclaredAsBlob(0));
+    ASSERT_TRUE(select.isColumnDeclaredAsBlob(1));
+    select.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_zero_copy_bind_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, data BLOB)")).executeCommand());
+
+    const std::string lastName("Lehmann");
+    std::vector<char> blob(1 << 20, 'x');
+
+    SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO user (userID, lastName, data) VALUES (?, ?, ?)"));
+    ASSERT_EQ(insert.prepare(), SQLITE_OK);
+
+    // Borrowed buffers are read in place.
+    ASSERT_EQ(insert.bindInt(1, 1), SQLITE_OK);
+    ASSERT_EQ(insert.bindText(2, lastName, SQLiteStatement::BindBorrow), SQLITE_OK);
+    ASSERT_EQ(insert.bindBlob(3, blob.data(), blob.size(), SQLiteStatement::BindBorrow), SQLITE_OK);
+    ASSERT_EQ(insert.step(), SQLITE_DONE);
+    ASSERT_EQ(insert.reset(), SQLITE_OK);
+
+    // Adopted buffers are owned by the statement or by SQLite.
+    ASSERT_EQ(insert.bindInt(1, 2), SQLITE_OK);
+    ASSERT_EQ(insert.bindAdoptedText(2, std::string("Burgdorf")), SQLITE_OK);
+    ASSERT_EQ(insert.bindAdoptedBlob(3, std::vector<char>(blob)), SQLITE_OK);
+    ASSERT_EQ(insert.step(), SQLITE_DONE);
+    ASSERT_EQ(insert.reset(), SQLITE_OK);
+
+    std::unique_ptr<char[]> array(new char[4]);
+    std::copy(blob.begin(), blob.begin() + 4, array.get());
+    ASSERT_EQ(insert.bindInt(1, 3), SQLITE_OK);
+    ASSERT_EQ(insert.bindAdoptedText(2, std::string("Lehmann")), SQLITE_OK);
+    ASSERT_EQ(insert.bindAdoptedBlob(3, std::move(array), 4), SQLITE_OK);
+    ASSERT_EQ(insert.step(), SQLITE_DONE);
+    insert.finalize();
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT lastName, data FROM user ORDER BY userID"));
+    ASSERT_EQ(select.prepare(), SQLITE_OK);
+    ASSERT_EQ(select.step(), SQLITE_ROW);
+    ASSERT_EQ(select.getColumnText(0), lastName);
+    ASSERT_EQ(select.getColumnBlobAsString(1), std::string(blob.begin(), blob.end()));
+    ASSERT_EQ(select.step(), SQLITE_ROW);
+    ASSERT_EQ(select.getColumnText(0), std::string("Burgdorf"));
+    ASSERT_EQ(select.getColumnBlobAsString(1), std::string(blob.begin(), blob.end()));
+    ASSERT_EQ(select.step(), SQLITE_ROW);
+    ASSERT_EQ(select.getColumnBlobAsString(1), std::string("xxxx"));
+    select.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_column_views_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, data BLOB)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, data) VALUES (1, 'Lehmann', x'00010203')")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, data) VALUES (2, 'Burgdorf', NULL)")).executeCommand());
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT lastName, data FROM user ORDER BY userID"));
+    ASSERT_EQ(select.prepare(), SQLITE_OK);
+    ASSERT_EQ(select.step(), SQLITE_ROW);
+
+    SQLiteColumnView lastName = select.columnTextView(0);
+    ASSERT_EQ(lastName.view(), std::string_view("Lehmann"));
+
+    SQLiteColumnView data = select.columnBlobSpan(1);
+    ASSERT_EQ(data.size(), 4u);
+    ASSERT_EQ(data.data()[3], 3);
+
+    // getColumnBlob reads the current row instead of re-running the query.
+    int size = 0;
+    ASSERT_TRUE(select.getColumnBlob(1, size));
+    ASSERT_EQ(size, 4);
+
+    ASSERT_EQ(select.step(), SQLITE_ROW);
+#ifndef NDEBUG
+    // The views above belong to the previous row.
+    ASSERT_DEATH(lastName.size(), "");
+#endif
+    ASSERT_EQ(select.columnTextView(0).view(), std::string_view("Burgdorf"));
+    ASSERT_TRUE(select.columnBlobSpan(1).empty());
+    ASSERT_FALSE(select.getColumnBlob(1, size));
+    ASSERT_EQ(size, 0);
+    select.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_batch_insert_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, age INTEGER)")).executeCommand());
+
+    // Rows from a generator, with a duplicate key every 100 rows.
+    SQLiteBatchInserter inserter(*sqliteDB, std::string("INSERT INTO user (userID, lastName, age) VALUES (?, ?, ?)"));
+    inserter.setRowsPerTransaction(1000);
+    std::vector<uint64_t> rejected;
+    inserter.setConstraintFailureHandler([&](uint64_t row, int) { rejected.push_back(row); });
+
+    int row = 0;
+    ASSERT_TRUE(inserter.insert([&](SQLiteStatement& statement, int firstParameter) {
+        if (row == 2500)
+            return false;
+        int userID = (row && !(row % 100)) ? row - 1 : row;
+        statement.bindInt(firstParameter, userID);
+        statement.bindText(firstParameter + 1, std::string("Lehmann"));
+        statement.bindInt(firstParameter + 2, row % 80);
+        ++row;
+        return true;
+    }));
+    ASSERT_EQ(inserter.statistics().rowsInserted, 2476u);
+    ASSERT_EQ(inserter.statistics().rowsRejected, 24u);
+    ASSERT_EQ(inserter.statistics().transactionsCommitted, 3u);
+    ASSERT_EQ(rejected.size(), 24u);
+    ASSERT_EQ(rejected[0], 100u);
+    ASSERT_FALSE(sqliteDB->transactionInProgress());
+
+    // Rejected rows do not count towards a transaction.
+    inserter.resetStatistics();
+    row = 0;
+    ASSERT_TRUE(inserter.insert([&](SQLiteStatement& statement, int firstParameter) {
+        if (row == 5)
+            return false;
+        statement.bindInt(firstParameter, row++);
+        statement.bindText(firstParameter + 1, std::string("Lehmann"));
+        statement.bindNull(firstParameter + 2);
+        return true;
+    }));
+    ASSERT_EQ(inserter.statistics().rowsInserted, 0u);
+    ASSERT_EQ(inserter.statistics().rowsRejected, 5u);
+    ASSERT_EQ(inserter.statistics().transactionsCommitted, 0u);
+
+    // Rows from an iterator, several rows per statement.
+    std::vector<std::pair<int, std::string> > users;
+    for (int i = 0; i < 1003; ++i)
+        users.push_back(std::make_pair(10000 + i, std::string("Burgdorf")));
+
+    SQLiteBatchInserter multiRowInserter(*sqliteDB, std::string("user"), std::vector<std::string>({ "userID", "lastName" }));
+    multiRowInserter.setRowsPerStatement(50);
+    ASSERT_TRUE(multiRowInserter.insert(users.begin(), users.end(), [](SQLiteStatement& statement, int firstParameter, const std::pair<int, std::string>& user) {
+        statement.bindInt(firstParameter, user.first);
+        statement.bindText(firstParameter + 1, user.second);
+    }));
+    ASSERT_EQ(multiRowInserter.statistics().rowsInserted, 1003u);
+
+    SQLiteStatement count(*sqliteDB, std::string("SELECT count(*) FROM user WHERE lastName = 'Burgdorf'"));
+    ASSERT_EQ(count.getColumnInt(0), 1003);
+    count.finalize();
+
+    // With a handler, a duplicate key rejects only its own row, not the rest
+    // of the group it would have been inserted with.
+    std::vector<std::pair<int, std::string> > moreUsers;
+    for (int i = 0; i < 10; ++i)
+        moreUsers.push_back(std::make_pair(20000 + i, std::string("Burgdorf")));
+    moreUsers[4].first = 10000;
+    rejected.clear();
+    multiRowInserter.setRowsPerStatement(10);
+    multiRowInserter.setConstraintFailureHandler([&](uint64_t row, int) { rejected.push_back(row); });
+    ASSERT_TRUE(multiRowInserter.insert(moreUsers.begin(), moreUsers.end(), [](SQLiteStatement& statement, int firstParameter, const std::pair<int, std::string>& user) {
+        statement.bindInt(firstParameter, user.first);
+        statement.bindText(firstParameter + 1, user.second);
+    }));
+    ASSERT_EQ(multiRowInserter.statistics().rowsInserted, 1012u);
+    ASSERT_EQ(multiRowInserter.statistics().rowsRejected, 1u);
+    ASSERT_EQ(rejected.size(), 1u);
+    ASSERT_EQ(rejected[0], 4u);
+    ASSERT_EQ(count.getColumnInt(0), 1012);
+    count.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_typed_rows_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, firstName VARCHAR(50), age INTEGER, weight DOUBLE)")).executeCommand());
+
+    // Populate the table created above
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, firstName, age, weight) VALUES (1, 'Lehmann', 'Jamie', 20, 65.5)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, firstName, age, weight) VALUES (2, 'Burgdorf', 'Peter', 55, NULL)")).executeCommand());
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT userID, lastName, weight, firstName FROM user ORDER BY userID"));
+    SQLiteRowRange<int64_t, std::string_view, std::optional<double>, std::string> rows = select.rows<int64_t, std::string_view, std::optional<double>, std::string>();
+    int count = 0;
+    for (auto [userID, lastName, weight, firstName] : rows) {
+        if (userID == 1) {
+            ASSERT_EQ(lastName, std::string_view("Lehmann"));
+            ASSERT_TRUE(weight.has_value());
+            ASSERT_DOUBLE_EQ(*weight, 65.5);
+            ASSERT_EQ(firstName, std::string("Jamie"));
+        } else {
+            ASSERT_EQ(lastName, std::string_view("Burgdorf"));
+            ASSERT_FALSE(weight.has_value());
+        }
+        ++count;
+    }
+    ASSERT_EQ(count, 2);
+    ASSERT_EQ(rows.result(), SQLITE_DONE);
+    select.finalize();
+
+    // Asking for more columns than the statement returns reads nothing.
+    SQLiteStatement tooFewColumns(*sqliteDB, std::string("SELECT userID FROM user"));
+    SQLiteRowRange<int, int> wideRows = tooFewColumns.rows<int, int>();
+    ASSERT_TRUE(wideRows.begin() == wideRows.end());
+    ASSERT_EQ(wideRows.result(), SQLITE_ERROR);
+    tooFewColumns.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_columnar_results_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, firstName VARCHAR(50), age INTEGER, weight DOUBLE)")).executeCommand());
+
+    // Populate the table created above
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, firstName, age, weight) VALUES (1, 'Lehmann', 'Jamie', 20, NULL)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, firstName, age, weight) VALUES (2, 'Burgdorf', 'Peter', 55, 80.1)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName, firstName, age, weight) VALUES (3, 'Lehmann', NULL, 18, 70.2)")).executeCommand());
+
+    SQLiteColumnarResult result;
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("SELECT userID, lastName, firstName, weight FROM user ORDER BY userID")).returnColumnarResults(result));
+    ASSERT_EQ(result.rowCount(), 3u);
+    ASSERT_EQ(result.columnCount(), 4u);
+
+    const SQLiteColumnarResult::Column& userID = result.column(0);
+    ASSERT_EQ(userID.name(), std::string("userID"));
+    ASSERT_EQ(userID.type(), SQLiteColumnarResult::IntegerColumn);
+    ASSERT_EQ(userID.integers()[2], 3);
+
+    const SQLiteColumnarResult::Column& lastName = result.column(1);
+    ASSERT_EQ(lastName.type(), SQLiteColumnarResult::TextColumn);
+    ASSERT_EQ(lastName.bytesAt(1), std::string_view("Burgdorf"));
+    ASSERT_EQ(lastName.offsets()[3], 22u);
+
+    const SQLiteColumnarResult::Column& firstName = result.column(2);
+    ASSERT_FALSE(firstName.isNull(0));
+    ASSERT_TRUE(firstName.isNull(2));
+
+    // The first weight is NULL, so the type comes from the declaration.
+    const SQLiteColumnarResult::Column& weight = result.column(3);
+    ASSERT_EQ(weight.type(), SQLiteColumnarResult::FloatColumn);
+    ASSERT_TRUE(weight.isNull(0));
+    ASSERT_EQ(weight.validityBitmap()[0], 6);
+    ASSERT_DOUBLE_EQ(weight.doubles()[2], 70.2);
+
+    // Values bound beforehand apply, and are kept for the next read.
+    SQLiteStatement adults(*sqliteDB, std::string("SELECT userID FROM user WHERE age > ? ORDER BY userID"));
+    ASSERT_EQ(adults.prepare(), SQLITE_OK);
+    ASSERT_EQ(adults.bindInt(1, 19), SQLITE_OK);
+    ASSERT_TRUE(adults.returnColumnarResults(result));
+    ASSERT_EQ(result.rowCount(), 2u);
+    ASSERT_EQ(result.column(0).integers()[1], 2);
+    ASSERT_TRUE(adults.returnColumnarResults(result));
+    ASSERT_EQ(result.rowCount(), 2u);
+
+    // A value the column type cannot hold widens the column.
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("VALUES (1, NULL, 2), (1.5, 7, 9007199254740993), (NULL, 'x', 0.5)")).returnColumnarResults(result));
+    ASSERT_EQ(result.rowCount(), 3u);
+
+    const SQLiteColumnarResult::Column& widened = result.column(0);
+    ASSERT_EQ(widened.type(), SQLiteColumnarResult::FloatColumn);
+    ASSERT_DOUBLE_EQ(widened.doubles()[0], 1.0);
+    ASSERT_DOUBLE_EQ(widened.doubles()[1], 1.5);
+    ASSERT_TRUE(widened.isNull(2));
+
+    const SQLiteColumnarResult::Column& mixed = result.column(1);
+    ASSERT_EQ(mixed.type(), SQLiteColumnarResult::TextColumn);
+    ASSERT_TRUE(mixed.isNull(0));
+    ASSERT_EQ(mixed.bytesAt(1), std::string_view("7"));
+    ASSERT_EQ(mixed.bytesAt(2), std::string_view("x"));
+
+    // 2^53 + 1 has no exact double, so the column falls back to text.
+    const SQLiteColumnarResult::Column& large = result.column(2);
+    ASSERT_EQ(large.type(), SQLiteColumnarResult::TextColumn);
+    ASSERT_EQ(large.bytesAt(1), std::string_view("9007199254740993"));
+    ASSERT_EQ(large.bytesAt(2), std::string_view("0.5"));
+    ASSERT_EQ(result.byteSize(), 3 * sizeof(double) + 3 * sizeof(uint64_t) + 2 + 3 * sizeof(uint64_t) + 1 + 16 + 3);
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_stream_results_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)")).executeCommand());
+
+    SQLiteBatchInserter inserter(*sqliteDB, std::string("INSERT INTO user (lastName) VALUES (?)"));
+    int row = 0;
+    ASSERT_TRUE(inserter.insert([&](SQLiteStatement& statement, int firstParameter) {
+        if (row++ == 1050)
+            return false;
+        statement.bindText(firstParameter, std::string("Lehmann"));
+        return true;
+    }));
+
+    // Chunks of at most 100 rows; pause after the third chunk and resume.
+    SQLiteStatement select(*sqliteDB, std::string("SELECT userID, lastName FROM user WHERE userID > ? ORDER BY userID"));
+    ASSERT_EQ(select.prepare(), SQLITE_OK);
+    ASSERT_EQ(select.bindInt(1, 50), SQLITE_OK);
+
+    SQLiteColumnarResult chunk;
+    SQLiteStatement::StreamStatistics statistics;
+    int64_t nextUserID = 51;
+    int chunks = 0;
+    SQLiteStatement::ChunkConsumer consume = [&](const SQLiteColumnarResult& result) {
+        EXPECT_LE(result.rowCount(), 100u);
+        for (size_t i = 0; i < result.rowCount(); ++i)
+            EXPECT_EQ(result.column(0).integers()[i], nextUserID++);
+        return ++chunks == 3 ? SQLiteStatement::StreamPause : SQLiteStatement::StreamContinue;
+    };
+    ASSERT_EQ(select.streamResults(chunk, consume, 100, 0, &statistics), SQLITE_ROW);
+    ASSERT_EQ(statistics.rows, 300u);
+    ASSERT_EQ(select.streamResults(chunk, consume, 100, 0, &statistics), SQLITE_DONE);
+    ASSERT_EQ(statistics.rows, 1000u);
+    ASSERT_EQ(statistics.chunks, 10u);
+    ASSERT_GT(statistics.peakAllocatedBytes, 0u);
+    select.finalize();
+
+    // A byte limit, and cancelling after the first chunk.
+    SQLiteStatement selectAll(*sqliteDB, std::string("SELECT lastName FROM user"));
+    statistics = SQLiteStatement::StreamStatistics();
+    ASSERT_EQ(selectAll.streamResults(chunk, [](const SQLiteColumnarResult&) { return SQLiteStatement::StreamCancel; }, 0, 64, &statistics), SQLITE_INTERRUPT);
+    ASSERT_EQ(statistics.chunks, 1u);
+    ASSERT_LT(statistics.rows, 10u);
+    selectAll.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_blob_stream_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table with two zero-filled blobs
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE media (mediaID INTEGER NOT NULL PRIMARY KEY, data BLOB)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO media (mediaID, data) VALUES (1, zeroblob(100000))")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO media (mediaID, data) VALUES (2, x'616263')")).executeCommand());
+
+    SQLiteBlobStream blob(*sqliteDB, 4096);
+    ASSERT_EQ(blob.open(std::string("media"), std::string("data"), 1, true), SQLITE_OK);
+    ASSERT_EQ(blob.size(), 100000);
+
+    // Positional writes and reads.
+    ASSERT_EQ(blob.write("Lehmann", 7, 50000), SQLITE_OK);
+    char buffer[8] = { 0 };
+    ASSERT_EQ(blob.read(buffer, 7, 50000), SQLITE_OK);
+    ASSERT_EQ(std::string(buffer), std::string("Lehmann"));
+    ASSERT_NE(blob.write("Lehmann", 7, 99999), SQLITE_OK);
+
+    // The same blob through iostreams.
+    std::iostream stream(&blob);
+    stream.seekp(99990);
+    stream << "Burgdorf";
+    ASSERT_TRUE(stream.good());
+    stream.seekg(50000);
+    std::string word;
+    stream >> word;
+    ASSERT_EQ(word.substr(0, 7), std::string("Lehmann"));
+    stream.seekg(-10, std::ios_base::end);
+    std::vector<char> tail(10);
+    stream.read(tail.data(), tail.size());
+    ASSERT_EQ(std::string(tail.data(), 8), std::string("Burgdorf"));
+    ASSERT_EQ(stream.gcount(), 10);
+
+    // Small writes are buffered; a positional read sees them, and flush()
+    // writes out the rest.
+    stream.seekp(0);
+    for (int i = 0; i < 10000; ++i)
+        stream << i % 10;
+    ASSERT_EQ(blob.read(buffer, 4, 4094), SQLITE_OK);
+    ASSERT_EQ(std::string(buffer, 4), std::string("4567"));
+    stream << "Lehmann";
+    stream.flush();
+    ASSERT_TRUE(stream.good());
+    std::vector<char> digits(10007);
+    ASSERT_EQ(blob.read(digits.data(), digits.size(), 0), SQLITE_OK);
+    for (int i = 0; i < 10000; ++i)
+        ASSERT_EQ(digits[i], '0' + i % 10);
+    ASSERT_EQ(std::string(digits.data() + 10000, 7), std::string("Lehmann"));
+
+    // Writes at the end of the blob fail once the buffer reaches it.
+    stream.seekp(-3, std::ios_base::end);
+    stream << "Burgdorf";
+    ASSERT_TRUE(stream.bad());
+    stream.clear();
+
+    // Move the handle to the other row.
+    ASSERT_EQ(blob.reopen(2), SQLITE_OK);
+    ASSERT_EQ(blob.size(), 3);
+    stream.clear();
+    stream.seekg(0);
+    stream >> word;
+    ASSERT_EQ(word, std::string("abc"));
+
+    // A failed reopen leaves the stream closed.
+    ASSERT_NE(blob.reopen(42), SQLITE_OK);
+    ASSERT_FALSE(blob.isOpen());
+    ASSERT_EQ(blob.reopen(2), SQLITE_MISUSE);
+    ASSERT_EQ(blob.close(), SQLITE_OK);
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_blob_file_ingest_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    const std::string filenameIn("testBlobIn.bin");
+    const std::string filenameOut("testBlobOut.bin");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE media (mediaID INTEGER NOT NULL PRIMARY KEY, name TEXT, data BLOB)")).executeCommand());
+
+    // A file that is not a whole number of pages.
+    std::string contents;
+    for (int i = 0; i < 300000; ++i)
+        contents += static_cast<char>(i * 7);
+    {
+        std::ofstream file(filenameIn.c_str(), std::ios::binary);
+        file.write(contents.data(), contents.size());
+    }
+
+    SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO media (name, data) VALUES (?, ?)"));
+    ASSERT_EQ(insert.prepare(), SQLITE_OK);
+    ASSERT_EQ(insert.bindText(1, filenameIn), SQLITE_OK);
+    int64_t rowID = 0;
+    ASSERT_EQ(SQLiteBlobStream::insertFile(insert, 2, std::string("media"), std::string("data"), filenameIn, &rowID), SQLITE_OK);
+    ASSERT_EQ(rowID, 1);
+    insert.finalize();
+    ASSERT_FALSE(sqliteDB->transactionInProgress());
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT data FROM media WHERE mediaID = 1"));
+    ASSERT_EQ(select.getColumnBlobAsString(0), contents);
+    select.finalize();
+
+    // And back out to a file.
+    SQLiteBlobStream blob(*sqliteDB);
+    ASSERT_EQ(blob.open(std::string("media"), std::string("data"), rowID), SQLITE_OK);
+    FILE* out = fopen(filenameOut.c_str(), "wb");
+    ASSERT_TRUE(out);
+    ASSERT_EQ(blob.readToFile(fileno(out)), SQLITE_OK);
+    fclose(out);
+    blob.close();
+
+    std::ifstream file(filenameOut.c_str(), std::ios::binary);
+    std::string copied((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    ASSERT_EQ(copied, contents);
+
+    // An ignored insert adds no row, so nothing is written, not even to
+    // the row of the previous insert.
+    {
+        std::ofstream other(filenameOut.c_str(), std::ios::binary | std::ios::trunc);
+        other << std::string(contents.size(), 'z');
+    }
+    SQLiteStatement ignored(*sqliteDB, std::string("INSERT OR IGNORE INTO media (mediaID, name, data) VALUES (1, ?, ?)"));
+    ASSERT_EQ(ignored.prepare(), SQLITE_OK);
+    ASSERT_EQ(ignored.bindText(1, filenameOut), SQLITE_OK);
+    ASSERT_EQ(SQLiteBlobStream::insertFile(ignored, 2, std::string("media"), std::string("data"), filenameOut), SQLITE_CONSTRAINT);
+    ignored.finalize();
+    ASSERT_FALSE(sqliteDB->transactionInProgress());
+    ASSERT_EQ(select.getColumnBlobAsString(0), contents);
+    select.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove files.
+    std::remove(filenameDB.c_str());
+    std::remove(filenameIn.c_str());
+    std::remove(filenameOut.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_named_bind_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, age INTEGER, weight DOUBLE)")).executeCommand());
+
+    static_assert(sqliteParameterCount("INSERT INTO user VALUES (?, ?, ?, ?)") == 4, "");
+    static_assert(sqliteParameterCount("SELECT ?3, '?', :a -- ?") == 4, "");
+    static_assert(sqliteParameterCount("SELECT :a, @b, :a, $c") == 3, "");
+    // Names inside strings, comments and [identifiers] are not parameters.
+    static_assert(sqliteParameterCount("SELECT ':id', :id") == 1, "");
+    static_assert(sqliteParameterCount("SELECT 1 -- by :id\n , :id") == 1, "");
+    static_assert(sqliteParameterCount("SELECT [a?b], ?") == 1, "");
+    const char* const countedSQL[] = { "SELECT ':id', :id", "SELECT 1 -- by :id\n , :id", "SELECT 1 AS [a?b], ?" };
+    for (size_t i = 0; i < sizeof(countedSQL) / sizeof(countedSQL[0]); ++i) {
+        SQLiteStatement counted(*sqliteDB, std::string(countedSQL[i]));
+        ASSERT_EQ(counted.prepare(), SQLResultOk);
+        ASSERT_EQ(static_cast<int>(counted.bindParameterCount()), sqliteParameterCount(countedSQL[i])) << countedSQL[i];
+    }
+
+    // Named parameters.
+    SQLiteStatement named(*sqliteDB, std::string("INSERT INTO user (userID, lastName, age, weight) VALUES (:id, :lastName, :age, :weight)"));
+    ASSERT_EQ(named.prepare(), SQLResultOk);
+    ASSERT_EQ(named.bindParameterCount(), 4u);
+    ASSERT_EQ(named.bindParameterIndex(":lastName"), 2);
+    ASSERT_EQ(named.bind(":id", 1), SQLResultOk);
+    ASSERT_EQ(named.bind(":lastName", "Lehmann"), SQLResultOk);
+    ASSERT_EQ(named.bind(":age", 20), SQLResultOk);
+    ASSERT_EQ(named.bind(":weight", 65.5), SQLResultOk);
+    ASSERT_EQ(named.bind(":height", 180), SQLResultRange);
+    ASSERT_EQ(named.step(), SQLResultDone);
+    named.finalize();
+
+    // Positional parameters, counted at run time.
+    SQLiteStatement positional(*sqliteDB, std::string("INSERT INTO user (userID, lastName, age, weight) VALUES (?, ?, ?, ?)"));
+    ASSERT_EQ(positional.prepare(), SQLResultOk);
+    ASSERT_EQ(positional.bindAll(2, std::string("Burgdorf")), SQLResultRange);
+    ASSERT_EQ(positional.bindAll(2, std::string("Burgdorf"), 55, nullptr), SQLResultOk);
+    // Any integral type binds, whatever its width or signedness.
+    ASSERT_EQ(positional.bindAll(2LL, std::string("Burgdorf"), sizeof(int64_t), nullptr), SQLResultOk);
+    ASSERT_EQ(positional.bind(3, static_cast<size_t>(55)), SQLResultOk);
+    ASSERT_EQ(positional.step(), SQLResultDone);
+    positional.finalize();
+
+    // Positional parameters, counted at compile time.
+    auto checked = SQLITE_CHECKED_STATEMENT(*sqliteDB, "INSERT INTO user (userID, lastName, age, weight) VALUES (?, ?, ?, ?)");
+    ASSERT_EQ(checked.prepare(), SQLResultOk);
+    ASSERT_EQ(checked.bindAll(int64_t(3), "Kowalski", 41, 80.0), SQLResultOk);
+    ASSERT_EQ(checked.step(), SQLResultDone);
+    checked.finalize();
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT lastName, weight, age FROM user WHERE userID = ?"));
+    ASSERT_EQ(select.prepare(), SQLResultOk);
+    ASSERT_EQ(select.bindAll(2u), SQLResultOk);
+    ASSERT_EQ(select.step(), SQLResultRow);
+    ASSERT_EQ(select.getColumnText(0), std::string("Burgdorf"));
+    ASSERT_EQ(select.getColumnValue(1).type(), SQLValue::NullValue);
+    ASSERT_EQ(select.getColumnInt(2), 55);
+    select.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_sql_value_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE value (id INTEGER, v)")).executeCommand());
+
+    const int64_t bigInteger = (int64_t(1) << 53) + 1;
+    const std::string longText(100, 'x');
+    const char blobData[] = { 'a', 0, 'b' };
+    std::vector<SQLValue> values;
+    values.push_back(SQLValue(bigInteger));
+    values.push_back(SQLValue(1.5));
+    values.push_back(SQLValue("short"));
+    values.push_back(SQLValue(longText));
+    values.push_back(SQLValue::blob(blobData, sizeof(blobData)));
+    values.push_back(SQLValue());
+
+    SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO value (id, v) VALUES (?, ?)"));
+    ASSERT_EQ(insert.prepare(), SQLResultOk);
+    for (size_t i = 0; i < values.size(); ++i) {
+        ASSERT_EQ(insert.bindAll(static_cast<int>(i), values[i]), SQLResultOk);
+        ASSERT_EQ(insert.step(), SQLResultDone);
+        insert.reset();
+    }
+    insert.finalize();
+
+    SQLiteStatement select(*sqliteDB, std::string("SELECT v FROM value ORDER BY id"));
+    ASSERT_EQ(select.prepare(), SQLResultOk);
+    std::vector<SQLValue> read;
+    while (select.step() == SQLResultRow) {
+        SQLValue view = select.columnValueView(0);
+        ASSERT_EQ(view.isBorrowed(), view.type() == SQLValue::StringValue || view.type() == SQLValue::BlobValue);
+        read.push_back(select.getColumnValue(0));
+    }
+    select.finalize();
+
+    ASSERT_EQ(read.size(), values.size());
+    ASSERT_EQ(read[0].type(), SQLValue::IntegerValue);
+    ASSERT_EQ(read[0].integer(), bigInteger);
+    ASSERT_EQ(read[1].type(), SQLValue::NumberValue);
+    ASSERT_DOUBLE_EQ(read[1].number(), 1.5);
+    ASSERT_EQ(read[2].type(), SQLValue::StringValue);
+    ASSERT_EQ(read[2].textView(), std::string_view("short"));
+    ASSERT_FALSE(read[2].isBorrowed());
+    ASSERT_EQ(read[3].string(), longText);
+    ASSERT_EQ(read[4].type(), SQLValue::BlobValue);
+    ASSERT_EQ(read[4].blobView(), std::string_view(blobData, sizeof(blobData)));
+    ASSERT_TRUE(read[5].isNull());
+
+    // Moving a heap payload leaves the source empty; copying duplicates it.
+    SQLValue copied = read[3];
+    SQLValue moved = std::move(read[3]);
+    ASSERT_EQ(moved.string(), longText);
+    ASSERT_EQ(copied.string(), longText);
+    ASSERT_TRUE(read[3].isNull());
+
+    // Borrowed values point at the caller's memory.
+    std::string borrowedSource("borrowed");
+    SQLValue borrowed = SQLValue::borrowedText(borrowedSource);
+    ASSERT_TRUE(borrowed.isBorrowed());
+    ASSERT_EQ(borrowed.textView().data(), borrowedSource.data());
+
+    // Every integral type makes an integer value, and floats a number.
+    const char buffer[7] = { };
+    ASSERT_EQ(SQLValue(5).type(), SQLValue::IntegerValue);
+    ASSERT_EQ(SQLValue(5u).integer(), 5);
+    ASSERT_EQ(SQLValue(5LL).integer(), 5);
+    ASSERT_EQ(SQLValue(static_cast<short>(-5)).integer(), -5);
+    ASSERT_EQ(SQLValue(sizeof(buffer)).type(), SQLValue::IntegerValue);
+    ASSERT_EQ(SQLValue(sizeof(buffer)).integer(), 7);
+    ASSERT_EQ(SQLValue(1.5f).type(), SQLValue::NumberValue);
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_async_log_sink)
+{
+    std::vector<std::string> lines;
+    SQLiteAsyncLogSink sink(64, [&lines](int level, const std::string& message) {
+        if (level >= SQLITE_LOG_LEVEL_INFO)
+            lines.push_back(message);
+    });
+    ASSERT_TRUE(sink.install());
+    SQLiteAsyncLogSink second;
+    ASSERT_FALSE(second.install());
+
+    // Several threads log at once without blocking each other.
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([t]() {
+            for (int i = 0; i < 10; ++i)
+                SQLITE_LOG(ERROR) << "thread " << t << " line " << i;
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    sink.flush();
+
+    ASSERT_EQ(lines.size() + sink.dropped(), 40u);
+    ASSERT_FALSE(lines.empty());
+    ASSERT_NE(lines[0].find("test_SQLite.cpp:"), std::string::npos);
+
+    // Levels below SQLITE_LOG_LEVEL are compiled out, arguments included.
+    int evaluated = 0;
+    SQLITE_LOG(TRACE) << ++evaluated;
+    ASSERT_EQ(evaluated, SQLITE_LOG_LEVEL_TRACE < SQLITE_LOG_LEVEL ? 0 : 1);
+
+    sink.uninstall();
+    ASSERT_EQ(SQLiteAsyncLogSink::installed(), static_cast<SQLiteAsyncLogSink*>(0));
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_locked_cursor_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE number (n INTEGER)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("WITH RECURSIVE c(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM c WHERE n < 1000) INSERT INTO number SELECT n FROM c")).executeCommand());
+    ASSERT_EQ(sqliteDB->lastChanges(), 1000);
+
+    // A read-only scan leaves lastChanges() alone.
+    SQLiteStatement select(*sqliteDB, std::string("SELECT n FROM number"));
+    int64_t total = 0;
+    {
+        SQLiteLockedCursor cursor(select);
+        ASSERT_TRUE(cursor.isReadOnly());
+        int result;
+        while ((result = cursor.step()) == SQLResultRow)
+            total += select.getColumnInt64(0);
+        ASSERT_EQ(result, SQLResultDone);
+    }
+    ASSERT_EQ(total, 500500);
+    ASSERT_EQ(sqliteDB->lastChanges(), 1000);
+    select.finalize();
+
+    // Writes still count their changes.
+    SQLiteStatement update(*sqliteDB, std::string("UPDATE number SET n = n + 1 WHERE n <= 10"));
+    {
+        SQLiteLockedCursor cursor(update);
+        ASSERT_FALSE(cursor.isReadOnly());
+        ASSERT_EQ(cursor.step(), SQLResultDone);
+        cursor.release();
+        ASSERT_EQ(cursor.step(), SQLITE_MISUSE);
+    }
+    ASSERT_EQ(sqliteDB->lastChanges(), 10);
+    update.finalize();
+
+    // Calls on the cursor's own statement do not take the lock again, and
+    // cursor steps are timed for the slow query log.
+    const std::string filenameLog("testCursorSlowQueries.log");
+    SQLiteSlowQueryLogOptions options;
+    options.path = filenameLog;
+    options.threshold = std::chrono::microseconds(0);
+    SQLiteSlowQueryLog& slowQueryLog = sqliteDB->enableSlowQueryLog(options);
+    SQLiteStatement scan(*sqliteDB, std::string("SELECT n FROM number WHERE n > 995 ORDER BY n"));
+    {
+        SQLiteLockedCursor cursor(scan);
+        ASSERT_EQ(cursor.step(), SQLResultRow);
+        SQLiteQueryPlan plan;
+        ASSERT_EQ(scan.queryPlan(plan), SQLResultOk);
+        ASSERT_EQ(scan.reset(), SQLResultOk);
+        ASSERT_EQ(cursor.step(), SQLResultRow);
+        ASSERT_EQ(cursor.step(), SQLResultRow);
+        ASSERT_EQ(scan.finalize(), SQLResultOk);
+        // Prepares and steps again through the fallback.
+        ASSERT_EQ(scan.getColumnInt(0), 996);
+    }
+    scan.finalize();
+    slowQueryLog.flush();
+    ASSERT_GE(slowQueryLog.recordedCount(), 2u);
+    sqliteDB->disableSlowQueryLog();
+    std::remove(filenameLog.c_str());
+
+    // An interrupt from another thread is seen by the next step, while the
+    // interrupting thread waits for the cursor to let go of the lock.
+    SQLiteStatement interrupted(*sqliteDB, std::string("SELECT n FROM number"));
+    {
+        SQLiteLockedCursor cursor(interrupted);
+        ASSERT_EQ(cursor.step(), SQLResultRow);
+        std::thread interrupter([sqliteDB]() { sqliteDB->interrupt(); });
+        while (!sqliteDB->isInterruptRequested())
+            std::this_thread::yield();
+        EXPECT_EQ(cursor.step(), SQLResultInterrupt);
+        // The interrupted step let go of the lock, so interrupt() returns.
+        interrupter.join();
+    }
+    interrupted.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_profiler_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+    ASSERT_EQ(sqliteDB->profiler(), static_cast<SQLiteProfiler*>(0));
+
+    ASSERT_EQ(SQLiteProfiler::normalizeSQL("SELECT  *\n FROM t1 WHERE a = 12 AND b = 'it''s' "), std::string("SELECT * FROM t1 WHERE a = ? AND b = ?"));
+    for (size_t bucket = 0; bucket + 1 < SQLiteProfiler::histogramBuckets; ++bucket) {
+        ASSERT_EQ(SQLiteProfiler::bucketForNanoseconds(SQLiteProfiler::bucketLowerBound(bucket)), bucket);
+        ASSERT_EQ(SQLiteProfiler::bucketForNanoseconds(SQLiteProfiler::bucketUpperBound(bucket)), bucket);
+    }
+
+    SQLiteProfiler& profiler = sqliteDB->enableProfiling();
+
+    // Create a table
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)")).executeCommand());
+    for (int i = 0; i < 10; ++i)
+        ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO user (userID, lastName) VALUES (") + std::to_string(i) + ", 'Lehmann')").executeCommand());
+
+    // Statements stepped on another thread land in their own shard.
+    std::thread reader([sqliteDB]() {
+        SQLiteStatement select(*sqliteDB, std::string("SELECT userID FROM user"));
+        select.prepare();
+        while (select.step() == SQLResultRow) { }
+        select.finalize();
+    });
+    reader.join();
+
+    // Interleaved runs on one thread count rows against their own query.
+    SQLiteStatement low(*sqliteDB, std::string("SELECT userID FROM user WHERE userID < 3"));
+    SQLiteStatement names(*sqliteDB, std::string("SELECT lastName FROM user"));
+    ASSERT_EQ(low.prepare(), SQLResultOk);
+    ASSERT_EQ(names.prepare(), SQLResultOk);
+    int lowResult = SQLResultRow;
+    int namesResult = SQLResultRow;
+    while (lowResult == SQLResultRow || namesResult == SQLResultRow) {
+        if (lowResult == SQLResultRow)
+            lowResult = low.step();
+        if (namesResult == SQLResultRow)
+            namesResult = names.step();
+    }
+    low.finalize();
+    names.finalize();
+
+    std::vector<SQLiteProfiler::QueryStatistics> statistics = profiler.snapshot();
+    bool sawInsert = false;
+    bool sawSelect = false;
+    bool sawInterleaved = false;
+    for (size_t i = 0; i < statistics.size(); ++i) {
+        if (statistics[i].sql == "INSERT INTO user (userID, lastName) VALUES (?, ?)") {
+            sawInsert = true;
+            ASSERT_EQ(statistics[i].calls, 10u);
+            ASSERT_GT(statistics[i].totalNanoseconds, 0u);
+            ASSERT_LE(statistics[i].percentileNanoseconds(50), statistics[i].maxNanoseconds);
+        } else if (statistics[i].sql == "SELECT userID FROM user") {
+            sawSelect = true;
+            ASSERT_EQ(statistics[i].calls, 1u);
+            ASSERT_EQ(statistics[i].rows, 10u);
+        } else if (statistics[i].sql == "SELECT userID FROM user WHERE userID < ?") {
+            sawInterleaved = true;
+            ASSERT_EQ(statistics[i].rows, 3u);
+        } else if (statistics[i].sql == "SELECT lastName FROM user") {
+            ASSERT_EQ(statistics[i].rows, 10u);
+        }
+    }
+    ASSERT_TRUE(sawInsert);
+    ASSERT_TRUE(sawSelect);
+    ASSERT_TRUE(sawInterleaved);
+    ASSERT_NE(profiler.dump().find("SELECT userID FROM user"), std::string::npos);
+
+    profiler.reset();
+    sqliteDB->disableProfiling();
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("SELECT count(*) FROM user")).returnsAtLeastOneResult());
+    statistics = profiler.snapshot();
+    for (size_t i = 0; i < statistics.size(); ++i)
+        ASSERT_EQ(statistics[i].calls, 0u);
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_status_counters_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    // Two unindexed tables, so that joining them builds an automatic index.
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE a (x INTEGER)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE b (x INTEGER)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("WITH RECURSIVE c(n) AS (SELECT 1 UNION ALL SELECT n + 1 FROM c WHERE n < 200) INSERT INTO a SELECT n FROM c")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("INSERT INTO b SELECT x FROM a")).executeCommand());
+
+    SQLiteStatement join(*sqliteDB, std::string("SELECT a.x FROM a, b WHERE a.x = b.x ORDER BY a.x DESC"));
+    ASSERT_EQ(join.prepare(), SQLResultOk);
+    int rows = 0;
+    while (join.step() == SQLResultRow)
+        ++rows;
+    ASSERT_EQ(rows, 200);
+
+    SQLiteStatement::StatementStatus status = join.statementStatus();
+    ASSERT_GT(status.autoIndexes, 0);
+    ASSERT_GT(status.fullScanSteps, 0);
+    ASSERT_GT(status.vmSteps, 0);
+    ASSERT_EQ(status.runs, 1);
+    ASSERT_GT(status.memoryUsed, 0);
+    join.statementStatus(true);
+    ASSERT_EQ(join.statementStatus().vmSteps, 0);
+
+    SQLiteDatabase::ConnectionStatus connection = sqliteDB->connectionStatus();
+    ASSERT_GT(connection.cacheUsed, 0);
+    ASSERT_GT(connection.schemaUsed, 0);
+    ASSERT_GT(connection.statementUsed, 0);
+    ASSERT_EQ(connection.deferredForeignKeys, 0);
+
+    // The collector sees the statement while it is still prepared.
+    std::mutex samplesLock;
+    std::vector<SQLiteMetricsCollector::Sample> samples;
+    SQLiteMetricsCollector collector(*sqliteDB, std::chrono::milliseconds(5), [&](const SQLiteMetricsCollector::Sample& sample) {
+        std::lock_guard<std::mutex> lock(samplesLock);
+        samples.push_back(sample);
+    });
+    SQLiteMetricsCollector::Sample sample = collector.collect();
+    bool sawJoin = false;
+    for (size_t i = 0; i < sample.statements.size(); ++i)
+        sawJoin = sawJoin || sample.statements[i].sql == join.query();
+    ASSERT_TRUE(sawJoin);
+
+    collector.start();
+    ASSERT_TRUE(collector.isRunning());
+    for (int i = 0; i < 200; ++i) {
+        {
+            std::lock_guard<std::mutex> lock(samplesLock);
+            if (samples.size() >= 2)
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    collector.stop();
+    ASSERT_GE(samples.size(), 2u);
+    join.finalize();
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_query_plan_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL, age INTEGER)")).executeCommand());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE INDEX user_lastName ON user (lastName)")).executeCommand());
+
+    ASSERT_EQ(SQLiteQueryPlan::issuesForDetail("SCAN user"), static_cast<unsigned>(SQLiteQueryPlan::FullTableScan));
+    ASSERT_EQ(SQLiteQueryPlan::issuesForDetail("SCAN TABLE user"), static_cast<unsigned>(SQLiteQueryPlan::FullTableScan));
+    ASSERT_EQ(SQLiteQueryPlan::issuesForDetail("SCAN user USING COVERING INDEX user_lastName"), 0u);
+    ASSERT_EQ(SQLiteQueryPlan::issuesForDetail("SEARCH b USING AUTOMATIC COVERING INDEX (x=?)"), static_cast<unsigned>(SQLiteQueryPlan::AutomaticIndex));
+
+    // queryPlan() works without preparing the statement.
+    SQLiteQueryPlan plan;
+    SQLiteStatement lookup(*sqliteDB, std::string("SELECT age FROM user WHERE lastName = ?"));
+    ASSERT_EQ(lookup.queryPlan(plan), SQLResultOk);
+    ASSERT_FALSE(plan.isEmpty());
+    ASSERT_EQ(plan.issues(), 0u);
+    ASSERT_NE(plan.toString().find("user_lastName"), std::string::npos);
+
+    SQLiteProfiler& profiler = sqliteDB->enableProfiling();
+    SQLitePlanWatchdog& watchdog = sqliteDB->enablePlanWatchdog(false);
+    ASSERT_EQ(sqliteDB->planWatchdog(), &watchdog);
+
+    SQLiteStatement scan(*sqliteDB, std::string("SELECT lastName, count(*) FROM user WHERE age > 30 GROUP BY age ORDER BY count(*)"));
+    ASSERT_EQ(scan.prepare(), SQLResultOk);
+    scan.finalize();
+    // The second prepare comes from the statement cache and is not inspected.
+    ASSERT_EQ(scan.prepare(), SQLResultOk);
+    scan.finalize();
+    ASSERT_EQ(lookup.prepare(), SQLResultOk);
+    lookup.finalize();
+    // Only the literal differs, so the query has already been inspected.
+    SQLiteStatement otherAge(*sqliteDB, std::string("SELECT lastName, count(*) FROM user WHERE age > 40 GROUP BY age ORDER BY count(*)"));
+    ASSERT_EQ(otherAge.prepare(), SQLResultOk);
+    otherAge.finalize();
+
+    ASSERT_EQ(watchdog.inspectedStatementCount(), 2u);
+    std::vector<SQLitePlanWatchdog::Finding> findings = watchdog.findings();
+    ASSERT_EQ(findings.size(), 1u);
+    ASSERT_EQ(findings[0].sql, scan.query());
+    ASSERT_TRUE(findings[0].issues & SQLiteQueryPlan::FullTableScan);
+    ASSERT_TRUE(findings[0].issues & SQLiteQueryPlan::TempBTreeForGroupBy);
+    ASSERT_TRUE(findings[0].issues & SQLiteQueryPlan::TempBTreeForOrderBy);
+    ASSERT_NE(watchdog.report().find("full table scan"), std::string::npos);
+
+    // The watchdog's EXPLAIN runs are not profiled.
+    ASSERT_EQ(profiler.dump().find("EXPLAIN"), std::string::npos);
+    sqliteDB->disableProfiling();
+
+    sqliteDB->disablePlanWatchdog();
+    ASSERT_EQ(sqliteDB->planWatchdog(), static_cast<SQLitePlanWatchdog*>(0));
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_slow_query_log_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    const std::string filenameLog("testSlowQueries.log");
+    std::shared_ptr<SQLiteDatabase> sqliteDB(new SQLiteDatabase());
+    std::remove(filenameLog.c_str());
+    std::remove((filenameLog + ".1").c_str());
+
+    // Open the db, if it doen't exist
+    // create it.
+    sqliteDB->open(filenameDB, false);
+    ASSERT_TRUE(sqliteDB->isOpen());
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)")).executeCommand());
+
+    // Every statement is slow; only the first three fit the rate limit.
+    SQLiteSlowQueryLogOptions options;
+    options.path = filenameLog;
+    options.threshold = std::chrono::microseconds(0);
+    options.maxRecordsPerSecond = 0;
+    options.burst = 3;
+    SQLiteSlowQueryLog& slowQueryLog = sqliteDB->enableSlowQueryLog(options);
+
+    for (int i = 0; i < 5; ++i) {
+        SQLiteStatement insert(*sqliteDB, std::string("INSERT INTO user (userID, lastName) VALUES (?, ?)"));
+        ASSERT_EQ(insert.prepare(), SQLResultOk);
+        insert.bindInt(1, i);
+        insert.bindText(2, "Lehmann");
+        ASSERT_EQ(insert.step(), SQLResultDone);
+        insert.finalize();
+    }
+    slowQueryLog.flush();
+    ASSERT_EQ(slowQueryLog.recordedCount(), 3u);
+    ASSERT_EQ(slowQueryLog.sampledOutCount(), 2u);
+
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(filenameLog.c_str());
+        for (std::string line; std::getline(file, line); )
+            lines.push_back(line);
+    }
+    ASSERT_EQ(lines.size(), 3u);
+    ASSERT_NE(lines[0].find("\"sql\":\"INSERT INTO user (userID, lastName) VALUES (?, ?)\""), std::string::npos);
+    ASSERT_NE(lines[0].find("VALUES (0, 'Lehmann')"), std::string::npos);
+    ASSERT_NE(lines[0].find("\"rows\":0"), std::string::npos);
+
+    // A small file size forces rotation; a select records its rows and plan.
+    options.maxRecordsPerSecond = 1000;
+    options.burst = 1000;
+    options.maxFileBytes = 256;
+    options.maxFiles = 1;
+    sqliteDB->enableSlowQueryLog(options);
+    SQLiteStatement select(*sqliteDB, std::string("SELECT lastName FROM user"));
+    ASSERT_EQ(select.prepare(), SQLResultOk);
+    while (select.step() == SQLResultRow) { }
+    select.finalize();
+    slowQueryLog.flush();
+    {
+        std::ifstream rotated((filenameLog + ".1").c_str());
+        ASSERT_TRUE(rotated.good());
+        std::ifstream file(filenameLog.c_str());
+        std::string line;
+        std::getline(file, line);
+        ASSERT_NE(line.find("\"rows\":5"), std::string::npos);
+        ASSERT_NE(line.find("SCAN"), std::string::npos);
+    }
+
+    // Counters are those of the slow run only, although the cached handle
+    // already ran four times before.
+    sqliteDB->disableSlowQueryLog();
+    const std::string scanSQL("SELECT lastName FROM user WHERE lastName <> 'Burgdorf'");
+    for (int run = 0; run < 5; ++run) {
+        if (run == 4) {
+            options.maxFileBytes = 1 << 20;
+            sqliteDB->enableSlowQueryLog(options);
+        }
+        SQLiteStatement scan(*sqliteDB, scanSQL);
+        ASSERT_EQ(scan.prepare(), SQLResultOk);
+        while (scan.step() == SQLResultRow) { }
+        scan.finalize();
+    }
+    slowQueryLog.flush();
+    {
+        std::ifstream file(filenameLog.c_str());
+        std::string line;
+        for (std::string next; std::getline(file, next); )
+            line = next;
+        ASSERT_NE(line.find("lastName <> ?"), std::string::npos);
+        ASSERT_NE(line.find("\"runs\":1,"), std::string::npos) << line;
+        ASSERT_NE(line.find("\"fullScanSteps\":4,"), std::string::npos) << line;
+    }
+
+    // The log's own setOptions() changes the threshold too.
+    uint64_t recorded = slowQueryLog.recordedCount();
+    options.threshold = std::chrono::hours(1);
+    slowQueryLog.setOptions(options);
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("SELECT count(*) FROM user")).returnsAtLeastOneResult());
+    slowQueryLog.flush();
+    ASSERT_EQ(slowQueryLog.recordedCount(), recorded);
+
+    // Disabled, nothing more is recorded.
+    options.threshold = std::chrono::microseconds(0);
+    slowQueryLog.setOptions(options);
+    sqliteDB->disableSlowQueryLog();
+    ASSERT_TRUE(SQLiteStatement(*sqliteDB, std::string("SELECT count(*) FROM user")).returnsAtLeastOneResult());
+    ASSERT_EQ(slowQueryLog.recordedCount(), recorded);
+
+    // Close db file.
+    sqliteDB->close();
+    ASSERT_FALSE(sqliteDB->isOpen());
+
+    // Remove files.
+    std::remove(filenameDB.c_str());
+    std::remove(filenameLog.c_str());
+    std::remove((filenameLog + ".1").c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_async_database_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    AsyncSQLiteDatabase asyncDB;
+
+    // Requests queue up without waiting for each other.
+    std::future<bool> opened = asyncDB.open(filenameDB);
+    std::future<bool> created = asyncDB.executeAsync("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)");
+    std::vector<std::future<bool> > inserts;
+    for (int i = 0; i < 10; ++i) {
+        inserts.push_back(asyncDB.executeAsync("INSERT INTO user (userID, lastName) VALUES (?, ?)", [i](SQLiteStatement& statement) {
+            statement.bindInt(1, i);
+            statement.bindText(2, "Lehmann");
+        }));
+    }
+    ASSERT_TRUE(opened.get());
+    ASSERT_TRUE(created.get());
+    for (size_t i = 0; i < inserts.size(); ++i)
+        ASSERT_TRUE(inserts[i].get());
+
+    // A failing body rolls the transaction back.
+    std::future<bool> rolledBack = asyncDB.transactionAsync([](SQLiteDatabase& db) {
+        db.executeCommand("DELETE FROM user");
+        return false;
+    });
+    std::future<bool> committed = asyncDB.transactionAsync([](SQLiteDatabase& db) {
+        return db.executeCommand("UPDATE user SET lastName = 'Burgdorf' WHERE userID = 3");
+    });
+    ASSERT_FALSE(rolledBack.get());
+    ASSERT_TRUE(committed.get());
+
+    AsyncSQLiteDatabase::QueryResult result = asyncDB.queryAsync("SELECT userID, lastName FROM user WHERE userID >= ? ORDER BY userID", [](SQLiteStatement& statement) {
+        statement.bindInt(1, 2);
+    }).get();
+    ASSERT_EQ(result.result, SQLResultDone);
+    ASSERT_EQ(result.columnNames, std::vector<std::string>({ "userID", "lastName" }));
+    ASSERT_EQ(result.rows.size(), 8u);
+    ASSERT_EQ(result.rows[1][0].integer(), 3);
+    ASSERT_EQ(result.rows[1][1].string(), std::string("Burgdorf"));
+
+    // Callbacks run on the worker thread.
+    std::promise<std::thread::id> callbackThread;
+    asyncDB.queryAsync("SELECT count(*) FROM user", AsyncSQLiteDatabase::Binder(), [&callbackThread](AsyncSQLiteDatabase::QueryResult&& result) {
+        callbackThread.set_value(result.rows.size() == 1 ? std::this_thread::get_id() : std::thread::id());
+    });
+    std::thread::id workerThread = callbackThread.get_future().get();
+    ASSERT_NE(workerThread, std::thread::id());
+    ASSERT_NE(workerThread, std::this_thread::get_id());
+
+    ASSERT_EQ(asyncDB.submit([](SQLiteDatabase& db) { return db.tableExists("user"); }).get(), true);
+
+    // Exceptions neither stop the worker nor lose the callback.
+    std::promise<bool> thrownCompletion;
+    asyncDB.transactionAsync([](SQLiteDatabase& db) -> bool {
+        db.executeCommand("INSERT INTO user (userID, lastName) VALUES (1000, 'Burgdorf')");
+        throw std::runtime_error("body failed");
+    }, [&thrownCompletion](bool committed) { thrownCompletion.set_value(committed); });
+    asyncDB.post([](SQLiteDatabase&) { throw std::runtime_error("task failed"); });
+    ASSERT_FALSE(thrownCompletion.get_future().get());
+    ASSERT_THROW(asyncDB.submit([](SQLiteDatabase&) -> bool { throw std::runtime_error("task failed"); }).get(), std::runtime_error);
+    ASSERT_EQ(asyncDB.submit([](SQLiteDatabase& db) { return db.returnsAtLeastOneResult("SELECT * FROM user WHERE userID = 1000"); }).get(), false);
+
+    asyncDB.close().get();
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_connection_pool_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    SQLiteConnectionPool pool;
+
+    ASSERT_TRUE(pool.open(filenameDB, 2));
+    ASSERT_EQ(pool.readerCount(), 2u);
+
+    {
+        SQLiteConnectionPool::Lease writer = pool.writer();
+        ASSERT_TRUE(writer.isValid());
+        ASSERT_TRUE(writer->executeCommand("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)"));
+        ASSERT_TRUE(writer->executeCommand("INSERT INTO user (userID, lastName) VALUES (1, 'Lehmann')"));
+        // Only one writer at a time.
+        ASSERT_FALSE(pool.tryWriter().isValid());
+    }
+
+    {
+        // Readers see committed data and cannot write.
+        SQLiteConnectionPool::Lease reader = pool.reader();
+        ASSERT_TRUE(reader->returnsAtLeastOneResult("SELECT * FROM user"));
+        ASSERT_FALSE(reader->executeCommand("DELETE FROM user"));
+
+        SQLiteStatement journalMode(*reader, "PRAGMA journal_mode");
+        ASSERT_EQ(journalMode.prepare(), SQLResultOk);
+        ASSERT_EQ(journalMode.step(), SQLResultRow);
+        ASSERT_EQ(journalMode.getColumnText(0), std::string("wal"));
+    }
+
+    // The same thread gets its reader back.
+    SQLiteDatabase* first = &pool.reader().database();
+    ASSERT_EQ(&pool.reader().database(), first);
+
+    // Readers run next to the writer and next to each other.
+    SQLiteConnectionPool::Lease writer = pool.writer();
+    std::vector<std::thread> threads;
+    std::atomic<int> rowsRead(0);
+    for (int i = 0; i < 4; ++i) {
+        threads.push_back(std::thread([&pool, &rowsRead] {
+            for (int j = 0; j < 50; ++j) {
+                SQLiteConnectionPool::Lease reader = pool.reader();
+                SQLiteStatement select(*reader, "SELECT count(*) FROM user");
+                if (select.prepare() == SQLResultOk && select.step() == SQLResultRow)
+                    rowsRead += select.getColumnInt(0);
+            }
+        }));
+    }
+    for (size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+    writer.release();
+    ASSERT_EQ(rowsRead.load(), 200);
+
+    SQLiteConnectionPool::Statistics statistics = pool.statistics();
+    ASSERT_EQ(statistics.writerLeases, 2);
+    ASSERT_EQ(statistics.readerLeases, 203);
+    ASSERT_EQ(statistics.affinityHits + statistics.affinityMisses, 203);
+    ASSERT_GE(statistics.affinityHits, 2);
+    ASSERT_LE(statistics.peakBusyReaders, 2u);
+    ASSERT_EQ(statistics.busyReaders, 0u);
+    ASSERT_EQ(statistics.connections, 3u);
+    ASSERT_GT(statistics.utilization(), 0);
+    ASSERT_LE(statistics.utilization(), 1);
+
+    pool.close();
+    ASSERT_FALSE(pool.reader().isValid());
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+    std::remove((filenameDB + "-wal").c_str());
+    std::remove((filenameDB + "-shm").c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_wal_checkpointer_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    SQLiteDatabase db;
+
+    ASSERT_TRUE(db.open(":memory:"));
+    ASSERT_FALSE(db.setJournalMode(SQLiteDatabase::JournalWAL));
+    db.close();
+
+    ASSERT_TRUE(db.open(filenameDB));
+    ASSERT_TRUE(db.setJournalMode(SQLiteDatabase::JournalWAL));
+    db.setWALAutoCheckpoint(0);
+    ASSERT_EQ(db.walAutoCheckpoint(), 0);
+    ASSERT_TRUE(db.executeCommand("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)"));
+
+    int walFrames;
+    int checkpointedFrames;
+    ASSERT_EQ(db.checkpoint(SQLiteDatabase::CheckpointPassive, &walFrames, &checkpointedFrames), SQLResultOk);
+    ASSERT_GT(walFrames, 0);
+    ASSERT_EQ(checkpointedFrames, walFrames);
+    db.setWALAutoCheckpoint(1000);
+    db.setBusyTimeout(5000);
+
+    SQLiteCheckpointer::Options options;
+    options.interval = std::chrono::milliseconds(60000);
+    options.walFrameThreshold = 10;
+    SQLiteCheckpointer checkpointer(db, options);
+    ASSERT_TRUE(checkpointer.start());
+
+    // Stored for after stop(); the checkpointer keeps its hook.
+    db.setWALAutoCheckpoint(2000);
+    ASSERT_EQ(db.walAutoCheckpoint(), 2000);
+
+    // Commits past the threshold wake the checkpointer instead of checkpointing themselves.
+    for (int i = 0; i < 20; ++i)
+        ASSERT_TRUE(db.executeCommand("INSERT INTO user (lastName) VALUES ('Lehmann')"));
+    for (int i = 0; i < 500 && !checkpointer.statistics().checkpoints; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    SQLiteCheckpointer::Statistics statistics = checkpointer.statistics();
+    ASSERT_GE(statistics.checkpoints, 1);
+    ASSERT_GT(statistics.framesCheckpointed, 0);
+    ASSERT_GT(statistics.lastDurationNanoseconds, 0);
+
+    // With no reader in the WAL, the checkpoint escalates and truncates it.
+    ASSERT_TRUE(db.executeCommand("INSERT INTO user (lastName) VALUES ('Burgdorf')"));
+    ASSERT_EQ(checkpointer.checkpointNow(), SQLResultOk);
+    statistics = checkpointer.statistics();
+    ASSERT_GE(statistics.escalations, 1);
+    ASSERT_EQ(statistics.walFrames, 0);
+    ASSERT_EQ(statistics.walBytes, 0);
+    std::ifstream wal((filenameDB + "-wal").c_str(), std::ios::binary | std::ios::ate);
+    ASSERT_EQ(static_cast<int64_t>(wal.tellg()), 0);
+
+    checkpointer.stop();
+    ASSERT_EQ(checkpointer.checkpointNow(), SQLITE_MISUSE);
+    db.close();
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+    std::remove((filenameDB + "-wal").c_str());
+    std::remove((filenameDB + "-shm").c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_group_commit_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    SQLiteDatabase db;
+
+    ASSERT_TRUE(db.open(filenameDB));
+    ASSERT_TRUE(db.executeCommand("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)"));
+    db.disableThreadingChecks();
+
+    SQLiteGroupCommitQueue::Options options;
+    options.maxBatchSize = 64;
+    options.maxDelay = std::chrono::milliseconds(20);
+    SQLiteGroupCommitQueue queue(db, options);
+    ASSERT_FALSE(queue.submit([](SQLiteDatabase&) { return true; }).get());
+    queue.start();
+
+    // Every fifth write inserts its row and then fails; only that row is rolled back.
+    std::vector<std::future<bool> > results(200);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.push_back(std::thread([t, &queue, &results] {
+            for (int i = t; i < 200; i += 4) {
+                results[i] = queue.submit([i](SQLiteDatabase& db) {
+                    return db.executeCommand("INSERT INTO user (userID, lastName) VALUES (" + std::to_string(i) + ", 'Lehmann')") && i % 5;
+                });
+            }
+        }));
+    }
+    for (size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+    for (int i = 0; i < 200; ++i)
+        ASSERT_EQ(results[i].get(), i % 5 != 0) << i;
+
+    SQLiteStatement count(db, "SELECT count(*) FROM user");
+    ASSERT_EQ(count.getColumnInt(0), 160);
+    count.finalize();
+    ASSERT_FALSE(db.returnsAtLeastOneResult("SELECT * FROM user WHERE userID = 5"));
+
+    SQLiteGroupCommitQueue::Statistics statistics = queue.statistics();
+    ASSERT_EQ(statistics.writesCommitted, 160);
+    ASSERT_EQ(statistics.writesRolledBack, 40);
+    ASSERT_EQ(statistics.failedBatches, 0);
+    ASSERT_LT(statistics.batches, 200);
+    ASSERT_LE(statistics.maxBatchSize, 64u);
+
+    // A closure that throws is rolled back alone, and its future rethrows.
+    std::future<bool> thrown = queue.submit([](SQLiteDatabase& db) -> bool {
+        db.executeCommand("INSERT INTO user (userID, lastName) VALUES (1000, 'Burgdorf')");
+        throw std::runtime_error("write failed");
+    });
+    std::future<bool> kept = queue.submit([](SQLiteDatabase& db) { return db.executeCommand("INSERT INTO user (userID, lastName) VALUES (1001, 'Burgdorf')"); });
+    ASSERT_THROW(thrown.get(), std::runtime_error);
+    ASSERT_TRUE(kept.get());
+    ASSERT_FALSE(db.returnsAtLeastOneResult("SELECT * FROM user WHERE userID = 1000"));
+    ASSERT_TRUE(db.returnsAtLeastOneResult("SELECT * FROM user WHERE userID = 1001"));
+
+    // Writes still queued are committed by stop().
+    std::future<bool> last = queue.submit([](SQLiteDatabase& db) { return db.executeCommand("DELETE FROM user"); });
+    queue.stop();
+    ASSERT_TRUE(last.get());
+    ASSERT_FALSE(db.returnsAtLeastOneResult("SELECT * FROM user"));
+    ASSERT_FALSE(db.transactionInProgress());
+
+    db.close();
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_nested_transaction_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    SQLiteDatabase db;
+
+    ASSERT_TRUE(db.open(filenameDB));
+    ASSERT_TRUE(db.executeCommand("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)"));
+
+    SQLiteTransaction outer(db);
+    outer.begin();
+    ASSERT_TRUE(outer.inProgress());
+    ASSERT_FALSE(outer.isNested());
+    ASSERT_EQ(db.transactionDepth(), 1);
+    ASSERT_TRUE(db.executeCommand("INSERT INTO user (userID, lastName) VALUES (1, 'Lehmann')"));
+
+    {
+        // A rolled back inner transaction only undoes its own changes.
+        SQLiteTransaction inner(db);
+        inner.begin();
+        ASSERT_TRUE(inner.isNested());
+        ASSERT_EQ(db.transactionDepth(), 2);
+        ASSERT_TRUE(db.executeCommand("INSERT INTO user (userID, lastName) VALUES (2, 'Burgdorf')"));
+
+        SQLiteTransaction innermost(db);
+        innermost.begin();
+        ASSERT_EQ(db.transactionDepth(), 3);
+        ASSERT_TRUE(db.executeCommand("INSERT INTO user (userID, lastName) VALUES (3, 'Hahn')"));
+        innermost.commit();
+        ASSERT_FALSE(innermost.inProgress());
+        ASSERT_EQ(db.transactionDepth(), 2);
+
+        inner.rollback();
+        ASSERT_EQ(db.transactionDepth(), 1);
+        ASSERT_TRUE(db.transactionInProgress());
+    }
+
+    {
+        // Going out of scope rolls back as well.
+        SQLiteTransaction inner(db);
+        inner.begin();
+        ASSERT_TRUE(db.executeCommand("INSERT INTO user (userID, lastName) VALUES (4, 'Weber')"));
+    }
+
+    {
+        SQLiteTransaction inner(db);
+        inner.begin();
+        ASSERT_TRUE(db.executeCommand("INSERT INTO user (userID, lastName) VALUES (5, 'Fischer')"));
+        inner.commit();
+    }
+    ASSERT_EQ(db.transactionDepth(), 1);
+
+    outer.commit();
+    ASSERT_FALSE(db.transactionInProgress());
+    ASSERT_EQ(db.transactionDepth(), 0);
+
+    SQLiteStatement select(db, "SELECT group_concat(userID) FROM user");
+    ASSERT_EQ(select.getColumnText(0), std::string("1,5"));
+    select.finalize();
+
+    // Rolling back the outer transaction also ends the ones nested in it.
+    outer.begin();
+    SQLiteTransaction inner(db);
+    inner.begin();
+    ASSERT_TRUE(db.executeCommand("DELETE FROM user"));
+    outer.rollback();
+    ASSERT_EQ(db.transactionDepth(), 0);
+    inner.commit();
+    ASSERT_FALSE(inner.inProgress());
+    ASSERT_TRUE(db.returnsAtLeastOneResult("SELECT * FROM user"));
+
+    db.close();
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_retry_policy_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    SQLiteDatabase holder;
+    SQLiteDatabase db;
+
+    ASSERT_TRUE(holder.open(filenameDB));
+    ASSERT_TRUE(holder.executeCommand("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)"));
+    ASSERT_TRUE(db.open(filenameDB));
+    holder.disableThreadingChecks();
+
+    SQLiteRetryPolicy::Options options;
+    options.initialDelay = std::chrono::microseconds(200);
+    options.maxDelay = std::chrono::milliseconds(5);
+    SQLiteRetryPolicy policy(options);
+    for (int retry = 0; retry < 20; ++retry) {
+        std::chrono::microseconds delay = policy.backoffDelay(retry);
+        ASSERT_GE(delay.count(), std::min<int64_t>(200 << std::min(retry, 10), 5000) / 2 - 1);
+        ASSERT_LE(delay.count(), 5000);
+    }
+
+    // The writer lock is released while the retrying connection waits.
+    SQLiteTransaction held(holder);
+    held.begin();
+    ASSERT_TRUE(held.inProgress());
+    std::thread releaser([&held] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        held.commit();
+    });
+    SQLiteTransaction transaction(db);
+    transaction.begin(policy, "begin");
+    releaser.join();
+    ASSERT_TRUE(transaction.inProgress());
+    ASSERT_TRUE(db.executeCommand("INSERT INTO user (userID, lastName) VALUES (1, 'Lehmann')"));
+    transaction.commit(policy, "commit");
+    ASSERT_FALSE(transaction.inProgress());
+
+    SQLiteRetryPolicy::SiteStatistics statistics = policy.statistics("begin");
+    ASSERT_EQ(statistics.calls, 1);
+    ASSERT_GT(statistics.retries, 0);
+    ASSERT_EQ(statistics.failures, 0);
+    ASSERT_GE(statistics.busyWaitNanoseconds, 40000000);
+    ASSERT_EQ(policy.statistics("commit").retries, 0);
+
+    // Statements in autocommit mode are retried as well.
+    held.begin();
+    releaser = std::thread([&held] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        held.commit();
+    });
+    SQLiteStatement insert(db, "INSERT INTO user (userID, lastName) VALUES (2, 'Burgdorf')");
+    ASSERT_EQ(insert.prepare(), SQLResultOk);
+    ASSERT_EQ(insert.step(policy, SQLITE_CALL_SITE), SQLResultDone);
+    releaser.join();
+    insert.finalize();
+    ASSERT_EQ(policy.statistics().size(), 3u);
+
+    // The policy gives up after maxTotalWait.
+    options.maxTotalWait = std::chrono::milliseconds(30);
+    SQLiteRetryPolicy impatient(options);
+    held.begin();
+    transaction.begin(impatient, "begin");
+    ASSERT_FALSE(transaction.inProgress());
+    ASSERT_EQ(impatient.statistics("begin").failures, 1);
+
+    // A std::function busy handler, called by SQLite itself.
+    int calls = 0;
+    db.setBusyHandler([&calls](int count) {
+        ++calls;
+        return count < 3;
+    });
+    ASSERT_FALSE(db.executeCommand("DELETE FROM user"));
+    ASSERT_EQ(calls, 4);
+
+    db.setBusyHandler(impatient.busyHandler("handler"));
+    ASSERT_FALSE(db.executeCommand("DELETE FROM user"));
+    ASSERT_EQ(impatient.statistics("handler").failures, 1);
+    ASSERT_EQ(impatient.statistics("handler").retries, options.maxRetries);
+    db.setBusyHandler(SQLiteDatabase::BusyHandler());
+
+    held.rollback();
+
+    // Dropping a table the connection is still reading stays locked however
+    // long it waits, so it is not retried.
+    SQLiteStatement reader(db, "SELECT userID FROM user");
+    ASSERT_EQ(reader.prepare(), SQLResultOk);
+    ASSERT_EQ(reader.step(), SQLResultRow);
+    int dropResult = policy.run(db, "drop", [&db]() {
+        SQLiteStatement drop(db, "DROP TABLE user");
+        int error = drop.prepare();
+        return error == SQLResultOk ? drop.step() : error;
+    });
+    ASSERT_EQ(dropResult & 0xff, SQLITE_LOCKED);
+    ASSERT_EQ(policy.statistics("drop").retries, 0);
+    ASSERT_EQ(policy.statistics("drop").failures, 0);
+    reader.finalize();
+
+    db.close();
+    holder.close();
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+
+#if SQLITE_HAS_COROUTINES
+// Minimal fire-and-forget coroutine type for driving the awaitables.
+struct SQLiteTestTask {
+    struct promise_type {
+        SQLiteTestTask get_return_object() { return SQLiteTestTask(); }
+        std::suspend_never initial_suspend() { return std::suspend_never(); }
+        std::suspend_never final_suspend() noexcept { return std::suspend_never(); }
+        void return_void() { }
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+static SQLiteTestTask readUsers(AsyncSQLiteDatabase& asyncDB, std::promise<std::vector<size_t> >& batchSizes, std::promise<int>& lastID)
+{
+    bool created = co_await asyncDB.execute("CREATE TABLE user (userID INTEGER NOT NULL PRIMARY KEY, lastName VARCHAR(50) NOT NULL)");
+    bool inserted = co_await asyncDB.transaction([](SQLiteDatabase& db) {
+        for (int i = 0; i < 10; ++i) {
+            if (!db.executeCommand("INSERT INTO user (lastName) VALUES ('Lehmann')"))
+                return false;
+        }
+        return true;
+    });
+
+    AsyncSQLiteDatabase::QueryResult result = co_await asyncDB.query("SELECT max(userID) FROM user");
+    lastID.set_value(created && inserted && result.rows.size() == 1 ? static_cast<int>(result.rows[0][0].integer()) : -1);
+
+    std::vector<size_t> sizes;
+    SQLiteRowStream rows = asyncDB.rowsAsync("SELECT userID FROM user WHERE userID > ? ORDER BY userID", [](SQLiteStatement& statement) {
+        statement.bindInt(1, 1);
+    }, 4);
+    while (true) {
+        SQLiteRowStream::Batch batch = co_await rows.next();
+        if (batch.empty())
+            break;
+        sizes.push_back(batch.size());
+    }
+    if (rows.result() != SQLResultDone)
+        sizes.clear();
+    batchSizes.set_value(sizes);
+}
+
+TEST(SQLiteWrapperCPPWebkit, test_async_coroutines_sqlitedb)
+{
+    const std::string filenameDB("testDB.db");
+    AsyncSQLiteDatabase asyncDB;
+    ASSERT_TRUE(asyncDB.open(filenameDB).get());
+
+    std::promise<std::vector<size_t> > batchSizes;
+    std::promise<int> lastID;
+    readUsers(asyncDB, batchSizes, lastID);
+
+    ASSERT_EQ(lastID.get_future().get(), 10);
+    ASSERT_EQ(batchSizes.get_future().get(), std::vector<size_t>({ 4, 4, 1 }));
+
+    asyncDB.close().get();
+
+    // Remove file.
+    std::remove(filenameDB.c_str());
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     ::testing::GTEST_FLAG(color) = "yes";